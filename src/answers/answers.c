@@ -3,21 +3,66 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include "./gen.h"
 #include "./types.h"
+#include "./decks.h"
 #include "files/files.h"
 #include "answers/answers.h"
 
-/* The array of answers.
+/* The answers, in an array indexed by game ID, and a bitset with a
+ * bit for each game that has an answer. The bitset is stored in
+ * unsigned longs, so that the games without answers can be skipped
+ * over a word at a time. The array entries for games without answers
+ * have a NULL text field.
  */
 static answerinfo *answers = NULL;
+static unsigned long *solved = NULL;
 static int answercount = 0;
 
-/* Callback for comparing two answerinfo objects.
+/* The number of bits in each word of the bitset.
  */
-static int answerinfocmp(void const *a, void const *b)
+#define WORDBITS  ((int)(CHAR_BIT * sizeof(unsigned long)))
+
+/* Macros for accessing a game's bit in the bitset.
+ */
+#define hasanswer(id)  ((solved[(id) / WORDBITS] >> ((id) % WORDBITS)) & 1)
+#define markanswer(id)  (solved[(id) / WORDBITS] |= 1UL << ((id) % WORDBITS))
+
+/* Free all memory associated with the answers array.
+ */
+static void deallocateanswers(void)
+{
+    int i;
+
+    for (i = 0 ; i < getdeckcount() ; ++i)
+        if (answers[i].text)
+            deallocate(answers[i].text);
+    deallocate(answers);
+    deallocate(solved);
+    answers = NULL;
+    solved = NULL;
+    answercount = 0;
+}
+
+/* Create the empty array and bitset.
+ */
+static void allocateanswers(void)
 {
-    return ((answerinfo const*)a)->id - ((answerinfo const*)b)->id;
+    int count, i;
+
+    count = getdeckcount();
+    answers = allocate(count * sizeof *answers);
+    for (i = 0 ; i < count ; ++i) {
+        answers[i].id = i;
+        answers[i].size = 0;
+        answers[i].text = NULL;
+    }
+    count = (count + WORDBITS - 1) / WORDBITS;
+    solved = allocate(count * sizeof *solved);
+    memset(solved, 0, count * sizeof *solved);
+    answercount = 0;
+    atexit(deallocateanswers);
 }
 
 /* Look up an answer. NULL is returned if the given game does not
@@ -25,61 +70,96 @@ static int answerinfocmp(void const *a, void const *b)
  */
 static answerinfo *getanswer(int id)
 {
-    answerinfo key;
-
-    key.id = id;
-    return bsearch(&key, answers, answercount, sizeof *answers,
-                   answerinfocmp);
+    if (!answers || id < 0 || id >= getdeckcount() || !hasanswer(id))
+        return NULL;
+    return &answers[id];
 }
 
-/* Introduce a new answer to the list of answers. This function
- * assumes that the caller has already verified that no answer
- * already exists for this game.
+/* Return the lowest ID at or above the given one that has an answer,
+ * or -1 if there is none.
  */
-static answerinfo *addanswer(int id)
+static int findanswerabove(int id)
 {
-    answerinfo *answer;
-
-    answers = reallocate(answers, (answercount + 1) * sizeof *answers);
-    answer = answers + answercount;
-    ++answercount;
-    answer->id = id;
-    answer->size = 0;
-    answer->text = NULL;
-    qsort(answers, answercount, sizeof *answers, answerinfocmp);
-    return getanswer(id);
+    unsigned long word;
+    int n, i;
+
+    n = (getdeckcount() + WORDBITS - 1) / WORDBITS;
+    i = id / WORDBITS;
+    if (i >= n)
+        return -1;
+    word = solved[i] & (~0UL << (id % WORDBITS));
+    while (!word) {
+        if (++i >= n)
+            return -1;
+        word = solved[i];
+    }
+    for (id = i * WORDBITS ; !(word & 1) ; word >>= 1)
+        ++id;
+    return id;
 }
 
-/* Free all memory associated with the answers array.
+/* Return the highest ID at or below the given one that has an answer,
+ * or -1 if there is none.
  */
-static void deallocateanswers(void)
+static int findanswerbelow(int id)
 {
-    int i;
+    unsigned long word;
+    int i, b;
+
+    i = id / WORDBITS;
+    word = solved[i] & (~0UL >> (WORDBITS - 1 - id % WORDBITS));
+    while (!word) {
+        if (--i < 0)
+            return -1;
+        word = solved[i];
+    }
+    for (b = WORDBITS - 1 ; !((word >> b) & 1) ; --b) ;
+    return i * WORDBITS + b;
+}
 
-    for (i = 0 ; i < answercount ; ++i)
-        if (answers[i].text)
-            deallocate(answers[i].text);
-    deallocate(answers);
-    answers = NULL;
-    answercount = 0;
+/* Introduce a new answer to the array of answers. This function
+ * assumes that the caller has already verified that no answer
+ * already exists for this game.
+ */
+static answerinfo *addanswer(int id)
+{
+    if (!answers)
+        allocateanswers();
+    markanswer(id);
+    ++answercount;
+    answers[id].size = 0;
+    answers[id].text = NULL;
+    return &answers[id];
 }
 
 /*
  * External functions.
  */
 
-/* Load the saved answers at the start of the program.
+/* Load the saved answers at the start of the program, and place them
+ * in the array. If the file has more than one answer for a game, the
+ * last one is used.
  */
 int initializeanswers(void)
 {
-    int n;
-
-    if (!answercount) {
-        n = loadanswerfile(&answers);
-        if (n > 0) {
-            answercount = n;
-            atexit(deallocateanswers);
+    answerinfo *list = NULL;
+    answerinfo *answer;
+    int n, i;
+
+    if (!answers) {
+        allocateanswers();
+        n = loadanswerfile(&list);
+        for (i = 0 ; i < n ; ++i) {
+            answer = getanswer(list[i].id);
+            if (answer)
+                deallocate(answer->text);
+            else
+                answer = addanswer(list[i].id);
+            answer->size = list[i].size;
+            answer->text = list[i].text;
         }
+        if (n >= 0)
+            deallocate(list);
     }
     return answercount;
 }
@@ -108,8 +188,14 @@ answerinfo const *getnearestanswer(int id)
 {
     int i;
 
-    for (i = 0 ; i < answercount && answers[i].id <= id ; ++i) ;
-    return i ? &answers[i - 1] : answers;
+    if (!answercount)
+        return NULL;
+    if (id >= getdeckcount())
+        id = getdeckcount() - 1;
+    i = id < 0 ? -1 : findanswerbelow(id);
+    if (i < 0)
+        i = findanswerabove(0);
+    return &answers[i];
 }
 
 /* Given an answer, return the first answer with a higher game ID.
@@ -117,16 +203,17 @@ answerinfo const *getnearestanswer(int id)
  */
 answerinfo const *getnextanswer(answerinfo const *answer)
 {
+    int i;
+
     if (!answer)
         return NULL;
-    ++answer;
-    if (answer == answers + answercount)
-        return NULL;
-    return answer;
+    i = findanswerabove(answer->id + 1);
+    return i < 0 ? NULL : &answers[i];
 }
 
-/* Add an answer to the list and update the answer file. If an answer
- * already exists for this game, it is replaced.
+/* Add an answer to the list and record it in the answer file's
+ * journal, or rewrite the answer file if the journal is full. If an
+ * answer already exists for this game, it is replaced.
  */
 int saveanswer(int gameid, char const *text)
 {
@@ -144,5 +231,16 @@ int saveanswer(int gameid, char const *text)
         deallocate(answer->text);
     answer->text = strallocate(text);
     answer->size = size;
-    return saveanswerfile(answers, answercount);
+    if (journalanswer(answer))
+        return TRUE;
+    return saveanswerfile(answers, getdeckcount());
+}
+
+/* Write the complete answer file, if the journal has any answers.
+ */
+int closeanswers(void)
+{
+    if (!answers)
+        return TRUE;
+    return closeanswerjournal(answers, getdeckcount());
 }
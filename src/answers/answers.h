@@ -60,9 +60,16 @@ extern int pickrandomunsolved(void);
  */
 extern int findnextunsolved(int startpos, int incr);
 
-/* Record the given string as a game's answer and write it to the
- * answer file. False is returned if the file cannot be updated.
+/* Record the given string as a game's answer and add it to the
+ * answer file's journal. False is returned if the file cannot be
+ * updated.
  */
 extern int saveanswer(int gameid, char const *text);
 
+/* Merge any answers held in the journal into the answer file. This
+ * should be done before the program exits, so that the answer file is
+ * left complete. False is returned if the file cannot be updated.
+ */
+extern int closeanswers(void);
+
 #endif
@@ -190,6 +190,10 @@ static void yowzitch(void)
         "  -t, --textmode        Use the non-graphical interface\n"
         "  -r, --readonly        Don't modify any files\n"
         "      --validate        Check user files for invalid data and exit\n"
+        "      --fsck            Check user files by checksum and exit\n"
+        "      --stats           Display redo session statistics and exit\n"
+        "      --pack            Store all sessions in one file and exit\n"
+        "      --unpack          Store sessions in separate files and exit\n"
         "      --dirs            Display the output directories and exit\n"
         "      --help            Display this help text and exit\n"
         "      --version         Display program version and exit\n"
@@ -229,6 +233,10 @@ static void readcmdline(int argc, char *argv[], settingsinfo *settings)
         { "textmode", no_argument, NULL, 't' },
         { "readonly", no_argument, NULL, 'r' },
         { "validate", no_argument, NULL, 'v' },
+        { "fsck", no_argument, NULL, 'k' },
+        { "stats", no_argument, NULL, 's' },
+        { "pack", no_argument, NULL, 'p' },
+        { "unpack", no_argument, NULL, 'u' },
         { "dirs", no_argument, NULL, 'd' },
         { "help", no_argument, NULL, 'H' },
         { "version", no_argument, NULL, 'V' },
@@ -240,6 +248,10 @@ static void readcmdline(int argc, char *argv[], settingsinfo *settings)
     char *cfgdir = NULL;
     char *datadir = NULL;
     int validateonly = FALSE;
+    int checkonly = FALSE;
+    int statsonly = FALSE;
+    int packonly = FALSE;
+    int unpackonly = FALSE;
     int dirdisplayonly = FALSE;
     char *p;
     long id;
@@ -252,6 +264,10 @@ static void readcmdline(int argc, char *argv[], settingsinfo *settings)
           case 't':     settings->forcetextmode = TRUE;         break;
           case 'r':     settings->readonly = TRUE;              break;
           case 'v':     validateonly = TRUE;                    break;
+          case 'k':     checkonly = TRUE;                       break;
+          case 's':     statsonly = TRUE;                       break;
+          case 'p':     packonly = TRUE;                        break;
+          case 'u':     unpackonly = TRUE;                      break;
           case 'd':     dirdisplayonly = TRUE;                  break;
           case 'H':     yowzitch();                             break;
           case 'V':     printflowedtext(versiontext);           break;
@@ -281,13 +297,24 @@ static void readcmdline(int argc, char *argv[], settingsinfo *settings)
         settings->gameid = (int)id;
     }
 
-    if (settings->readonly == TRUE || validateonly)
+    if (settings->readonly == TRUE || validateonly || checkonly ||
+                statsonly)
         setreadonly(TRUE);
     setfiledirectories(cfgdir, datadir, argv[0]);
     if (validateonly) {
         filevalidationloop();
         exit(EXIT_SUCCESS);
     }
+    if (checkonly)
+        exit(filecheckloop() ? EXIT_SUCCESS : EXIT_FAILURE);
+    if (statsonly) {
+        sessionstatsloop();
+        exit(EXIT_SUCCESS);
+    }
+    if (packonly)
+        exit(packsessions() ? EXIT_SUCCESS : EXIT_FAILURE);
+    if (unpackonly)
+        exit(unpacksessions() ? EXIT_SUCCESS : EXIT_FAILURE);
     if (dirdisplayonly) {
         printfiledirectories();
         exit(EXIT_SUCCESS);
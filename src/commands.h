@@ -36,6 +36,7 @@ enum {
     cmd_changesettings,         /* display the options settings */
     cmd_select,                 /* select a game (list display) */
     cmd_showhelp,               /* display the online help */
+    cmd_showstats,              /* toggle the session statistics display */
     cmd_redraw,                 /* re-render the game display */
     cmd_lastcmd
 };
@@ -70,6 +70,7 @@ static char const *commandshelptext =
     "Return to the previously viewed position  " GLYPH_DASH " \n"
     "Redraw the screen                         Ctrl-L\n"
     "Display the options menu                  Ctrl-O\n"
+    "Show or hide session statistics           Ctrl-D\n"
     "Display this help                         ? or F1\n"
     "Quit and select a new game                Q\n"
     "Quit and exit the program                 Shift-Q\n"
@@ -109,6 +109,7 @@ static command_t translategameinput(int ch)
       case 'S':             return cmd_swapbookmark;
       case '!':             return cmd_setminimalpath;
       case '\017':          return cmd_changesettings;
+      case '\004':          return cmd_showstats;
       case '?':             return cmd_showhelp;
       case 'q':             return cmd_quit;
       case 'Q':             return cmd_quitprogram;
@@ -173,10 +174,12 @@ static void drawnavinfo(gameplayinfo const *gameplay,
     redo_position const *unshiftpos;
     redo_position const *shiftpos;
     redo_branch const *branch;
+    int i;
 
     unshiftpos = NULL;
     shiftpos = NULL;
-    for (branch = position->next ; branch ; branch = branch->cdr) {
+    for (i = 0 ; i < (int)position->nextcount ; ++i) {
+        branch = position->next + i;
         if (branch->move == cardtomoveid1(gameplay->cardat[place]))
             unshiftpos = branch->p;
         else if (branch->move == cardtomoveid2(gameplay->cardat[place]))
@@ -235,13 +238,59 @@ static void drawbetterinfo(redo_position const *position)
     }
 }
 
+/* Output one line of the session statistics, with the label at the
+ * left and the value at the right of the information column. Large
+ * values are abbreviated in order to fit.
+ */
+static void drawstatline(int y, char const *label, unsigned long value)
+{
+    if (value < 100000)
+        mvprintw(y, rightcolumnx, "%-4s%6lu", label, value);
+    else if (value < 100000000)
+        mvprintw(y, rightcolumnx, "%-4s%5luk", label, value / 1000);
+    else
+        mvprintw(y, rightcolumnx, "%-4s%5luM", label, value / 1000000);
+}
+
+/* Output the redo session's statistics in the information column,
+ * underneath the game state indicators.
+ */
+static void drawsessionstats(redo_sessionstats const *stats)
+{
+    unsigned long n;
+    int y;
+
+    y = toprowy + 5;
+    textmode(MODEID_DARKER);
+    drawstatline(y++, "pos", stats->positions);
+    drawstatline(y++, "free", stats->freepositions);
+    drawstatline(y++, "brch", stats->branches);
+    n = stats->positionbytes + stats->branchbytes;
+    drawstatline(y++, "kB", n / 1024);
+    drawstatline(y++, "dep", stats->maxdepth);
+    drawstatline(y++, "grft", stats->grafts);
+    drawstatline(y++, "evct", stats->evictions);
+    drawstatline(y++, "look", stats->lookups);
+    drawstatline(y++, "prob", stats->probes);
+    drawstatline(y++, "cmp", stats->comparisons);
+    if (stats->hashsize)
+        mvprintw(y++, rightcolumnx, "hash%5lu%%",
+                 100 * stats->hashused / stats->hashsize);
+    n = stats->lookups - stats->hashrejects;
+    if (n)
+        mvprintw(y++, rightcolumnx, "fp%7lu%%", 100 * stats->falsehits / n);
+    textmode(MODEID_NORMAL);
+}
+
 /* Render the game display. At the top are placed the foundations and
  * the reserves, and below this is the main tableau of the layout.
  * After the cards are drawn, information about the game state is
- * placed in the right-hand column.
+ * placed in the right-hand column, along with the session statistics
+ * if they were supplied.
  */
 static void drawgamedisplay(gameplayinfo const *gameplay,
-                            redo_position const *position, int bookmark)
+                            redo_position const *position, int bookmark,
+                            redo_sessionstats const *stats)
 {
     card_t card;
     int showmoveable;
@@ -289,6 +338,8 @@ static void drawgamedisplay(gameplayinfo const *gameplay,
         mvaddstr(toprowy + 2, rightcolumnx, "STUCK");
     if (bookmark)
         mvaddstr(toprowy + 3, rightcolumnx, "mark ");
+    if (stats)
+        drawsessionstats(stats);
 
     if (saveiconshown) {
         if (time(NULL) > saveiconshown)
@@ -318,7 +369,8 @@ static void drawgamedisplay(gameplayinfo const *gameplay,
 void cursesui_rendergame(renderparams const *params)
 {
     if (validatesize())
-        drawgamedisplay(params->gameplay, params->position, params->bookmark);
+        drawgamedisplay(params->gameplay, params->position, params->bookmark,
+                        params->stats);
 }
 
 /* Retrieve a single key event. Commands to view help and redraw the
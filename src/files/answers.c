@@ -12,92 +12,258 @@
 #include "files/files.h"
 #include "internal.h"
 
+/* The name of the answer file.
+ */
+#define ANSWER_FILENAME  "brainjam.sol"
+
+/* The answers file ends with a line holding a checksum of the lines
+ * before it. The semicolon at the start marks the line as a comment
+ * in the original program's file format.
+ */
+#define CHECKSUM_LINE  ";crc32c=%08lx\n"
+
+/* Instead of rewriting the answer file every time an answer is added,
+ * the new answer is appended to a journal, which is kept alongside
+ * the answer file with ".jnl" appended to the name. The journal holds
+ * lines in the same form as the answer file, without the header. A
+ * line in the journal replaces any earlier answer for the same game.
+ * The journal is merged into the answer file once it grows past
+ * JOURNAL_LIMIT bytes, and when the journal is closed, so that the
+ * answer file itself remains in the original program's format.
+ */
+#define JOURNAL_LIMIT  16384
+
+/* The size of the journal, or -1 if the answer file has not been
+ * read yet.
+ */
+static long journalsize = -1;
+
+/* Return the pathname of the answer file's journal.
+ */
+static char *mkjournalpath(void)
+{
+    return mksettingspath(ANSWER_FILENAME ".jnl");
+}
+
+/* Check the checksum line at the end of the answers file, if there is
+ * one.
+ */
+static int verifyanswers(filebuffer const *buf)
+{
+    char line[32];
+    unsigned long value;
+    long pos;
+
+    if (!buf->size || buf->data[buf->size - 1] != '\n')
+        return CHECK_UNVERIFIED;
+    pos = buf->size - 1;
+    while (pos > 0 && buf->data[pos - 1] != '\n')
+        --pos;
+    if (buf->size - pos >= (long)sizeof line)
+        return CHECK_UNVERIFIED;
+    memcpy(line, buf->data + pos, buf->size - pos);
+    line[buf->size - pos] = '\0';
+    if (sscanf(line, ";crc32c=%8lx", &value) != 1)
+        return CHECK_UNVERIFIED;
+    return value == getchecksum(buf->data, pos) ? CHECK_VALID
+                                                 : CHECK_DAMAGED;
+}
+
+/* Parse the answer lines in a buffer, adding them to a growable
+ * array. Lines beginning with a semicolon are ignored. The lines are
+ * numbered from lineno, for the benefit of error messages.
+ */
+static void parseanswers(filebuffer *buf, char const *filename, int lineno,
+                         answerinfo **panswers, int *pcount, int *psize)
+{
+    answerinfo *answer;
+    char *line, *end;
+    int size, id;
+
+    putbyte(buf, '\0');
+    for (line = (char*)buf->data + buf->pos ; *line ; ++lineno, line = end) {
+        end = strchr(line, '\n');
+        if (end)
+            *end++ = '\0';
+        else
+            end = line + strlen(line);
+        if (*line == ';')
+            continue;
+        if (sscanf(line, "%4d=000%*[A-La-l](%d)", &id, &size) != 2 ||
+                        id < 0 || size < 0 || size > (int)strlen(line) - 8) {
+            fprintf(stderr, "%s:%d: invalid answer file entry\n",
+                    filename, lineno);
+            continue;
+        }
+        if (id >= getdeckcount()) {
+            fprintf(stderr, "%s:%d: invalid id: %d\n", filename, lineno, id);
+            continue;
+        }
+        if (*pcount == *psize) {
+            *psize = *psize ? 2 * *psize : 256;
+            *panswers = reallocate(*panswers, *psize * sizeof **panswers);
+        }
+        answer = *panswers + *pcount;
+        ++*pcount;
+        answer->id = id;
+        answer->size = size;
+        answer->text = allocate(size + 1);
+        memcpy(answer->text, line + 8, size);
+        answer->text[size] = '\0';
+    }
+}
+
 /*
  * External functions.
  */
 
-/* Read the answer file, if it hasn't been read already, and return
- * the array of answerinfo structs through panswers. The caller
- * inherits ownership of the array. (The unusual formatting of the
- * information in this file is inherited from the original Windows
- * program.)
+/* Read the answer file, if it hasn't been read already, followed by
+ * its journal, and return the array of answerinfo structs through
+ * panswers. The caller inherits ownership of the array. (The unusual
+ * formatting of the information in this file is inherited from the
+ * original Windows program.)
  */
 int loadanswerfile(answerinfo **panswers)
 {
-    char buf[512];
+    filebuffer buf = { NULL, 0, 0, 0 };
     answerinfo *answers;
-    FILE *fp;
     char *filename;
-    int lineno, maxcount;
-    int size, id, n;
+    int count, size;
 
-    filename = mksettingspath("brainjam.sol");
-    fp = fopen(filename, "r");
-    if (!fp) {
-        if (errno == ENOENT) {
-            deallocate(filename);
-            return 0;
-        } else {
-            perror(filename);
+    answers = NULL;
+    count = 0;
+    size = 0;
+    filename = mksettingspath(ANSWER_FILENAME);
+    waitforfile(filename);
+    if (readfile(filename, &buf)) {
+        if (verifyanswers(&buf) == CHECK_DAMAGED)
+            warn("%s: answer file checksum does not match", filename);
+        if (buf.size < 11 || memcmp(buf.data, "[Solutions]", 11)) {
+            fprintf(stderr, "%s: invalid answer file\n", filename);
             deallocate(filename);
+            deallocate(buf.data);
             return -1;
         }
-    }
-    if (!fgets(buf, sizeof buf, fp) || memcmp(buf, "[Solutions]", 11)) {
-        fprintf(stderr, "%s: invalid answer file\n", filename);
+        while (buf.pos < buf.size && buf.data[buf.pos++] != '\n') ;
+        parseanswers(&buf, filename, 2, &answers, &count, &size);
+    } else if (errno != ENOENT) {
+        perror(filename);
         deallocate(filename);
-        fclose(fp);
+        deallocate(buf.data);
         return -1;
     }
-    maxcount = getdeckcount();
-    answers = allocate(maxcount * sizeof *answers);
-    n = 0;
-    for (lineno = 1 ; fgets(buf, sizeof buf, fp) ; ++lineno) {
-        if (sscanf(buf, "%4d=000%*[A-La-l](%d)", &id, &size) != 2 || id < 0) {
-            fprintf(stderr, "%s:%d: invalid answer file entry\n",
-                    filename, lineno);
-            continue;
-        }
-        if (id >= maxcount) {
-            fprintf(stderr, "%s:%d: invalid id: %d\n", filename, lineno, id);
-            continue;
-        }
-        answers[n].id = id;
-        answers[n].size = size;
-        answers[n].text = allocate(size + 1);
-        memcpy(answers[n].text, buf + 8, size);
-        answers[n].text[size] = '\0';
-        ++n;
+    deallocate(filename);
+    deallocate(buf.data);
+
+    buf.data = NULL;
+    filename = mkjournalpath();
+    if (readfile(filename, &buf)) {
+        journalsize = buf.size;
+        parseanswers(&buf, filename, 1, &answers, &count, &size);
+    } else {
+        journalsize = 0;
+        if (errno != ENOENT)
+            perror(filename);
     }
-    fclose(fp);
     deallocate(filename);
+    deallocate(buf.data);
 
-    *panswers = reallocate(answers, n * sizeof *answers);
-    return n;
+    *panswers = answers;
+    return count;
 }
 
-/* Store the given array of answers to the answer file.
+/* Store the given array of answers to the answer file, followed by
+ * its checksum. Entries without any text are skipped. The journal is
+ * removed once the file has been saved.
  */
 int saveanswerfile(answerinfo const *answers, int count)
 {
+    filebuffer buf = { NULL, 0, 0, 0 };
+    char *filename, *journalname;
+    int f, i;
+
+    if (getreadonly())
+        return FALSE;
+    putformatted(&buf, "[Solutions]\n");
+    for (i = 0 ; i < count ; ++i)
+        if (answers[i].text)
+            putformatted(&buf, "%04d=000%s(%d)\n",
+                         answers[i].id, answers[i].text, answers[i].size);
+    putformatted(&buf, CHECKSUM_LINE, getchecksum(buf.data, buf.size));
+    filename = mksettingspath(ANSWER_FILENAME);
+    journalname = mkjournalpath();
+    f = savefilelater(filename, &buf, journalname);
+    if (f)
+        journalsize = 0;
+    deallocate(journalname);
+    deallocate(filename);
+    return f;
+}
+
+/* Append an answer to the journal. The journal is written to
+ * directly, after any pending save of the answer file has finished
+ * removing the old journal.
+ */
+int journalanswer(answerinfo const *answer)
+{
+    filebuffer buf = { NULL, 0, 0, 0 };
     FILE *fp;
     char *filename;
-    int i;
+    int f;
 
-    if (getreadonly())
+    if (getreadonly() || journalsize < 0 || journalsize > JOURNAL_LIMIT)
         return FALSE;
-    filename = mksettingspath("brainjam.sol");
-    fp = fopen(filename, "w");
-    if (!fp) {
+    putformatted(&buf, "%04d=000%s(%d)\n",
+                 answer->id, answer->text, answer->size);
+    filename = mkjournalpath();
+    waitforfile(filename);
+    fp = fopen(filename, "ab");
+    f = fp && fwrite(buf.data, buf.size, 1, fp) == 1;
+    if (fp && fclose(fp))
+        f = FALSE;
+    if (f)
+        journalsize += buf.size;
+    else
         perror(filename);
+    deallocate(filename);
+    deallocate(buf.data);
+    return f;
+}
+
+/* Merge the journal into the answer file, if it has anything in it.
+ */
+int closeanswerjournal(answerinfo const *answers, int count)
+{
+    if (journalsize <= 0)
+        return TRUE;
+    return saveanswerfile(answers, count);
+}
+
+/* Verify the answer file by its checksum alone. The journal has no
+ * checksum, so if there is one the answers are unverified.
+ */
+int checkanswerfile(void)
+{
+    filebuffer buf = { NULL, 0, 0, 0 };
+    FILE *fp;
+    char *filename;
+    int result;
+
+    filename = mksettingspath(ANSWER_FILENAME);
+    if (readfile(filename, &buf))
+        result = verifyanswers(&buf);
+    else
+        result = errno == ENOENT ? CHECK_VALID : CHECK_DAMAGED;
+    deallocate(buf.data);
+    deallocate(filename);
+    if (result == CHECK_VALID) {
+        filename = mkjournalpath();
+        fp = fopen(filename, "rb");
+        if (fp) {
+            fclose(fp);
+            result = CHECK_UNVERIFIED;
+        }
         deallocate(filename);
-        return FALSE;
     }
-    fputs("[Solutions]\n", fp);
-    for (i = 0 ; i < count ; ++i)
-        fprintf(fp, "%04d=000%s(%d)\n",
-                answers[i].id, answers[i].text, answers[i].size);
-    fclose(fp);
-    deallocate(filename);
-    return TRUE;
+    return result;
 }
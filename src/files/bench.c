@@ -0,0 +1,255 @@
+/* files/bench.c: A benchmarking program for the session files.
+ *
+ * This program is not part of the game. It is built on request, via
+ * "make session-bench". It builds a large synthetic session by making
+ * random moves in a single game, and then times writing the session
+ * to a file and reading it back in again. The results are printed as
+ * tab-separated lines, in the same form as the redo library's
+ * benchmarking program.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "./gen.h"
+#include "./types.h"
+#include "./decls.h"
+#include "./decks.h"
+#include "redo/redo.h"
+#include "game/game.h"
+#include "files/files.h"
+
+/* The benchmark parameters, as set by the command-line options.
+ */
+static long positioncount = 1000000;    /* positions in the session */
+static int maxdepth = 400;              /* the longest path to create */
+static int repeatcount = 5;             /* times to save and load */
+static int gameid = 1;                  /* the game to play */
+static char const *filename = "session-bench.tmp";
+
+/* The state of the random-number generator.
+ */
+static unsigned long randomseed = 1;
+
+/* Return a random number in the range [0, n).
+ */
+static long randomnumber(long n)
+{
+    randomseed = randomseed * 1103515245UL + 12345UL;
+    return (long)((randomseed >> 8) % (unsigned long)n);
+}
+
+/* Output the result of one benchmark, which processed a file of the
+ * given size repeatcount times.
+ */
+static void report(char const *name, long positions, long size,
+                   clock_t elapsed)
+{
+    double seconds, megabytes;
+
+    seconds = (double)elapsed / CLOCKS_PER_SEC;
+    megabytes = (double)size * repeatcount / 1000000.0;
+    printf("%s\t%ld\t%ld\t%d\t%.6f\t%.2f\n", name, positions, size,
+           repeatcount, seconds, seconds > 0 ? megabytes / seconds : 0.0);
+}
+
+/* Add positions to the session by making random moves. The walk
+ * returns to an earlier position whenever it reaches the maximum
+ * depth or fails to find a valid move, and also at random. The
+ * positions are added without checking for equivalent states, so that
+ * the time taken by those checks (which grows with the size of the
+ * session) does not swamp the time spent on the file itself.
+ */
+static void buildsession(redo_session *session, gameplayinfo *gameplay)
+{
+    redo_position *pos, *next;
+    movecmd_t cmd;
+    card_t card;
+    int moveid, tries, n;
+
+    pos = redo_getfirstposition(session);
+    tries = 0;
+    while (redo_getsessionsize(session) < positioncount) {
+        if (tries > 64 || pos->movecount >= maxdepth ||
+                                        randomnumber(32) == 0) {
+            for (n = randomnumber(pos->movecount + 1) ; n ; --n)
+                pos = pos->prev;
+            restoresavedstate(gameplay, pos);
+            tries = 0;
+            continue;
+        }
+        ++tries;
+        cmd = (randomnumber(2) ? 'a' : 'A') + randomnumber(MOVEABLE_PLACE_COUNT);
+        card = gameplay->cardat[movecmdtoplace(cmd)];
+        if (!applymove(gameplay, cmd))
+            continue;
+        moveid = mkmoveid(card, ismovecmd2(cmd));
+        next = redo_getnextposition(pos, moveid);
+        if (!next)
+            next = recordgamestate(gameplay, session, pos, moveid,
+                                   redo_nocheck);
+        if (!next) {
+            fprintf(stderr, "redo_addposition() failed\n");
+            exit(EXIT_FAILURE);
+        }
+        pos = next;
+        tries = 0;
+    }
+    restoresavedstate(gameplay, redo_getfirstposition(session));
+}
+
+/* Return the size of the session file.
+ */
+static long getfilesize(void)
+{
+    FILE *fp;
+    long size;
+
+    fp = fopen(filename, "rb");
+    if (!fp || fseek(fp, 0, SEEK_END) || (size = ftell(fp)) < 0) {
+        perror(filename);
+        exit(EXIT_FAILURE);
+    }
+    fclose(fp);
+    return size;
+}
+
+/* Write the session out to the session file repeatedly. The return
+ * value is the size of the file.
+ */
+static long benchsavesession(redo_session *session)
+{
+    clock_t start, elapsed;
+    long size;
+    int i;
+
+    start = clock();
+    for (i = 0 ; i < repeatcount ; ++i) {
+        if (!savesession(session)) {
+            fprintf(stderr, "savesession() failed\n");
+            exit(EXIT_FAILURE);
+        }
+        finishsaving();
+    }
+    elapsed = clock() - start;
+    size = getfilesize();
+    report("savesession", redo_getsessionsize(session), size, elapsed);
+    return size;
+}
+
+/* Read the session file back in repeatedly, emptying the session each
+ * time, and verify that it is restored to its original size.
+ */
+static void benchloadsession(redo_session *session, gameplayinfo *gameplay,
+                             long size)
+{
+    clock_t start, elapsed;
+    int count, i;
+
+    count = redo_getsessionsize(session);
+    elapsed = 0;
+    for (i = 0 ; i < repeatcount ; ++i) {
+        if (!reinitializegame(gameplay, session)) {
+            fprintf(stderr, "reinitializegame() failed\n");
+            exit(EXIT_FAILURE);
+        }
+        start = clock();
+        if (!loadsession(session, gameplay)) {
+            fprintf(stderr, "loadsession() failed\n");
+            exit(EXIT_FAILURE);
+        }
+        elapsed += clock() - start;
+        if (redo_getsessionsize(session) != count) {
+            fprintf(stderr, "loadsession() restored %d positions, not %d\n",
+                    redo_getsessionsize(session), count);
+            exit(EXIT_FAILURE);
+        }
+    }
+    report("loadsession", count, size, elapsed);
+}
+
+/* Display the program's options and exit.
+ */
+static void usage(char const *prog, int status)
+{
+    printf("Usage: %s [-n POSITIONS] [-m DEPTH] [-r REPEATS] [-g GAMEID]"
+           " [-f FILENAME]\n"
+           "  -n  positions in the session (default: %ld)\n"
+           "  -m  maximum length of a path (default: %d)\n"
+           "  -r  times to save and load the session (default: %d)\n"
+           "  -g  the game to make moves in (default: %d)\n"
+           "  -f  the file to use (default: %s)\n"
+           "Results are printed one per line, as tab-separated fields.\n",
+           prog, positioncount, maxdepth, repeatcount, gameid, filename);
+    exit(status);
+}
+
+/* Parse a numeric option argument, which must be within the given
+ * range.
+ */
+static long getnumber(char const *prog, char const *arg, long min, long max)
+{
+    char *p;
+    long n;
+
+    n = strtol(arg, &p, 10);
+    if (*p || n < min || n > max) {
+        fprintf(stderr, "%s: invalid argument: \"%s\"\n", prog, arg);
+        usage(prog, EXIT_FAILURE);
+    }
+    return n;
+}
+
+/* Read the options, build the session, and then run the benchmarks.
+ * The file is deleted afterwards.
+ */
+int main(int argc, char *argv[])
+{
+    gameplayinfo gameplay;
+    redo_session *session;
+    long size;
+    int ch;
+
+    while ((ch = getopt(argc, argv, "n:m:r:g:f:h")) != EOF) {
+        switch (ch) {
+          case 'n': positioncount = getnumber(argv[0], optarg, 1, 0x7FFFFFF);
+                    break;
+          case 'm': maxdepth = getnumber(argv[0], optarg, 1, 0xFFFF);
+                    break;
+          case 'r': repeatcount = getnumber(argv[0], optarg, 1, 0x7FFF);
+                    break;
+          case 'g': gameid = getnumber(argv[0], optarg, 0,
+                                       getdeckcount() - 1);
+                    break;
+          case 'f': filename = optarg;
+                    break;
+          case 'h': usage(argv[0], EXIT_SUCCESS);
+                    break;
+          default:  usage(argv[0], EXIT_FAILURE);
+                    break;
+        }
+    }
+    if (optind < argc)
+        usage(argv[0], EXIT_FAILURE);
+
+    gameplay.gameid = gameid;
+    session = initializegame(&gameplay);
+    if (!session) {
+        fprintf(stderr, "%s: redo_beginsession() failed\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    redo_setgraftbehavior(session, redo_nograft);
+    buildsession(session, &gameplay);
+    setsessionfilename(filename);
+
+    printf("benchmark\tpositions\tfilesize\trepetitions\tseconds"
+           "\tmegabytespersecond\n");
+    size = benchsavesession(session);
+    benchloadsession(session, &gameplay, size);
+
+    remove(filename);
+    redo_endsession(session);
+    return 0;
+}
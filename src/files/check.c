@@ -0,0 +1,151 @@
+/* files/check.c: verifying the session files by their checksums.
+ *
+ * Checking a session file by loading it means recreating every move
+ * that it records, which can take a long time when there are many
+ * large sessions. Comparing a file's checksum with its contents is
+ * much faster. The sessions do not depend on one another, so they are
+ * read and checked by several threads at once.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "./gen.h"
+#include "./decks.h"
+#include "files/files.h"
+#include "internal.h"
+
+/* The greatest number of threads used to check the sessions.
+ */
+#define MAX_THREADS  16
+
+/* The state shared by the threads: the pathname of the session pack,
+ * if it is in use, the result for each game, the number of sessions
+ * found, and the next game to be checked. The last two are protected
+ * by the lock.
+ */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static char *packname = NULL;
+static char *results = NULL;
+static int foundcount = 0;
+static int nextgameid = 0;
+
+/* Return true if a file exists.
+ */
+static int fileexists(char const *filename)
+{
+    FILE *fp;
+
+    fp = fopen(filename, "rb");
+    if (!fp)
+        return FALSE;
+    fclose(fp);
+    return TRUE;
+}
+
+/* Check the session of one game, and record the result. The return
+ * value is false if the game has no session. A session that cannot be
+ * read is treated as damaged.
+ */
+static int checkgame(int gameid)
+{
+    filebuffer buf = { NULL, 0, 0, 0 };
+    char *filename, *journalname;
+    int found;
+
+    filename = mksessionpath(gameid);
+    if (packname)
+        found = readpackedsession(packname, gameid, &buf);
+    else
+        found = readfile(filename, &buf);
+    if (found) {
+        results[gameid] = verifysessiondata(&buf);
+    } else {
+        found = errno != ENOENT;
+        results[gameid] = found ? CHECK_DAMAGED : CHECK_VALID;
+    }
+    deallocate(buf.data);
+    journalname = fmtallocate("%s.jnl", filename);
+    if (fileexists(journalname)) {
+        if (results[gameid] == CHECK_VALID)
+            results[gameid] = CHECK_UNVERIFIED;
+        found = TRUE;
+    }
+    deallocate(journalname);
+    deallocate(filename);
+    return found;
+}
+
+/* Check games until there are none left.
+ */
+static void *checkthread(void *data)
+{
+    int gameid, found;
+
+    (void)data;
+    found = FALSE;
+    for (;;) {
+        pthread_mutex_lock(&lock);
+        if (found)
+            ++foundcount;
+        gameid = nextgameid < getdeckcount() ? nextgameid++ : -1;
+        pthread_mutex_unlock(&lock);
+        if (gameid < 0)
+            break;
+        found = checkgame(gameid);
+    }
+    return NULL;
+}
+
+/* Return the number of threads to use.
+ */
+static int getthreadcount(void)
+{
+    long n;
+
+#ifdef _SC_NPROCESSORS_ONLN
+    n = sysconf(_SC_NPROCESSORS_ONLN);
+#else
+    n = 4;
+#endif
+    return n < 1 ? 1 : n > MAX_THREADS ? MAX_THREADS : (int)n;
+}
+
+/*
+ * External functions.
+ */
+
+/* Start the threads, and check games in this thread as well until
+ * they are all done. If a thread cannot be started, the work is
+ * shared among those that were.
+ */
+int checksessionfiles(char *status)
+{
+    pthread_t threads[MAX_THREADS];
+    int count, n, i;
+
+    packname = usingsessionpack() ? mkpackpath() : NULL;
+    results = status;
+    foundcount = 0;
+    nextgameid = 0;
+    n = getthreadcount();
+    for (i = 0 ; i < n - 1 ; ++i)
+        if (pthread_create(&threads[i], NULL, checkthread, NULL))
+            break;
+    checkthread(NULL);
+    while (i--)
+        pthread_join(threads[i], NULL);
+
+    count = 0;
+    for (i = 0 ; i < getdeckcount() ; ++i)
+        if (results[i] != CHECK_VALID)
+            ++count;
+    printf("%d session files verified by checksum, %d to be loaded\n",
+           foundcount - count, count);
+    deallocate(packname);
+    packname = NULL;
+    results = NULL;
+    return count;
+}
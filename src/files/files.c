@@ -9,9 +9,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
 #include <errno.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#if _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 #include "./gen.h"
 #include "files/files.h"
 #include "internal.h"
@@ -70,6 +76,33 @@ static int dirsepindex(char const *path)
     return pp ? pp - path : -1;
 }
 
+/* Force the data written to a file to be stored on the disk, before
+ * the file is closed. This function hides the fact that the Windows
+ * API does not provide fsync().
+ */
+int syncfile(FILE *fp)
+{
+    if (fflush(fp))
+        return -1;
+#if _WIN32
+    return _commit(_fileno(fp));
+#else
+    return fsync(fileno(fp));
+#endif
+}
+
+/* Rename a file, replacing any existing file with the new name. This
+ * function hides the fact that rename() in the Windows API refuses to
+ * replace an existing file.
+ */
+static int replacefile(char const *from, char const *to)
+{
+#if _WIN32
+    remove(to);
+#endif
+    return rename(from, to);
+}
+
 /*
  * Directory validation.
  */
@@ -305,6 +338,160 @@ int getreadonly(void)
     return readonly || forcereadonly;
 }
 
+/* Make room for n more bytes at the end of a buffer.
+ */
+static void growbuffer(filebuffer *buf, long n)
+{
+    if (buf->size + n <= buf->allocated)
+        return;
+    if (!buf->allocated)
+        buf->allocated = 4096;
+    while (buf->allocated < buf->size + n)
+        buf->allocated *= 2;
+    buf->data = reallocate(buf->data, buf->allocated);
+}
+
+/* Append a byte to a buffer.
+ */
+void putbyte(filebuffer *buf, int byte)
+{
+    growbuffer(buf, 1);
+    buf->data[buf->size++] = (unsigned char)byte;
+}
+
+/* Append n bytes to a buffer.
+ */
+void putbytes(filebuffer *buf, void const *src, long n)
+{
+    growbuffer(buf, n);
+    memcpy(buf->data + buf->size, src, n);
+    buf->size += n;
+}
+
+/* Append a formatted string to a buffer. Room is made for the nul
+ * byte that vsnprintf() adds, but it is not counted in the size.
+ */
+void putformatted(filebuffer *buf, char const *fmt, ...)
+{
+    va_list args;
+    int n;
+
+    va_start(args, fmt);
+    n = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+    growbuffer(buf, n + 1);
+    va_start(args, fmt);
+    vsnprintf((char*)buf->data + buf->size, n + 1, fmt, args);
+    va_end(args);
+    buf->size += n;
+}
+
+/* Compute a CRC32C, using the redo library's implementation.
+ */
+unsigned long getchecksum(void const *data, long size)
+{
+    return size ? redo_hashcrc32c(data, (int)size) : 0;
+}
+
+/* Append a checksum of everything in a buffer to the buffer.
+ */
+void putchecksum(filebuffer *buf)
+{
+    unsigned long value;
+    int i;
+
+    value = getchecksum(buf->data, buf->size);
+    for (i = 0 ; i < SIZE_CHECKSUM ; ++i)
+        putbyte(buf, (int)((value >> (8 * i)) & 0xFF));
+}
+
+/* Compare the checksum at the end of a buffer with the bytes that
+ * precede it.
+ */
+int checksumvalid(filebuffer const *buf)
+{
+    unsigned long value;
+    long size;
+    int i;
+
+    size = buf->size - SIZE_CHECKSUM;
+    if (size < 0)
+        return FALSE;
+    value = 0;
+    for (i = 0 ; i < SIZE_CHECKSUM ; ++i)
+        value |= (unsigned long)buf->data[size + i] << (8 * i);
+    return value == getchecksum(buf->data, size);
+}
+
+/* Read an entire file into memory.
+ */
+int readfile(char const *filename, filebuffer *buf)
+{
+    FILE *fp;
+    long size;
+    int f;
+
+    fp = fopen(filename, "rb");
+    if (!fp)
+        return FALSE;
+    f = !fseek(fp, 0, SEEK_END) && (size = ftell(fp)) >= 0 &&
+                                   !fseek(fp, 0, SEEK_SET);
+    if (f) {
+        buf->data = allocate(size ? size : 1);
+        buf->size = size;
+        buf->allocated = size;
+        buf->pos = 0;
+        f = fread(buf->data, 1, size, fp) == (size_t)size;
+    }
+    fclose(fp);
+    return f;
+}
+
+/* Return true if a file's contents are identical to a buffer's.
+ */
+static int issamefile(char const *filename, filebuffer const *buf)
+{
+    filebuffer old = { NULL, 0, 0, 0 };
+    int f;
+
+    f = readfile(filename, &old) && old.size == buf->size &&
+                        !memcmp(old.data, buf->data, buf->size);
+    deallocate(old.data);
+    return f;
+}
+
+/* Write a file's new contents under a temporary name, and then
+ * replace the file with it.
+ */
+int savefile(char const *filename, filebuffer const *buf)
+{
+    FILE *fp;
+    char *tempname;
+    int f;
+
+    if (issamefile(filename, buf))
+        return TRUE;
+    tempname = fmtallocate("%s.tmp", filename);
+    fp = fopen(tempname, "wb");
+    if (!fp) {
+        perror(tempname);
+        deallocate(tempname);
+        return FALSE;
+    }
+    f = fwrite(buf->data, 1, buf->size, fp) == (size_t)buf->size &&
+                        !syncfile(fp);
+    if (fclose(fp))
+        f = FALSE;
+    if (f && !replacefile(tempname, filename)) {
+        deallocate(tempname);
+        return TRUE;
+    }
+    perror(f ? filename : tempname);
+    remove(tempname);
+    deallocate(tempname);
+    return FALSE;
+}
+
 /* Turn a filename into a pathname, using datadir as the starting
  * directory. If datadir is unset, the current directory will be used.
  */
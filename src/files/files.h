@@ -92,44 +92,158 @@ extern char const *lookupinitsetting(char const *key);
  */
 extern void storeinitsetting(char const *key, char const *value);
 
+/*
+ * File verification.
+ */
+
+/* The answers file and the session files end with a checksum, which
+ * allows them to be verified without being loaded. These are the
+ * possible results of checking a file: either its checksum matches
+ * (or it does not exist), or the file must be loaded to be checked,
+ * as with a file written by an earlier version, or its checksum does
+ * not match.
+ */
+#define CHECK_VALID  0
+#define CHECK_UNVERIFIED  1
+#define CHECK_DAMAGED  2
+
+/* Verify the session of every game by its checksum, using several
+ * threads at once. The results are stored in the status array, which
+ * must have an entry for each game. A session with a journal is
+ * unverified, as the journal has no checksum. The number of sessions
+ * verified is displayed. The return value is the number of sessions
+ * that are not valid, which the caller should then load in order for
+ * the problems in them to be reported.
+ */
+extern int checksessionfiles(char *status);
+
 /*
  * The answers file.
  */
 
-/* Read the answers file and return the array of answers through the
- * provided pointer. The return value is the size of the array on
- * success, or -1 if the answers file cannot be read. The caller is
- * responsible for freeing the array.
+/* Read the answers file and its journal, and return the array of
+ * answers through the provided pointer. The array is in the order
+ * that the answers were recorded, and so a game can appear more than
+ * once, in which case the last answer replaces the earlier ones. The
+ * return value is the size of the array on success, or -1 if the
+ * answers file cannot be read. The caller is responsible for freeing
+ * the array.
  */
 extern int loadanswerfile(answerinfo **panswers);
 
-/* Write the given array of answers to the answers file. The return
- * value is false if an error occurs.
+/* Write the given array of answers to the answers file, in order,
+ * and discard the journal. Entries whose text is NULL are left out,
+ * so that an array with an entry for every game can be passed. The
+ * return value is false if an error occurs.
  */
 extern int saveanswerfile(answerinfo const *answers, int count);
 
+/* Record a new or improved answer by appending it to the answers
+ * file's journal, rather than rewriting the file. The return value is
+ * false if the journal has grown too large, or cannot be written, in
+ * which case saveanswerfile() should be used instead.
+ */
+extern int journalanswer(answerinfo const *answer);
+
+/* Merge the answers in the journal into the answers file, by saving
+ * the given array with saveanswerfile(), if the journal is not empty.
+ * The return value is false if an error occurs while saving.
+ */
+extern int closeanswerjournal(answerinfo const *answers, int count);
+
+/* Verify the answers file by its checksum, without reading the
+ * answers. If the file has a journal, it is unverified. The return
+ * value is one of the CHECK_* values. Nothing is displayed, as any
+ * problems are reported by loadanswerfile().
+ */
+extern int checkanswerfile(void);
+
+/* Wait until every file that is being saved in the background has
+ * been written out. This also happens automatically at exit.
+ */
+extern void finishsaving(void);
+
 /*
  * The session files.
  */
 
 /* Set the name of the current session file to filename. The default
  * data directory will be used if filename is not an absolute path.
+ * The session's journal is kept alongside it, with ".jnl" appended to
+ * the name.
  */
 extern void setsessionfilename(char const *filename);
 
+/* Set the current session to be the one for the given game. This is
+ * the same as setting the filename to "session-NNNN", except that the
+ * session pack is used instead if it exists.
+ */
+extern void setsessiongame(int gameid);
+
 /* Read the game tree stored in the session file and add it to the
- * redo session, recreating every move. The game state should be
+ * redo session, recreating every move, and then replay the changes
+ * recorded in the journal. Files written by older versions of the
+ * program can also be read. The game state should be
  * initialized to the starting state before calling this function.
  * (The function temporarily alters the state, and then restores it
  * before returning.) The return value is false if the file exists but
- * cannot be read.
+ * cannot be read. If deferred loading is enabled, the branches that
+ * were not most recently used are left unloaded until
+ * expandposition() is called. expandposition() is installed with
+ * setpositionexpander() so that the game loads them as needed.
  */
 extern int loadsession(redo_session *session, gameplayinfo *gameplay);
 
+/* Enable or disable deferred loading. When enabled, loadsession()
+ * skips over the parts of the session file that are not needed to
+ * resume play: branches that were not the most recently visited, and
+ * that do not lead to a solution. Deferred loading is off by default.
+ */
+extern void setdeferredloading(int enabled);
+
+/* Load the branches of the given position that loadsession() skipped
+ * over, or every skipped branch if position is NULL. The game state
+ * is left unchanged. The return value is true if any positions were
+ * added. This function is suitable for passing to
+ * setpositionexpander().
+ */
+extern int expandposition(redo_session *session, gameplayinfo *gameplay,
+                          redo_position *position);
+
 /* Write the complete redo_session contents to the current session
- * file. The return value is false if an error occurs while saving the
- * data.
+ * file, and discard the journal. Branches that have not been loaded
+ * are copied unchanged. The file is always written in the
+ * current format, which records enough of every move for
+ * loadsession() to recreate it without re-applying the rules. The
+ * return value is false if an error occurs while saving the data.
  */
 extern int savesession(redo_session const *session);
 
+/* Append a change to the session loaded by loadsession() to its
+ * journal. added is true if position has just been added to the
+ * session, or false if it is about to be removed. This function is
+ * suitable for passing to setpositionlogger().
+ */
+extern void journalposition(redo_position const *position, int added);
+
+/* Close the session's journal, after all changes to the session have
+ * been recorded with journalposition(). If the journal has grown too
+ * large, or was not successfully kept, the complete session is saved
+ * instead. The return value is false if an error occurs while saving.
+ */
+extern int closejournal(redo_session const *session);
+
+/* Move all of the session files in the data directory into a single
+ * session pack, creating it if necessary. Once the pack exists, the
+ * sessions of every game are stored in it. The return value is false
+ * if any session could not be moved.
+ */
+extern int packsessions(void);
+
+/* Move all of the sessions in the session pack back into separate
+ * session files, and remove the pack. The return value is false if
+ * any session could not be moved, in which case the pack is kept.
+ */
+extern int unpacksessions(void);
+
 #endif
@@ -103,7 +103,7 @@ int loadinitfile(settingsinfo *settings)
     char *filename;
     char *val;
     int lineno;
-    int id, n, ch;
+    int id, limit, n, ch;
 
     filename = mksettingspath("brainjam.ini");
     fp = fopen(filename, "r");
@@ -160,6 +160,14 @@ int loadinitfile(settingsinfo *settings)
         } else if (!strcmp(buf, "branching")) {
             if (settings->branching < 0)
                 settings->branching = strcmp(val, "0");
+        } else if (!strcmp(buf, "positionlimit")) {
+            if (sscanf(val, "%d", &limit) == 1 && limit >= 0) {
+                if (settings->positionlimit < 0)
+                    settings->positionlimit = limit;
+            } else {
+                warn("%s:%d: invalid positionlimit value", filename, lineno);
+                continue;
+            }
         } else {
             storeinitsetting(buf, val);
         }
@@ -174,33 +182,30 @@ int loadinitfile(settingsinfo *settings)
  */
 int saveinitfile(settingsinfo const *settings)
 {
-    FILE *fp;
+    filebuffer buf = { NULL, 0, 0, 0 };
     char *filename;
-    int i;
+    int f, i;
 
     if (getreadonly())
         return FALSE;
-    filename = mksettingspath("brainjam.ini");
-    fp = fopen(filename, "w");
-    if (!fp) {
-        perror(filename);
-        deallocate(filename);
-        return FALSE;
-    }
-    fprintf(fp, "\n[General]\n");
+    putformatted(&buf, "\n[General]\n");
     if (settings->gameid >= 0)
-        fprintf(fp, "lastgame=%04d\n", settings->gameid);
+        putformatted(&buf, "lastgame=%04d\n", settings->gameid);
     if (settings->showkeys >= 0)
-        fprintf(fp, "showkeys=%c\n", settings->showkeys ? '1' : '0');
+        putformatted(&buf, "showkeys=%c\n", settings->showkeys ? '1' : '0');
     if (settings->animation >= 0)
-        fprintf(fp, "animation=%c\n", settings->animation ? '1' : '0');
+        putformatted(&buf, "animation=%c\n", settings->animation ? '1' : '0');
     if (settings->autoplay >= 0)
-        fprintf(fp, "autoplay=%c\n", settings->autoplay ? '1' : '0');
+        putformatted(&buf, "autoplay=%c\n", settings->autoplay ? '1' : '0');
     if (settings->branching >= 0)
-        fprintf(fp, "branching=%c\n", settings->branching ? '1' : '0');
+        putformatted(&buf, "branching=%c\n", settings->branching ? '1' : '0');
+    if (settings->positionlimit >= 0)
+        putformatted(&buf, "positionlimit=%d\n", settings->positionlimit);
     for (i = 0 ; i < extrascount ; ++i)
-        fprintf(fp, "%s=%s\n", extras[i].key, extras[i].value);
-    fclose(fp);
+        putformatted(&buf, "%s=%s\n", extras[i].key, extras[i].value);
+    filename = mksettingspath("brainjam.ini");
+    f = savefile(filename, &buf);
     deallocate(filename);
-    return TRUE;
+    deallocate(buf.data);
+    return f;
 }
@@ -20,4 +20,128 @@ extern char *mksettingspath(char const *filename);
  */
 extern int getreadonly(void);
 
+/* A buffer holding the complete contents of a file. Files are read
+ * into memory in one piece and then parsed, and their new contents
+ * are assembled in memory before being written out in one piece.
+ */
+typedef struct filebuffer {
+    unsigned char *data;        /* the file contents */
+    long size;                  /* the number of bytes in data */
+    long allocated;             /* the number of bytes allocated */
+    long pos;                   /* the offset of the next byte to read */
+} filebuffer;
+
+/* Append a byte to a buffer.
+ */
+extern void putbyte(filebuffer *buf, int byte);
+
+/* Append n bytes to a buffer.
+ */
+extern void putbytes(filebuffer *buf, void const *src, long n);
+
+/* Append a formatted string to a buffer, without a terminating nul.
+ */
+extern void putformatted(filebuffer *buf, char const *fmt, ...);
+
+/* Files are protected by a checksum, a CRC32C of their contents, so
+ * that they can be verified without being parsed. In binary files it
+ * is stored in SIZE_CHECKSUM bytes, lowest first.
+ */
+#define SIZE_CHECKSUM  4
+
+/* Return the checksum of size bytes of data.
+ */
+extern unsigned long getchecksum(void const *data, long size);
+
+/* Append a checksum of a buffer's current contents to the buffer.
+ */
+extern void putchecksum(filebuffer *buf);
+
+/* Return true if the last SIZE_CHECKSUM bytes in a buffer are a
+ * checksum of the bytes before them, as appended by putchecksum().
+ */
+extern int checksumvalid(filebuffer const *buf);
+
+/* Force the data written to a file to be stored on the disk. The
+ * return value is zero on success.
+ */
+extern int syncfile(FILE *fp);
+
+/* Read the entire contents of a file into a buffer, which should be
+ * empty. The return value is false if the file could not be read, in
+ * which case errno indicates the reason.
+ */
+extern int readfile(char const *filename, filebuffer *buf);
+
+/* Replace the contents of a file with the contents of a buffer. The
+ * new contents are written to a temporary file in the same directory,
+ * which is flushed to the disk and then renamed over the original.
+ * If the program is interrupted, the file is therefore left either
+ * complete or unchanged. If the file already holds exactly the same
+ * bytes, it is left alone. An error message is displayed and false is
+ * returned if the file could not be written.
+ */
+extern int savefile(char const *filename, filebuffer const *buf);
+
+/* Hand a buffer over to the worker thread, to be saved to a file with
+ * savefile() in the background. The buffer's data is taken over, and
+ * will be freed once it has been written. If obsolete is not NULL, it
+ * names a file that is removed after the new file has been saved. If
+ * the same file is already waiting to be saved, it is saved just once
+ * with the newer contents. The return value is false only if the file
+ * had to be saved immediately and could not be.
+ */
+extern int savefilelater(char const *filename, filebuffer *buf,
+                         char const *obsolete);
+
+/* Hand a buffer over to the worker thread, to be stored as the given
+ * game's session in the session pack with savepackedsession(). This
+ * function otherwise behaves the same as savefilelater().
+ */
+extern int savepackedlater(char const *packname, int gameid,
+                           filebuffer *buf, char const *obsolete);
+
+/* Wait until any pending background writes to the given file, or
+ * removal of it, have completed. This must be done before the file is
+ * read or written directly.
+ */
+extern void waitforfile(char const *filename);
+
+/* Return the pathname of the session pack. The caller is responsible
+ * for freeing the returned buffer.
+ */
+extern char *mkpackpath(void);
+
+/* Return the pathname of a game's session file, as used when the
+ * session pack is not. The caller is responsible for freeing the
+ * returned buffer.
+ */
+extern char *mksessionpath(int gameid);
+
+/* Return true if the sessions are stored in a session pack.
+ */
+extern int usingsessionpack(void);
+
+/* Read a game's session from the session pack into a buffer, which
+ * should be empty. The return value is false if the session could not
+ * be read, in which case errno indicates the reason. (ENOENT is used
+ * if the pack has no session for the game.)
+ */
+extern int readpackedsession(char const *packname, int gameid,
+                             filebuffer *buf);
+
+/* Store a buffer as a game's session in the session pack. The data is
+ * written to unused space in the pack and flushed to the disk before
+ * the pack's index is changed to refer to it, so that an interruption
+ * leaves either the old or the new session in place. An error message
+ * is displayed and false is returned if the pack could not be updated.
+ */
+extern int savepackedsession(char const *packname, int gameid,
+                             filebuffer const *buf);
+
+/* Verify the contents of a session file by its checksum, without
+ * loading it. The return value is one of the CHECK_* values.
+ */
+extern int verifysessiondata(filebuffer const *buf);
+
 #endif
@@ -1,3 +1,25 @@
 # files/module.mk: build rules for the files module.
 
-SRC += files/files.c files/init.c files/answers.c files/session.c
+SRC += files/files.c files/init.c files/answers.c files/session.c \
+       files/writer.c files/pack.c files/check.c
+
+# Files are saved by a background thread.
+override CFLAGS += -pthread
+override LDFLAGS += -pthread
+
+# A program that benchmarks writing and reading session files is
+# built only on request, via "make session-bench". It links with the
+# parts of the game that the session files depend upon.
+.PHONY: session-bench
+
+session-bench: files/session-bench$(EXEEXT)
+
+SESSIONBENCHOBJ := files/session.o files/files.o files/answers.o \
+                   files/writer.o files/pack.o \
+                   game/state.o game/game.o answers/answers.o \
+                   ./decks.o ./gen.o redo/redo.o
+
+files/session-bench$(EXEEXT): files/bench.c $(SESSIONBENCHOBJ)
+	$(CC) $(CPPFLAGS) $(CFLAGS) $(LDFLAGS) -o $@ $^
+
+EXTRA += files/session-bench$(EXEEXT)
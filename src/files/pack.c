@@ -0,0 +1,391 @@
+/* files/pack.c: storing every session in a single file.
+ *
+ * Instead of keeping one session file per game, the sessions can
+ * optionally be kept together in a session pack. The pack begins with
+ * a header, followed by an index with an entry for every game. Each
+ * entry gives the offset of that game's session data within the pack,
+ * the size of the data, and the amount of room reserved for it. The
+ * session data fills the rest of the file. Any space not reserved by
+ * an index entry is free to be reused.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "./gen.h"
+#include "./decks.h"
+#include "files/files.h"
+#include "internal.h"
+
+/* The pack header consists of a signature, a version byte, three
+ * bytes of padding, and the number of entries in the index. All
+ * numbers in the pack are stored as four-byte little-endian values.
+ */
+static char const signature[4] = { 0x7F, 'B', 'J', 'P' };
+#define PACK_VERSION  1
+#define SIZE_HEADER  12
+#define SIZE_ENTRY  12
+
+/* The pack is used if a file with this name exists in the data
+ * directory.
+ */
+#define PACK_FILENAME  "sessions.pack"
+
+/* An entry in the index of the pack.
+ */
+typedef struct packentry {
+    unsigned long offset;       /* the location of the session data */
+    unsigned long size;         /* the size of the session data */
+    unsigned long room;         /* the number of bytes reserved */
+} packentry;
+
+/* Whether the pack is in use: true, false, or -1 if not yet known.
+ */
+static int packinuse = -1;
+
+/* Decode a four-byte number.
+ */
+static unsigned long getvalue(unsigned char const *p)
+{
+    return (unsigned long)p[0] | ((unsigned long)p[1] << 8) |
+           ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+/* Encode a four-byte number.
+ */
+static void setvalue(unsigned char *p, unsigned long value)
+{
+    p[0] = value & 0xFF;
+    p[1] = (value >> 8) & 0xFF;
+    p[2] = (value >> 16) & 0xFF;
+    p[3] = (value >> 24) & 0xFF;
+}
+
+/* Read the header of a pack, and verify it. The return value is the
+ * number of entries in the index, or -1 if the header is invalid.
+ */
+static long readheader(FILE *fp, char const *packname)
+{
+    unsigned char header[SIZE_HEADER];
+
+    if (fread(header, SIZE_HEADER, 1, fp) != 1) {
+        perror(packname);
+        return -1;
+    }
+    if (memcmp(header, signature, sizeof signature) ||
+                header[sizeof signature] != PACK_VERSION) {
+        warn("%s: not a valid session pack", packname);
+        errno = EINVAL;
+        return -1;
+    }
+    return (long)getvalue(header + 8);
+}
+
+/* Read one entry from a pack's index.
+ */
+static int readentry(FILE *fp, int gameid, packentry *entry)
+{
+    unsigned char buf[SIZE_ENTRY];
+
+    if (fseek(fp, SIZE_HEADER + gameid * SIZE_ENTRY, SEEK_SET) ||
+                fread(buf, SIZE_ENTRY, 1, fp) != 1)
+        return FALSE;
+    entry->offset = getvalue(buf);
+    entry->size = getvalue(buf + 4);
+    entry->room = getvalue(buf + 8);
+    return TRUE;
+}
+
+/* Comparison function for sorting index entries by their location.
+ */
+static int cmpentries(void const *a, void const *b)
+{
+    packentry const *x = a;
+    packentry const *y = b;
+
+    return x->offset < y->offset ? -1 : x->offset > y->offset ? 1 : 0;
+}
+
+/* Find a location in the pack where size bytes can be stored, without
+ * disturbing the space reserved by any entry in the index (including
+ * the entry about to be replaced, whose data must stay intact until
+ * the index no longer refers to it). The first gap large enough is
+ * used; if there is none, the data is placed at the end of the pack.
+ * The index entries are sorted as a side effect.
+ */
+static unsigned long findroom(packentry *index, long count,
+                              unsigned long size)
+{
+    unsigned long pos;
+    long i;
+
+    qsort(index, count, sizeof *index, cmpentries);
+    pos = SIZE_HEADER + count * SIZE_ENTRY;
+    for (i = 0 ; i < count ; ++i) {
+        if (!index[i].room)
+            continue;
+        if (index[i].offset >= pos + size)
+            break;
+        if (pos < index[i].offset + index[i].room)
+            pos = index[i].offset + index[i].room;
+    }
+    return pos;
+}
+
+/*
+ * Internal functions.
+ */
+
+/* Return the pathname of the session pack.
+ */
+char *mkpackpath(void)
+{
+    return mkdatapath(PACK_FILENAME);
+}
+
+/* Return the pathname of a game's loose session file.
+ */
+char *mksessionpath(int gameid)
+{
+    char *filename, *path;
+
+    filename = fmtallocate("session-%04d", gameid);
+    path = mkdatapath(filename);
+    deallocate(filename);
+    return path;
+}
+
+/* Check for the existence of the session pack, the first time that
+ * this function is called.
+ */
+int usingsessionpack(void)
+{
+    FILE *fp;
+    char *packname;
+
+    if (packinuse < 0) {
+        packname = mkpackpath();
+        fp = fopen(packname, "rb");
+        packinuse = fp != NULL;
+        if (fp)
+            fclose(fp);
+        deallocate(packname);
+    }
+    return packinuse;
+}
+
+/* Look up the game's entry in the index, and read its data.
+ */
+int readpackedsession(char const *packname, int gameid, filebuffer *buf)
+{
+    FILE *fp;
+    packentry entry;
+    long count;
+    int f;
+
+    fp = fopen(packname, "rb");
+    if (!fp)
+        return FALSE;
+    count = readheader(fp, packname);
+    f = count >= 0;
+    if (f && (gameid >= count || !readentry(fp, gameid, &entry) ||
+                                 !entry.size)) {
+        errno = ENOENT;
+        f = FALSE;
+    }
+    if (f) {
+        buf->data = allocate(entry.size);
+        buf->size = entry.size;
+        buf->allocated = entry.size;
+        buf->pos = 0;
+        f = !fseek(fp, entry.offset, SEEK_SET) &&
+            fread(buf->data, entry.size, 1, fp) == 1;
+        if (!f)
+            errno = EIO;
+    }
+    fclose(fp);
+    return f;
+}
+
+/* Store the session data in free space, leaving room for it to grow
+ * by a quarter, and then update the index entry. The data is left
+ * alone if it is unchanged.
+ */
+int savepackedsession(char const *packname, int gameid,
+                      filebuffer const *buf)
+{
+    FILE *fp;
+    filebuffer old = { NULL, 0, 0, 0 };
+    packentry *index;
+    packentry entry;
+    unsigned char *data;
+    long count, i;
+    int f;
+
+    if (readpackedsession(packname, gameid, &old) &&
+                old.size == buf->size &&
+                !memcmp(old.data, buf->data, buf->size)) {
+        deallocate(old.data);
+        return TRUE;
+    }
+    deallocate(old.data);
+
+    fp = fopen(packname, "r+b");
+    if (!fp) {
+        perror(packname);
+        return FALSE;
+    }
+    count = readheader(fp, packname);
+    if (count < 0 || gameid >= count) {
+        if (count >= 0)
+            warn("%s: no room for game %04d", packname, gameid);
+        fclose(fp);
+        return FALSE;
+    }
+    data = allocate(count * SIZE_ENTRY);
+    if (fread(data, SIZE_ENTRY, count, fp) != (size_t)count) {
+        perror(packname);
+        deallocate(data);
+        fclose(fp);
+        return FALSE;
+    }
+    index = allocate(count * sizeof *index);
+    for (i = 0 ; i < count ; ++i) {
+        index[i].offset = getvalue(data + i * SIZE_ENTRY);
+        index[i].size = getvalue(data + i * SIZE_ENTRY + 4);
+        index[i].room = getvalue(data + i * SIZE_ENTRY + 8);
+    }
+
+    entry.size = buf->size;
+    entry.room = buf->size + buf->size / 4;
+    entry.offset = findroom(index, count, entry.room);
+    deallocate(index);
+
+    setvalue(data, entry.offset);
+    setvalue(data + 4, entry.size);
+    setvalue(data + 8, entry.room);
+    f = !fseek(fp, entry.offset, SEEK_SET) &&
+        fwrite(buf->data, 1, buf->size, fp) == (size_t)buf->size &&
+        !syncfile(fp) &&
+        !fseek(fp, SIZE_HEADER + gameid * SIZE_ENTRY, SEEK_SET) &&
+        fwrite(data, SIZE_ENTRY, 1, fp) == 1 &&
+        !syncfile(fp);
+    if (fclose(fp))
+        f = FALSE;
+    if (!f)
+        perror(packname);
+    deallocate(data);
+    return f;
+}
+
+/*
+ * External functions.
+ */
+
+/* Move every loose session file into the session pack, creating the
+ * pack if it does not already exist. Each session file is removed
+ * once it has been stored in the pack. Journal files are left where
+ * they are, as they remain valid.
+ */
+int packsessions(void)
+{
+    filebuffer buf = { NULL, 0, 0, 0 };
+    unsigned char header[SIZE_HEADER];
+    char *packname, *filename;
+    int id, n, f;
+
+    if (getreadonly()) {
+        warn("cannot change the session files in read-only mode");
+        return FALSE;
+    }
+    packname = mkpackpath();
+    if (!usingsessionpack()) {
+        memcpy(header, signature, sizeof signature);
+        header[sizeof signature] = PACK_VERSION;
+        memset(header + sizeof signature + 1, 0, 3);
+        setvalue(header + 8, getdeckcount());
+        putbytes(&buf, header, SIZE_HEADER);
+        for (n = 0 ; n < getdeckcount() * SIZE_ENTRY ; ++n)
+            putbyte(&buf, 0);
+        f = savefile(packname, &buf);
+        deallocate(buf.data);
+        if (!f) {
+            deallocate(packname);
+            return FALSE;
+        }
+        packinuse = TRUE;
+    }
+
+    f = TRUE;
+    n = 0;
+    for (id = 0 ; id < getdeckcount() ; ++id) {
+        filename = mksessionpath(id);
+        buf.data = NULL;
+        if (readfile(filename, &buf)) {
+            if (!savepackedsession(packname, id, &buf))
+                f = FALSE;
+            else if (remove(filename))
+                perror(filename);
+            else
+                ++n;
+        } else if (errno != ENOENT) {
+            perror(filename);
+            f = FALSE;
+        }
+        deallocate(buf.data);
+        deallocate(filename);
+    }
+    printf("%d session files moved into %s\n", n, packname);
+    deallocate(packname);
+    return f;
+}
+
+/* Move every session in the session pack out into a loose session
+ * file, and then remove the pack. The pack is kept if any session
+ * could not be moved.
+ */
+int unpacksessions(void)
+{
+    filebuffer buf = { NULL, 0, 0, 0 };
+    char *packname, *filename;
+    int id, n, f;
+
+    if (getreadonly()) {
+        warn("cannot change the session files in read-only mode");
+        return FALSE;
+    }
+    packname = mkpackpath();
+    if (!usingsessionpack()) {
+        warn("%s: no session pack to unpack", packname);
+        deallocate(packname);
+        return FALSE;
+    }
+
+    f = TRUE;
+    n = 0;
+    for (id = 0 ; id < getdeckcount() && f ; ++id) {
+        buf.data = NULL;
+        if (readpackedsession(packname, id, &buf)) {
+            filename = mksessionpath(id);
+            if (savefile(filename, &buf))
+                ++n;
+            else
+                f = FALSE;
+            deallocate(filename);
+        } else if (errno != ENOENT) {
+            perror(packname);
+            f = FALSE;
+        }
+        deallocate(buf.data);
+    }
+    if (f && remove(packname)) {
+        perror(packname);
+        f = FALSE;
+    }
+    if (f)
+        packinuse = FALSE;
+    printf("%d session files moved out of %s\n", n, packname);
+    deallocate(packname);
+    return f;
+}
@@ -3,6 +3,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include "./gen.h"
 #include "./decls.h"
@@ -19,90 +20,803 @@
 #define movevalue(branch)  \
     (((branch)->move & MOVE_MASK) | ((branch)->p->better ? BETTER_FLAG : 0))
 
-/* There are three special byte values used as delimiters in the
+/* There are four special byte values used as delimiters in the
  * session files. Impossible card values are used to avoid collision
  * with valid move IDs.
  */
 #define START_BRANCH    mkcard(14, 0)   /* start a sequence of branches */
 #define SIBLING_BRANCH  mkcard(14, 1)   /* separate two sibling branches */
 #define CLOSE_BRANCH    mkcard(14, 2)   /* end a sequence of branches */
+#define CHECKPOINT      mkcard(14, 3)   /* introduce a saved state */
 
-/* The name of the current session file.
+/* The original session files consist of nothing but the bytes
+ * described above. Later versions begin with a header: a signature,
+ * whose first byte cannot begin an original session file, followed by
+ * a version number.
+ */
+static char const signature[4] = { 0x7F, 'B', 'J', 'S' };
+#define SESSION_VERSION  4
+
+/* In version 2 files, each move byte is followed by a byte giving the
+ * places that the card moved from and to, so that the move can be
+ * recreated without consulting the rules. After every move that
+ * brings the move count to a multiple of CHECKPOINT_INTERVAL, the
+ * complete state data follows, so that the recreated states can be
+ * verified as the file is read.
+ */
+#define CHECKPOINT_INTERVAL  64
+#define SIZE_CHECKPOINT  ((NCARDS + NPLACES) * sizeof(card_t))
+
+/* In version 3 files, a move that reaches an endpoint is followed by
+ * an additional byte, an impossible move ID, so that the subtrees
+ * containing solutions can be identified without recreating them.
+ */
+#define SOLUTION_MARK  (MOVEID_ALT_FLAG | mkcard(14, 0))
+
+/* Version 4 files end with a checksum of all the preceding bytes, so
+ * that a file can be verified without being loaded.
+ */
+#define CHECKSUM_VERSION  4
+
+/* Changes made to a session during play are appended to a journal
+ * file, so that the session file need not be rewritten every time a
+ * game is closed. The journal begins with its own signature and
+ * version, followed by the size of the session file that it extends.
+ * Each record then holds an operation byte, the path from the
+ * position that the previous record left off at to the position that
+ * the operation applies to (a count of steps back toward the root,
+ * then a count of moves forward, followed by the move bytes), and,
+ * for an addition, the new move. The journal is merged into the
+ * session file once it grows past JOURNAL_LIMIT bytes.
+ *
+ * Since version 2, the header ends with a flag byte, which is set if
+ * the session was loaded with some of its subtrees deferred. The
+ * journal then also records each time that deferred subtrees were
+ * loaded: a count, followed by the location of each subtree in the
+ * session file. Such a journal can only be replayed on a session
+ * loaded in the same way, since whether or not a new position is
+ * grafted depends on which positions are present.
+ */
+static char const journalsignature[4] = { 0x7F, 'B', 'J', 'J' };
+#define JOURNAL_VERSION  2
+#define JOURNAL_ADD  1                  /* add a position */
+#define JOURNAL_DROP  2                 /* remove a leaf position */
+#define JOURNAL_EXPAND  3               /* load deferred subtrees */
+#define JOURNAL_LIMIT  16384
+
+/* The name of the current session file. If the session is stored in
+ * the session pack instead, then the pack's name and the game ID are
+ * also set.
  */
 static char *sessionfilename = NULL;
+static char *packfilename = NULL;
+static int sessiongameid = -1;
+
+/* An entry on the work stack used when writing a session file. An
+ * entry either holds a branch whose subtree is to be written out, or
+ * else a delimiter byte to be written out (in which case the branch
+ * field is NULL), or else an unloaded subtree whose bytes are to be
+ * copied from the original file (in which case the byte field is -1).
+ */
+typedef struct saveentry {
+    redo_branch const *branch;  /* the branch to output */
+    int byte;                   /* the delimiter to output */
+    long start;                 /* the location of the unloaded subtree */
+} saveentry;
+
+/* The location of a sibling subtree within a session file: the offset
+ * of its first byte, and the offset of the delimiter that follows it.
+ * The last flag is set if the subtree is the last of its siblings, and
+ * the solution flag if it contains a solution.
+ */
+typedef struct subtree {
+    long start;                 /* the first byte of the subtree */
+    long end;                   /* the delimiter after the subtree */
+    char last;                  /* true if followed by CLOSE_BRANCH */
+    char solution;              /* true if it contains an endpoint */
+} subtree;
+
+/* A subtree that was left unloaded, and the position it branches from.
+ */
+typedef struct deferral {
+    redo_position *position;    /* the parent of the subtree */
+    long start;                 /* the location of the subtree */
+} deferral;
 
-/* Values needed by the recursive functions. These values do not
- * change during a recursive sequence of calls, so they are stored
- * here instead of in every stack frame.
+/* A growable stack, used to walk the session tree without recursion,
+ * so that arbitrarily deep trees cannot exhaust the native stack.
  */
-static FILE *fp;                /* the file being read or written */
-static gameplayinfo *gameplay;  /* the game state buffer */
-static redo_session *session;   /* the redo session */
+typedef struct workstack {
+    void *entries;              /* the array of entries */
+    int count;                  /* the number of entries in use */
+    int size;                   /* the number of entries allocated */
+} workstack;
 
-/* Forward declaration of a doubly-recursive function.
+/* The state of the journal: its filename, its file handle while it
+ * is open for appending, its size, the size of the session file that
+ * it extends (or -1 if the session file has not been loaded), a flag
+ * that is set if the journal cannot be relied upon, a flag that is
+ * set if the journal is for a session loaded with deferred subtrees,
+ * and a flag that is set while the journal is being replayed. The
+ * moves leading to the position that the last record left off at are
+ * kept on a work stack of move IDs.
  */
-static void savesession_branchrecurse(redo_branch const *branch);
+static char *journalfilename = NULL;
+static FILE *journalfp = NULL;
+static long journalsize = 0;
+static long basesize = -1;
+static int journalfailed = FALSE;
+static int journaldeferred = FALSE;
+static int replayingjournal = FALSE;
+static workstack journalpath = { NULL, 0, 0 };
 
-/* Read a subtree's worth of moves from the session file. For each
- * move, the game state is recreated and added to the session at the
- * given position.
+/* When loading is deferred, the contents of the session file are kept
+ * after loadsession() returns, along with the locations of all the
+ * sibling subtrees in the file (in order of their location), and the
+ * subtrees that have yet to be loaded.
  */
-static int loadsession_recurse(redo_position *position)
+static int deferloading = FALSE;
+static filebuffer sessiondata = { NULL, 0, 0, 0 };
+static int sessionversion = 0;
+static workstack subtrees = { NULL, 0, 0 };
+static workstack deferrals = { NULL, 0, 0 };
+
+/* Return the next byte from a buffer, or EOF if there are none left.
+ */
+static int getbyte(filebuffer *buf)
 {
-    int moveid, byte;
+    return buf->pos < buf->size ? buf->data[buf->pos++] : EOF;
+}
 
-    for (;;) {
-        byte = fgetc(fp);
-        if (byte == CLOSE_BRANCH || byte == EOF)
-            return FALSE;
-        if (byte == SIBLING_BRANCH)
-            return TRUE;
+/* Copy the next n bytes from a buffer into dest. The return value is
+ * false if fewer than n bytes remain.
+ */
+static int getbytes(filebuffer *buf, void *dest, long n)
+{
+    if (buf->size - buf->pos < n)
+        return FALSE;
+    memcpy(dest, buf->data + buf->pos, n);
+    buf->pos += n;
+    return TRUE;
+}
+
+/* Make room for one more entry, of the given size in bytes, on a
+ * stack. The return value points to the new entry.
+ */
+static void *pushentry(workstack *stack, int entrysize)
+{
+    if (stack->count == stack->size) {
+        stack->size = stack->size ? 2 * stack->size : 64;
+        stack->entries = reallocate(stack->entries, stack->size * entrysize);
+    }
+    ++stack->count;
+    return (char*)stack->entries + (stack->count - 1) * entrysize;
+}
+
+/* Write a non-negative number to a buffer, seven bits at a time,
+ * starting with the lowest bits. The top bit of each byte is set if
+ * more bytes follow.
+ */
+static void putcount(filebuffer *buf, unsigned long n)
+{
+    while (n >= 0x80) {
+        putbyte(buf, (int)(n & 0x7F) | 0x80);
+        n >>= 7;
+    }
+    putbyte(buf, (int)n);
+}
+
+/* Read a number written by putcount(). The return value is -1 if the
+ * buffer ends first or the number is implausibly large.
+ */
+static long getcount(filebuffer *buf)
+{
+    long n;
+    int byte, shift;
+
+    n = 0;
+    for (shift = 0 ; shift < 28 ; shift += 7) {
+        byte = getbyte(buf);
+        if (byte == EOF)
+            return -1;
+        n |= (long)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return n;
+    }
+    return -1;
+}
+
+/* Find the locations of all the sibling subtrees in a session file,
+ * starting at the given offset. Only the delimiters are examined, so
+ * this takes a fraction of the time that loading the moves would.
+ * The stack holds the index of the subtree currently open at each
+ * level of nesting. A subtree containing a solution marks its parent
+ * as doing so as well.
+ */
+static void scansessiontree(filebuffer const *buf, long pos)
+{
+    workstack stack = { NULL, 0, 0 };
+    subtree *sub;
+    int *open;
+    int byte;
+
+    subtrees.count = 0;
+    while (pos < buf->size) {
+        byte = buf->data[pos++];
         if (byte == START_BRANCH) {
-            while (loadsession_recurse(position))
+            *(int*)pushentry(&stack, sizeof(int)) = subtrees.count;
+        } else if (byte == SIBLING_BRANCH || byte == CLOSE_BRANCH) {
+            if (!stack.count)
+                break;
+            open = stack.entries;
+            sub = (subtree*)subtrees.entries + open[stack.count - 1];
+            sub->end = pos - 1;
+            sub->last = byte == CLOSE_BRANCH;
+            if (sub->solution && stack.count > 1)
+                ((subtree*)subtrees.entries)[open[stack.count - 2]]
+                                                    .solution = TRUE;
+            if (byte == CLOSE_BRANCH) {
+                --stack.count;
+                continue;
+            }
+            open[stack.count - 1] = subtrees.count;
+        } else {
+            if (byte == CHECKPOINT)
+                pos += SIZE_CHECKPOINT;
+            else if (byte == SOLUTION_MARK && stack.count)
+                ((subtree*)subtrees.entries)
+                        [((int*)stack.entries)[stack.count - 1]]
+                                                    .solution = TRUE;
+            else if (byte != SOLUTION_MARK)
+                ++pos;
+            continue;
+        }
+        sub = pushentry(&subtrees, sizeof *sub);
+        sub->start = pos;
+        sub->end = -1;
+        sub->last = FALSE;
+        sub->solution = FALSE;
+    }
+    deallocate(stack.entries);
+}
+
+/* Return the subtree that begins at the given offset, or NULL if
+ * there is none.
+ */
+static subtree const *findsubtree(long start)
+{
+    subtree const *list;
+    int lo, hi, mid;
+
+    list = subtrees.entries;
+    lo = 0;
+    hi = subtrees.count;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (list[mid].start < start)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo < subtrees.count && list[lo].start == start && list[lo].end > 0)
+        return list + lo;
+    return NULL;
+}
+
+/* Read a tree's worth of moves from the session file, stopping at the
+ * given offset. For each move, the game state is recreated and added
+ * to the session, below the given starting position. The stack holds
+ * the positions at the start of each currently open sequence of
+ * branches. In a version 2 file, the game state is recreated from the
+ * recorded places, and only the state data saved in the session is
+ * kept up to date. If defer is true, a sibling subtree is skipped over
+ * and recorded as deferred, unless it is the last of its siblings (and
+ * so the most recently used) or it contains a solution.
+ */
+static void loadsessiontree(filebuffer *buf, redo_session *session,
+                            gameplayinfo *gameplay, int version,
+                            redo_position *position, long end, int defer)
+{
+    workstack stack = { NULL, 0, 0 };
+    deferral *entry;
+    subtree const *sub;
+    card_t checkpoint[NCARDS + NPLACES];
+    int moveid, byte, places, f;
+
+    while (buf->pos < end && (byte = getbyte(buf)) != EOF) {
+        if (byte == START_BRANCH || byte == SIBLING_BRANCH) {
+            if (byte == START_BRANCH) {
+                *(redo_position**)pushentry(&stack, sizeof position) =
+                                                                position;
+            } else {
+                if (!stack.count)
+                    break;
+                position = ((redo_position**)stack.entries)[stack.count - 1];
+                if (version >= 2)
+                    seedsavedstate(gameplay, position);
+                else
+                    restoresavedstate(gameplay, position);
+            }
+            sub = defer ? findsubtree(buf->pos) : NULL;
+            if (sub && sub->end > sub->start && !sub->last &&
+                                                !sub->solution) {
+                entry = pushentry(&deferrals, sizeof *entry);
+                entry->position = position;
+                entry->start = sub->start;
+                buf->pos = sub->end;
+            }
+            continue;
+        }
+        if (byte == CLOSE_BRANCH) {
+            if (!stack.count)
+                break;
+            position = ((redo_position**)stack.entries)[--stack.count];
+            if (version >= 2)
+                seedsavedstate(gameplay, position);
+            else
                 restoresavedstate(gameplay, position);
             continue;
         }
+        if (version >= 2 && byte == CHECKPOINT) {
+            f = getbytes(buf, checkpoint, SIZE_CHECKPOINT);
+            if (!f || memcmp(checkpoint, &gameplay->covers, SIZE_CHECKPOINT)) {
+                warn("%s:%ld: session tree does not match saved state",
+                     sessionfilename, buf->pos);
+                break;
+            }
+            continue;
+        }
+        if (version >= 3 && byte == SOLUTION_MARK)
+            continue;
         moveid = byte & MOVE_MASK;
-        if (!applymove(gameplay, moveidtocmd(gameplay, moveid))) {
+        if (version >= 2) {
+            places = getbyte(buf);
+            f = places != EOF && replaymove(gameplay, moveid,
+                                            places >> 4, places & 0x0F);
+        } else {
+            f = applymove(gameplay, moveidtocmd(gameplay, moveid));
+        }
+        if (!f) {
             warn("%s:%ld: unable to reinstantiate session tree",
-                 sessionfilename, ftell(fp));
+                 sessionfilename, buf->pos);
             continue;
         }
         position = recordgamestate(gameplay, session, position, moveid,
                                    byte & BETTER_FLAG ? redo_checklater
                                                       : redo_nocheck);
     }
+    deallocate(stack.entries);
+}
+
+/* Return true if changes to the session are to be recorded in the
+ * journal.
+ */
+static int isjournaling(void)
+{
+    return journalfilename && basesize >= 0 && !journalfailed &&
+           !replayingjournal && !getreadonly();
+}
+
+/* Begin a new journal record, preceded by the journal's header if
+ * the journal is currently empty.
+ */
+static void beginrecord(filebuffer *buf, int op)
+{
+    if (!journalsize) {
+        putbytes(buf, journalsignature, sizeof journalsignature);
+        putbyte(buf, JOURNAL_VERSION);
+        putcount(buf, basesize);
+        putbyte(buf, journaldeferred);
+    }
+    putbyte(buf, op);
+}
+
+/* Append a completed record to the journal, opening the journal
+ * first if necessary. If the journal cannot be written to, it is
+ * abandoned, and the session file will be rewritten instead when the
+ * session is closed.
+ */
+static void writerecord(filebuffer *buf)
+{
+    if (!journalfp) {
+        waitforfile(journalfilename);
+        journalfp = fopen(journalfilename, journalsize ? "ab" : "wb");
+    }
+    if (!journalfp || fwrite(buf->data, buf->size, 1, journalfp) != 1
+                   || fflush(journalfp)) {
+        perror(journalfilename);
+        journalfailed = TRUE;
+    }
+    journalsize += buf->size;
+    deallocate(buf->data);
+}
+
+/* Forget the deferred subtrees, and the session file contents that
+ * they refer to.
+ */
+static void discarddeferred(void)
+{
+    deallocate(sessiondata.data);
+    sessiondata.data = NULL;
+    sessiondata.size = 0;
+    subtrees.count = 0;
+    deferrals.count = 0;
+}
+
+/* Load one of the deferred subtrees, and remove it from the list. The
+ * subtree's branch is added after the parent's existing branches,
+ * leaving the most recently used branch in front.
+ */
+static void loaddeferred(redo_session *session, gameplayinfo *gameplay,
+                         int index)
+{
+    deferral *list;
+    deferral entry;
+    subtree const *sub;
+    int front;
+
+    list = deferrals.entries;
+    entry = list[index];
+    list[index] = list[--deferrals.count];
+    sub = findsubtree(entry.start);
+    front = entry.position->nextcount ? entry.position->next[0].move : -1;
+    seedsavedstate(gameplay, entry.position);
+    sessiondata.pos = entry.start;
+    loadsessiontree(&sessiondata, session, gameplay, sessionversion,
+                    entry.position, sub->end, TRUE);
+    if (front >= 0)
+        redo_getnextposition(entry.position, front);
+}
+
+/* Find the deferred subtree at the given location. The return value
+ * is its index in the list, or -1 if it is not deferred.
+ */
+static int finddeferred(long start)
+{
+    deferral const *list;
+    int i;
+
+    list = deferrals.entries;
+    for (i = 0 ; i < deferrals.count ; ++i)
+        if (list[i].start == start)
+            return i;
+    return -1;
+}
+
+/* Write one branch of a position to the session file: the move byte,
+ * followed, unless the file is in the original format, by the places
+ * byte, the state data if a checkpoint is due, and a mark if the move
+ * reaches an endpoint. The return value is false if the places that
+ * the card moved between cannot be determined, in which case nothing
+ * is written after the move byte.
+ */
+static int savemove(filebuffer *buf, redo_branch const *branch, int version)
+{
+    place_t from, to;
+
+    putbyte(buf, movevalue(branch));
+    if (version < 2)
+        return TRUE;
+    if (!getmoveplaces(branch->p->prev, branch, &from, &to))
+        return FALSE;
+    putbyte(buf, (from << 4) | to);
+    if (branch->p->movecount % CHECKPOINT_INTERVAL == 0) {
+        putbyte(buf, CHECKPOINT);
+        putbytes(buf, redo_getsavedstate(branch->p), SIZE_CHECKPOINT);
+    }
+    if (branch->p->endpoint)
+        putbyte(buf, SOLUTION_MARK);
+    return TRUE;
+}
+
+/* Copy a subtree that was never loaded from the original file. If the
+ * file is being written in the original format, only the move bytes
+ * and the delimiters are kept.
+ */
+static void copysubtree(filebuffer *buf, subtree const *sub, int version)
+{
+    long pos;
+    int byte;
+
+    if (version >= 2) {
+        putbytes(buf, sessiondata.data + sub->start, sub->end - sub->start);
+        return;
+    }
+    pos = sub->start;
+    while (pos < sub->end) {
+        byte = sessiondata.data[pos++];
+        if (byte == CHECKPOINT) {
+            pos += SIZE_CHECKPOINT;
+        } else if (byte != SOLUTION_MARK) {
+            putbyte(buf, byte);
+            if (byte != START_BRANCH && byte != SIBLING_BRANCH &&
+                                        byte != CLOSE_BRANCH)
+                ++pos;
+        }
+    }
+}
+
+/* Comparison function for sorting deferred subtrees by their parent
+ * position, and then by their location in the file.
+ */
+static int cmpdeferrals(void const *a, void const *b)
+{
+    deferral const *x = a;
+    deferral const *y = b;
+
+    if (x->position != y->position)
+        return (char const*)x->position < (char const*)y->position ? -1 : 1;
+    return x->start < y->start ? -1 : x->start > y->start ? 1 : 0;
+}
+
+/* Return the number of deferred subtrees that branch from the given
+ * position, and set *pfirst to the first of them, given a list sorted
+ * by cmpdeferrals().
+ */
+static int finddeferrals(deferral const *list, int count,
+                         redo_position const *position,
+                         deferral const **pfirst)
+{
+    int lo, hi, mid;
+
+    lo = 0;
+    hi = count;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if ((char const*)list[mid].position < (char const*)position)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *pfirst = list + lo;
+    for (hi = lo ; hi < count && list[hi].position == position ; ++hi) ;
+    return hi - lo;
+}
+
+/* Write the tree of moves to the session file. At a position with
+ * multiple branches, the siblings are output in reverse order, so
+ * that their current ordering will be naturally restored when the
+ * file is read back in. (This ordering falls out naturally from
+ * pushing the branches on the stack in their current order.) Any
+ * subtrees that were never loaded are copied from the original file,
+ * ahead of the loaded siblings. The return value is false if a move
+ * could not be written out in full.
+ */
+static int savesessiontree(filebuffer *buf, redo_session const *session,
+                           int version)
+{
+    workstack stack = { NULL, 0, 0 };
+    saveentry *entry;
+    deferral *sorted;
+    deferral const *deferred;
+    redo_position const *position;
+    int count, n, i, f;
+
+    f = TRUE;
+    count = deferrals.count;
+    sorted = NULL;
+    if (count) {
+        sorted = allocate(count * sizeof *sorted);
+        memcpy(sorted, deferrals.entries, count * sizeof *sorted);
+        qsort(sorted, count, sizeof *sorted, cmpdeferrals);
+    }
+    deferred = NULL;
+
+    position = redo_getfirstposition(session);
+    for (;;) {
+        for (;;) {
+            n = count ? finddeferrals(sorted, count, position, &deferred)
+                      : 0;
+            if (position->nextcount != 1 || n)
+                break;
+            if (!savemove(buf, position->next, version))
+                f = FALSE;
+            position = position->next->p;
+        }
+        if (position->nextcount + n > 0) {
+            putbyte(buf, START_BRANCH);
+            entry = pushentry(&stack, sizeof *entry);
+            entry->branch = NULL;
+            entry->byte = CLOSE_BRANCH;
+            for (i = 0 ; i < (int)position->nextcount + n ; ++i) {
+                if (i) {
+                    entry = pushentry(&stack, sizeof *entry);
+                    entry->branch = NULL;
+                    entry->byte = SIBLING_BRANCH;
+                }
+                entry = pushentry(&stack, sizeof *entry);
+                if (i < (int)position->nextcount) {
+                    entry->branch = position->next + i;
+                } else {
+                    entry->branch = NULL;
+                    entry->byte = -1;
+                    entry->start = deferred[n - 1 - (i - position->nextcount)]
+                                                                    .start;
+                }
+            }
+        }
+        for (;;) {
+            if (!stack.count) {
+                deallocate(stack.entries);
+                deallocate(sorted);
+                return f;
+            }
+            --stack.count;
+            entry = (saveentry*)stack.entries + stack.count;
+            if (entry->branch)
+                break;
+            if (entry->byte >= 0) {
+                putbyte(buf, entry->byte);
+            } else {
+                copysubtree(buf, findsubtree(entry->start), version);
+            }
+        }
+        if (!savemove(buf, entry->branch, version))
+            f = FALSE;
+        position = entry->branch->p;
+    }
 }
 
-/* Write a subtree's worth of moves to the session file, rooted at the
- * given position.
+/* Fill a stack with the move IDs leading from the root of the session
+ * to the given position.
  */
-static void savesession_recurse(redo_position const *position)
+static void getpath(workstack *path, redo_position const *position)
 {
-    while (position->nextcount == 1) {
-        fputc(movevalue(position->next), fp);
-        position = position->next->p;
+    redo_branch const *branch;
+    int *moves;
+    int i;
+
+    path->count = 0;
+    for (i = 0 ; i < (int)position->movecount ; ++i)
+        pushentry(path, sizeof *moves);
+    moves = path->entries;
+    for (i = path->count - 1 ; i >= 0 ; --i) {
+        branch = position->prev->next;
+        while (branch->p != position)
+            ++branch;
+        moves[i] = branch->move;
+        position = position->prev;
+    }
+}
+
+/* Read the journal, and check that it extends the session file that
+ * was just read. A journal written for a different version of the
+ * session file is out of date, and is discarded. The return value is
+ * the journal's deferred flag, or -1 if there is no journal to
+ * replay. The buffer is left at the first record.
+ */
+static int readjournal(filebuffer *buf)
+{
+    char header[sizeof journalsignature + 1];
+    int version, flag, f;
+
+    journalsize = 0;
+    if (!readfile(journalfilename, buf)) {
+        if (errno != ENOENT) {
+            perror(journalfilename);
+            journalfailed = TRUE;
+        }
+        return -1;
+    }
+    flag = FALSE;
+    f = getbytes(buf, header, sizeof header) &&
+        !memcmp(header, journalsignature, sizeof journalsignature);
+    if (f) {
+        version = header[sizeof journalsignature];
+        f = version >= 1 && version <= JOURNAL_VERSION &&
+            getcount(buf) == basesize;
+        if (f && version >= 2)
+            f = (flag = getbyte(buf)) == FALSE || flag == TRUE;
     }
-    if (position->nextcount > 0) {
-        fputc(START_BRANCH, fp);
-        savesession_branchrecurse(position->next);
-        fputc(CLOSE_BRANCH, fp);
+    if (!f) {
+        if (!getreadonly())
+            remove(journalfilename);
+        return -1;
     }
+    journalsize = buf->size;
+    return flag;
 }
 
-/* Recursively write a set of sibling branches to the session file,
- * depth first. The siblings are output in reverse order, so that
- * their current ordering will be naturally restored when the file is
- * read back in.
+/* Replay the changes recorded in the journal on top of the session
+ * that was just loaded. The path to each record's position is kept
+ * as a list of moves, and followed from the root, exactly as when the
+ * journal was written, since a graft can move positions to a new
+ * parent. Deferred subtrees are loaded just as expandposition() did
+ * during play. (Subtrees that were loaded while a graft was being
+ * updated will have already been loaded again in the same way, and
+ * are skipped.) The return value is false if the journal could not be
+ * completely replayed, in which case the session should be saved
+ * afresh.
  */
-static void savesession_branchrecurse(redo_branch const *branch)
+static int replayjournal(filebuffer *buf, redo_session *session,
+                         gameplayinfo *gameplay)
 {
-    if (branch->cdr) {
-        savesession_branchrecurse(branch->cdr);
-        fputc(SIBLING_BRANCH, fp);
+    redo_position *position, *pos;
+    long up, down, count, start;
+    int loaded, op, byte, i, f;
+
+    replayingjournal = TRUE;
+    journalpath.count = 0;
+    f = TRUE;
+    while (f && (op = getbyte(buf)) != EOF) {
+        if (op == JOURNAL_EXPAND) {
+            count = getcount(buf);
+            f = count > 0;
+            loaded = FALSE;
+            for ( ; f && count > 0 ; --count) {
+                start = getcount(buf);
+                f = start >= 0;
+                if (f && (i = finddeferred(start)) >= 0) {
+                    loaddeferred(session, gameplay, i);
+                    loaded = TRUE;
+                }
+            }
+            if (loaded)
+                redo_setbetterfields(session);
+            continue;
+        }
+        up = getcount(buf);
+        down = getcount(buf);
+        f = (op == JOURNAL_ADD || op == JOURNAL_DROP) && up >= 0 && down >= 0;
+        f = f && up <= journalpath.count;
+        if (f)
+            journalpath.count -= up;
+        for ( ; f && down > 0 ; --down)
+            if ((f = (byte = getbyte(buf)) != EOF))
+                *(int*)pushentry(&journalpath, sizeof byte) = byte;
+        position = redo_getfirstposition(session);
+        for (i = 0 ; f && i < journalpath.count ; ++i)
+            f = (position = redo_findnextposition(position,
+                                ((int*)journalpath.entries)[i])) != NULL;
+        if (!f)
+            break;
+        if (op == JOURNAL_ADD) {
+            byte = getbyte(buf);
+            pos = NULL;
+            if (byte != EOF) {
+                pos = redo_findnextposition(position, byte);
+                if (!pos)
+                    pos = recordmove(gameplay, session, position, byte);
+                *(int*)pushentry(&journalpath, sizeof byte) = byte;
+            }
+        } else {
+            pos = position->prev;
+            if (pos && redo_dropposition(session, position) == position)
+                pos = NULL;
+            --journalpath.count;
+        }
+        f = pos != NULL;
     }
-    fputc(movevalue(branch), fp);
-    savesession_recurse(branch->p);
+    if (!f) {
+        warn("%s:%ld: journal does not match the session tree",
+             journalfilename, buf->pos);
+        journalpath.count = 0;
+    }
+    replayingjournal = FALSE;
+    return f;
+}
+
+/*
+ * Internal functions.
+ */
+
+/* Check a session file's header and checksum. Files that predate
+ * checksums, or whose version is not known, cannot be verified
+ * without being loaded.
+ */
+int verifysessiondata(filebuffer const *buf)
+{
+    int version;
+
+    if (!buf->size)
+        return CHECK_VALID;
+    if (buf->size < (long)sizeof signature + 1 ||
+                memcmp(buf->data, signature, sizeof signature))
+        return CHECK_UNVERIFIED;
+    version = buf->data[sizeof signature];
+    if (version < CHECKSUM_VERSION || version > SESSION_VERSION)
+        return CHECK_UNVERIFIED;
+    return checksumvalid(buf) ? CHECK_VALID : CHECK_DAMAGED;
 }
 
 /*
@@ -115,51 +829,288 @@ static void savesession_branchrecurse(redo_branch const *branch)
  */
 void setsessionfilename(char const *filename)
 {
+    if (journalfp) {
+        fclose(journalfp);
+        journalfp = NULL;
+    }
     if (sessionfilename)
         deallocate(sessionfilename);
+    if (journalfilename)
+        deallocate(journalfilename);
+    if (packfilename)
+        deallocate(packfilename);
+    packfilename = NULL;
+    sessiongameid = -1;
     sessionfilename = mkdatapath(filename);
+    journalfilename = allocate(strlen(sessionfilename) + 5);
+    sprintf(journalfilename, "%s.jnl", sessionfilename);
+    journalsize = 0;
+    basesize = -1;
+    journalfailed = FALSE;
+    journalpath.count = 0;
+    discarddeferred();
+}
+
+/* Select the session file for the given game. If the session pack is
+ * in use, the session is read from and written to the pack instead.
+ */
+void setsessiongame(int gameid)
+{
+    char buf[16];
+
+    sprintf(buf, "session-%04d", gameid);
+    setsessionfilename(buf);
+    if (usingsessionpack()) {
+        packfilename = mkpackpath();
+        sessiongameid = gameid;
+    }
 }
 
 /* Read the game tree stored in the session file and recreate it,
- * storing all the positions in the redo session. The game state is
- * restored to the starting position before returning.
+ * storing all the positions in the redo session. A file without a
+ * header is read as an original session file. A file whose checksum
+ * does not match is reported, but is still loaded as far as it can be.
+ * If deferred loading is enabled, sibling subtrees that were not the
+ * most recently used, and that contain no solutions, are skipped over,
+ * to be loaded on demand by expandposition(). The changes in the
+ * journal are then replayed, and if this cannot be done cleanly the
+ * session file is rewritten immediately. (The journal determines
+ * whether loading is deferred, since it must be replayed on the same
+ * positions that it was recorded with.) The game state is restored to
+ * the starting position before returning.
  */
-int loadsession(redo_session *session_arg, gameplayinfo *gameplay_arg)
+int loadsession(redo_session *session, gameplayinfo *gameplay)
 {
+    filebuffer buf = { NULL, 0, 0, 0 };
+    filebuffer journal = { NULL, 0, 0, 0 };
+    char header[sizeof signature + 1];
+    int version, mode, defer, f;
+
     if (!sessionfilename)
         return FALSE;
+    discarddeferred();
 
-    fp = fopen(sessionfilename, "rb");
-    if (!fp) {
-        if (errno == ENOENT) {
-            return TRUE;
-        } else {
-            perror(sessionfilename);
+    if (packfilename) {
+        waitforfile(packfilename);
+        f = readpackedsession(packfilename, sessiongameid, &buf);
+    } else {
+        waitforfile(sessionfilename);
+        f = readfile(sessionfilename, &buf);
+    }
+    waitforfile(journalfilename);
+    if (!f) {
+        deallocate(buf.data);
+        if (errno != ENOENT) {
+            perror(packfilename ? packfilename : sessionfilename);
             return FALSE;
         }
     }
-    gameplay = gameplay_arg;
-    session = session_arg;
-    loadsession_recurse(redo_getfirstposition(session));
-    fclose(fp);
+    basesize = buf.size;
+
+    version = 1;
+    if (getbytes(&buf, header, sizeof header) &&
+                !memcmp(header, signature, sizeof signature)) {
+        version = header[sizeof signature];
+        if (version < 2 || version > SESSION_VERSION) {
+            warn("%s: unsupported session file version %d",
+                 sessionfilename, version);
+            deallocate(buf.data);
+            return FALSE;
+        }
+    } else {
+        buf.pos = 0;
+    }
+    if (version >= CHECKSUM_VERSION) {
+        if (!checksumvalid(&buf))
+            warn("%s: session file checksum does not match",
+                 sessionfilename);
+        if (buf.size >= buf.pos + SIZE_CHECKSUM)
+            buf.size -= SIZE_CHECKSUM;
+    }
+    setpositionexpander(expandposition);
+    mode = readjournal(&journal);
+    defer = version >= 3 && (mode >= 0 ? mode : deferloading);
+    if (defer)
+        scansessiontree(&buf, buf.pos);
+    loadsessiontree(&buf, session, gameplay, version,
+                    redo_getfirstposition(session), buf.size, defer);
+    if (deferrals.count) {
+        sessiondata = buf;
+        sessionversion = version;
+    } else {
+        deallocate(buf.data);
+        subtrees.count = 0;
+    }
     redo_setbetterfields(session);
+    journaldeferred = mode >= 0 ? mode : deferrals.count > 0;
+    f = mode >= 0 ? replayjournal(&journal, session, gameplay)
+                  : !journalfailed;
+    deallocate(journal.data);
+    if (!deferloading && deferrals.count) {
+        replayingjournal = TRUE;
+        expandposition(session, gameplay, NULL);
+        replayingjournal = FALSE;
+        f = FALSE;
+    }
+    if (!f && !getreadonly())
+        savesession(session);
     restoresavedstate(gameplay, redo_getfirstposition(session));
     return TRUE;
 }
 
-/* Write the moves in the redo session out to the session file.
+/* Load the subtrees branching from the given position that were
+ * skipped over when the session was loaded, or every remaining
+ * subtree if position is NULL. The subtrees loaded are recorded in
+ * the journal. The game state is left unchanged. The return value is
+ * true if any positions were added to the session.
+ */
+int expandposition(redo_session *session, gameplayinfo *gameplay,
+                   redo_position *position)
+{
+    filebuffer buf = { NULL, 0, 0, 0 };
+    workstack loaded = { NULL, 0, 0 };
+    gameplayinfo saved;
+    deferral const *list;
+    long *starts;
+    int i;
+
+    if (!deferrals.count)
+        return FALSE;
+    saved = *gameplay;
+    i = 0;
+    while (i < deferrals.count) {
+        list = deferrals.entries;
+        if (position && list[i].position != position) {
+            ++i;
+            continue;
+        }
+        *(long*)pushentry(&loaded, sizeof *starts) = list[i].start;
+        loaddeferred(session, gameplay, i);
+        if (position)
+            i = 0;
+    }
+    if (loaded.count) {
+        redo_setbetterfields(session);
+        if (isjournaling()) {
+            beginrecord(&buf, JOURNAL_EXPAND);
+            putcount(&buf, loaded.count);
+            starts = loaded.entries;
+            for (i = 0 ; i < loaded.count ; ++i)
+                putcount(&buf, starts[i]);
+            writerecord(&buf);
+        }
+        deallocate(loaded.entries);
+    }
+    if (!deferrals.count)
+        discarddeferred();
+    *gameplay = saved;
+    return loaded.count > 0;
+}
+
+/* Enable or disable deferred loading of session files.
+ */
+void setdeferredloading(int enabled)
+{
+    deferloading = enabled;
+}
+
+/* Write the moves in the redo session out to the session file. The
+ * file's contents are assembled in memory, and then handed off to be
+ * saved in the background. Once the file has been saved, the journal
+ * is no longer needed, and is removed. If the places of a move cannot
+ * be recorded, the file is written in the original format instead,
+ * which the loader recreates by applying the moves. If subtrees remain
+ * unloaded, the positions in memory no longer correspond to what
+ * loading the new file would produce, so no further changes are
+ * journalled, and the file is instead rewritten when the journal is
+ * closed.
  */
 int savesession(redo_session const *session)
 {
+    filebuffer buf = { NULL, 0, 0, 0 };
+    long size;
+    int f;
+
     if (!sessionfilename || getreadonly())
         return FALSE;
 
-    fp = fopen(sessionfilename, "wb");
-    if (!fp) {
-        perror(sessionfilename);
-        return FALSE;
+    putbytes(&buf, signature, sizeof signature);
+    putbyte(&buf, SESSION_VERSION);
+    if (savesessiontree(&buf, session, SESSION_VERSION)) {
+        putchecksum(&buf);
+    } else {
+        warn("%s: unable to record the places of a move, saving the"
+             " session in the original format", sessionfilename);
+        buf.size = 0;
+        savesessiontree(&buf, session, 1);
+    }
+    if (journalfp) {
+        fclose(journalfp);
+        journalfp = NULL;
+    }
+    size = buf.size;
+    if (packfilename)
+        f = savepackedlater(packfilename, sessiongameid, &buf,
+                            journalfilename);
+    else
+        f = savefilelater(sessionfilename, &buf, journalfilename);
+    if (f) {
+        basesize = size;
+        journalsize = 0;
+        journalfailed = FALSE;
+        journaldeferred = FALSE;
+        journalpath.count = 0;
+        if (deferrals.count)
+            journalfailed = TRUE;
+    }
+    return f;
+}
+
+/* Append a record of a change to the session to the journal. The
+ * journal is opened the first time that a change is recorded, and a
+ * header is written if it is new.
+ */
+void journalposition(redo_position const *position, int added)
+{
+    filebuffer buf = { NULL, 0, 0, 0 };
+    workstack path = { NULL, 0, 0 };
+    int *from, *to;
+    int common, n, i;
+
+    if (!isjournaling())
+        return;
+
+    getpath(&path, position);
+    from = journalpath.entries;
+    to = path.entries;
+    n = added ? path.count - 1 : path.count;
+    for (common = 0 ; common < n && common < journalpath.count ; ++common)
+        if (from[common] != to[common])
+            break;
+
+    beginrecord(&buf, added ? JOURNAL_ADD : JOURNAL_DROP);
+    putcount(&buf, journalpath.count - common);
+    putcount(&buf, n - common);
+    for (i = common ; i < path.count ; ++i)
+        putbyte(&buf, to[i]);
+    writerecord(&buf);
+
+    deallocate(journalpath.entries);
+    journalpath = path;
+    if (!added)
+        --journalpath.count;
+}
+
+/* Close the journal. If the journal has grown large, or if it could
+ * not be kept up to date, the session file is rewritten.
+ */
+int closejournal(redo_session const *session)
+{
+    if (journalfp) {
+        fclose(journalfp);
+        journalfp = NULL;
     }
-    savesession_recurse(redo_getfirstposition(session));
-    fclose(fp);
+    if (journalfailed || basesize < 0 || journalsize > JOURNAL_LIMIT)
+        return savesession(session);
     return TRUE;
 }
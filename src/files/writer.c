@@ -0,0 +1,229 @@
+/* files/writer.c: saving files in the background.
+ *
+ * The contents of a file to be saved are assembled in memory by the
+ * caller, and then handed to a worker thread, which does the actual
+ * writing. The caller can thus return to the user without waiting
+ * for the data to reach the disk. The thread is started the first
+ * time it is needed, and is stopped at exit once every pending file
+ * has been written.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "./gen.h"
+#include "files/files.h"
+#include "internal.h"
+
+/* A file waiting to be saved. If gameid is not negative, the data is
+ * a session to be stored in the session pack named by filename. The
+ * obsolete field, if not NULL, names a file to be deleted once the
+ * new contents have been saved.
+ */
+typedef struct savejob {
+    struct savejob *next;       /* the next job in the queue */
+    char *filename;             /* the file to save */
+    int gameid;                 /* the session's game, or -1 */
+    char *obsolete;             /* a file to remove afterwards */
+    filebuffer buf;             /* the file's new contents */
+} savejob;
+
+/* The state of the worker. The queue is protected by the lock. The
+ * job at the front of the queue is the one currently being written,
+ * if busy is set. Jobs remain in the queue until they are finished.
+ */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jobready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t jobdone = PTHREAD_COND_INITIALIZER;
+static pthread_t worker;
+static savejob *queue = NULL;
+static int running = FALSE;
+static int stopping = FALSE;
+static int busy = FALSE;
+
+/* Free a job and its contents.
+ */
+static void freejob(savejob *job)
+{
+    deallocate(job->filename);
+    deallocate(job->obsolete);
+    deallocate(job->buf.data);
+    deallocate(job);
+}
+
+/* Write out a file, and remove the obsolete file if the new one was
+ * successfully saved.
+ */
+static int runjob(savejob const *job)
+{
+    int f;
+
+    if (job->gameid < 0)
+        f = savefile(job->filename, &job->buf);
+    else
+        f = savepackedsession(job->filename, job->gameid, &job->buf);
+    if (f && job->obsolete)
+        remove(job->obsolete);
+    return f;
+}
+
+/* The worker thread. Jobs are taken from the front of the queue and
+ * written out until the thread is told to stop and the queue is
+ * empty.
+ */
+static void *workerthread(void *data)
+{
+    savejob *job;
+
+    (void)data;
+    pthread_mutex_lock(&lock);
+    for (;;) {
+        while (!queue && !stopping)
+            pthread_cond_wait(&jobready, &lock);
+        if (!queue)
+            break;
+        job = queue;
+        busy = TRUE;
+        pthread_mutex_unlock(&lock);
+        runjob(job);
+        pthread_mutex_lock(&lock);
+        queue = job->next;
+        busy = FALSE;
+        freejob(job);
+        pthread_cond_broadcast(&jobdone);
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+/* Return true if a queued job will write or remove the given file.
+ * The lock must be held.
+ */
+static int ispending(char const *filename)
+{
+    savejob const *job;
+
+    for (job = queue ; job ; job = job->next)
+        if (!strcmp(job->filename, filename) ||
+                        (job->obsolete && !strcmp(job->obsolete, filename)))
+            return TRUE;
+    return FALSE;
+}
+
+/* Wait for every queued file to be written out, and then stop the
+ * worker thread. Files saved after this point are written
+ * immediately. This function is called at exit.
+ */
+static void stopworker(void)
+{
+    pthread_mutex_lock(&lock);
+    stopping = TRUE;
+    pthread_cond_signal(&jobready);
+    pthread_mutex_unlock(&lock);
+    if (running) {
+        pthread_join(worker, NULL);
+        running = FALSE;
+    }
+}
+
+/* Queue a job for the worker thread, starting the thread if
+ * necessary. If the same file is already waiting to be saved, the
+ * waiting job is given the new contents instead. If the thread cannot
+ * be used, the job is done immediately.
+ */
+static int queuejob(char const *filename, int gameid, filebuffer *buf,
+                    char const *obsolete)
+{
+    savejob *job, **pjob;
+    int f;
+
+    pthread_mutex_lock(&lock);
+    if (!running && !stopping) {
+        running = !pthread_create(&worker, NULL, workerthread, NULL);
+        if (running)
+            atexit(stopworker);
+        else
+            stopping = TRUE;
+    }
+    if (!running) {
+        pthread_mutex_unlock(&lock);
+        job = allocate(sizeof *job);
+        job->filename = strallocate(filename);
+        job->gameid = gameid;
+        job->obsolete = obsolete ? strallocate(obsolete) : NULL;
+        job->buf = *buf;
+        f = runjob(job);
+        freejob(job);
+        return f;
+    }
+
+    pjob = &queue;
+    if (busy)
+        pjob = &queue->next;
+    for ( ; *pjob ; pjob = &(*pjob)->next)
+        if (!strcmp((*pjob)->filename, filename) &&
+                        (*pjob)->gameid == gameid)
+            break;
+    job = *pjob;
+    if (job) {
+        deallocate(job->buf.data);
+        deallocate(job->obsolete);
+    } else {
+        job = allocate(sizeof *job);
+        job->next = NULL;
+        job->filename = strallocate(filename);
+        job->gameid = gameid;
+        *pjob = job;
+    }
+    job->obsolete = obsolete ? strallocate(obsolete) : NULL;
+    job->buf = *buf;
+    pthread_cond_signal(&jobready);
+    pthread_mutex_unlock(&lock);
+    return TRUE;
+}
+
+/*
+ * Internal functions.
+ */
+
+/* Queue a file to be saved by the worker thread.
+ */
+int savefilelater(char const *filename, filebuffer *buf, char const *obsolete)
+{
+    return queuejob(filename, -1, buf, obsolete);
+}
+
+/* Queue a session to be stored in the session pack by the worker
+ * thread.
+ */
+int savepackedlater(char const *packname, int gameid, filebuffer *buf,
+                    char const *obsolete)
+{
+    return queuejob(packname, gameid, buf, obsolete);
+}
+
+/* Wait until the given file is no longer waiting to be written or
+ * removed by the worker thread.
+ */
+void waitforfile(char const *filename)
+{
+    pthread_mutex_lock(&lock);
+    while (ispending(filename))
+        pthread_cond_wait(&jobdone, &lock);
+    pthread_mutex_unlock(&lock);
+}
+
+/*
+ * External functions.
+ */
+
+/* Wait for every queued file to be written out.
+ */
+void finishsaving(void)
+{
+    pthread_mutex_lock(&lock);
+    while (queue)
+        pthread_cond_wait(&jobdone, &lock);
+    pthread_mutex_unlock(&lock);
+}
@@ -49,12 +49,48 @@ extern void setanimation(int enabled);
  */
 extern void setbranching(int enabled);
 
+/* Set the maximum number of positions to keep in a game's redo
+ * session, or zero for no limit. When the limit is exceeded, the
+ * least recently visited branches that are not part of a solution are
+ * forgotten. The limit takes effect when the next game begins.
+ */
+extern void setpositionlimit(int limit);
+
+/* Set a function to be notified of every change that the user makes
+ * to the structure of the redo session. The function is called with
+ * added set to true after a new position has been added, and with
+ * added set to false just before a position is removed, including
+ * positions removed to keep the session under its position limit.
+ * NULL can be passed to stop the notifications.
+ */
+extern void setpositionlogger(void (*logger)(redo_position const *position,
+                                             int added));
+
+/* Set a function to be called to fill in any part of the redo session
+ * that has not yet been loaded. The function is called with a
+ * position before it is displayed, before it is removed, and before
+ * its saved state is changed by a graft, and should return true if
+ * any positions were added below it. It is called with NULL to
+ * request everything, when a position limit is in effect. NULL can be
+ * passed to stop the calls.
+ */
+extern void setpositionexpander(int (*expander)(redo_session *session,
+                                                gameplayinfo *gameplay,
+                                                redo_position *position));
+
 /* Initialize the game state to the beginning of a game. The
  * gameplay's gameid field is used to choose the deck to use. The
  * return value is a new redo_session for this game.
  */
 extern redo_session *initializegame(gameplayinfo *gameplay);
 
+/* Initialize the game state to the beginning of a game, as with
+ * initializegame(), but reuse an existing redo session instead of
+ * creating a new one. Everything stored in the session is discarded.
+ * The return value is false if the session could not be reset.
+ */
+extern int reinitializegame(gameplayinfo *gameplay, redo_session *session);
+
 /* Change the game state by making the given move. The return value is
  * false if the move is invalid.
  */
@@ -70,12 +106,49 @@ extern redo_position *recordgamestate(gameplayinfo const *gameplay,
                                       redo_position *fromposition,
                                       int moveid, int checkequiv);
 
+/* Make a move from the given position and add the resulting position
+ * to the redo session, exactly as if the user had made the move: the
+ * session is checked for equivalent positions, and the states of any
+ * grafted positions are updated. The game state is left at the new
+ * position. NULL is returned if the move is not valid.
+ */
+extern redo_position *recordmove(gameplayinfo *gameplay,
+                                 redo_session *session,
+                                 redo_position *position, int moveid);
+
 /* Return the game state to the one associated with the given redo
  * position.
  */
 extern void restoresavedstate(gameplayinfo *gameplay,
                               redo_position const *position);
 
+/* Copy the state associated with the given redo position into the
+ * game state, like restoresavedstate(), but without recalculating the
+ * fields that are derived from it. The game state is only suitable
+ * for use with replaymove() and recordgamestate() until
+ * restoresavedstate() is called.
+ */
+extern void seedsavedstate(gameplayinfo *gameplay,
+                           redo_position const *position);
+
+/* Determine the places that the card was moved from and to in the
+ * move represented by the given branch of position. The return value
+ * is false if the saved states do not show a card being moved.
+ */
+extern int getmoveplaces(redo_position const *position,
+                         redo_branch const *branch,
+                         place_t *from, place_t *to);
+
+/* Move the card identified by moveid from one place to another,
+ * without checking that the move is permitted by the rules. This
+ * allows recorded moves to be recreated quickly. Only the fields that
+ * are saved in the redo session, and the endpoint field, are updated,
+ * as with seedsavedstate(). The return value is false if the card is
+ * not at the top of the from place.
+ */
+extern int replaymove(gameplayinfo *gameplay, int moveid,
+                      place_t from, place_t to);
+
 /* Iterate through the user's stored answer for the current game,
  * storing the moves in the given redo session. The return value is
  * false if the current game does not have a recorded answer. The game
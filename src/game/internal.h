@@ -44,4 +44,12 @@ extern void finishmove(gameplayinfo *gameplay, moveinfo move);
 extern void updategrafted(gameplayinfo *gameplay, redo_session *session,
                           redo_position *position);
 
+/* Load the branches of a position that have not been loaded into the
+ * redo session yet, or those of every position if position is NULL.
+ * This function does nothing if no function has been supplied to
+ * setpositionexpander(). The game state is left unchanged.
+ */
+extern int expandunloaded(gameplayinfo *gameplay, redo_session *session,
+                          redo_position *position);
+
 #endif
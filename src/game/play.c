@@ -50,6 +50,27 @@ static int animation = TRUE;
  */
 static int branchingredo = TRUE;
 
+/* The maximum number of positions in the redo session, or zero.
+ */
+static int positionlimit = 0;
+
+/* The function to notify of positions added and removed, if any.
+ */
+static void (*positionlogger)(redo_position const*, int) = NULL;
+
+/* The position from which a move is being recorded, and the move. The
+ * new position is logged as soon as it is added, before any positions
+ * that its addition causes to be evicted, so that the log replays the
+ * changes in the order in which they happened.
+ */
+static redo_position *unloggedfrom = NULL;
+static int unloggedmove = -1;
+
+/* The session's generation number when it was last searched for an
+ * assembled answer.
+ */
+static unsigned long searchedgeneration = 0;
+
 /* The position currently being displayed.
  */
 static redo_position *currentposition = NULL;
@@ -58,6 +79,10 @@ static redo_position *currentposition = NULL;
  */
 static redo_position *backone = NULL;
 
+/* True if the redo session's statistics should be displayed.
+ */
+static int showstats = FALSE;
+
 /* The stack of bookmarked game states.
  */
 static stackentry *positionstack = NULL;
@@ -78,9 +103,31 @@ static int isstackempty(void)
     return positionstack == NULL;
 }
 
+/* Return true if a position is on the bookmark stack.
+ */
+static int isbookmarked(redo_position const *position)
+{
+    stackentry const *entry;
+
+    for (entry = positionstack ; entry ; entry = entry->next)
+        if (entry->position == position)
+            return TRUE;
+    return FALSE;
+}
+
+/* Protect a position from being forgotten when the redo session
+ * exceeds its position limit, if the position is bookmarked or is the
+ * previously visited position. Otherwise, remove the protection.
+ */
+static void updatekeep(redo_session *session, redo_position *position)
+{
+    redo_keepposition(session, position,
+                      position == backone || isbookmarked(position));
+}
+
 /* Bookmark a position.
  */
-static void stackpush(redo_position *position)
+static void stackpush(redo_session *session, redo_position *position)
 {
     stackentry *entry;
 
@@ -88,11 +135,12 @@ static void stackpush(redo_position *position)
     entry->position = position;
     entry->next = positionstack;
     positionstack = entry;
+    redo_keepposition(session, position, TRUE);
 }
 
 /* Return the most recently bookmarked position.
  */
-static redo_position *stackpop(void)
+static redo_position *stackpop(redo_session *session)
 {
     redo_position *pos;
     stackentry *entry;
@@ -103,6 +151,7 @@ static redo_position *stackpop(void)
     pos = entry->position;
     positionstack = entry->next;
     deallocate(entry);
+    updatekeep(session, pos);
     return pos;
 }
 
@@ -133,6 +182,19 @@ static void stackdelete(redo_position const *position)
     }
 }
 
+/* Change the previously visited position.
+ */
+static void setbackone(redo_session *session, redo_position *position)
+{
+    redo_position *pos;
+
+    pos = backone;
+    backone = position;
+    if (pos && pos != position)
+        updatekeep(session, pos);
+    redo_keepposition(session, position, TRUE);
+}
+
 /*
  * Providing a queue of commands.
  */
@@ -195,21 +257,22 @@ static char *createanswerstring(gameplayinfo *gameplay,
     redo_branch const *branch;
     char *string;
     int failed;
-    int size, i;
+    int size, i, j;
 
     position = redo_getfirstposition(session);
     size = position->solutionsize;
     string = allocate(size + 1);
     failed = FALSE;
     for (i = 0 ; i < size ; ++i) {
-        for (branch = position->next ; branch ; branch = branch->cdr)
-            if (branch->p->solutionsize == size)
+        for (j = 0 ; j < (int)position->nextcount ; ++j)
+            if ((int)position->next[j].p->solutionsize == size)
                 break;
-        if (!branch) {
+        if (j == (int)position->nextcount) {
             warn("failed to create answer: no correct move at %d", i + 1);
             failed = TRUE;
             break;
         }
+        branch = position->next + j;
         restoresavedstate(gameplay, position);
         string[i] = moveidtocmd(gameplay, branch->move);
         position = branch->p;
@@ -223,6 +286,56 @@ static char *createanswerstring(gameplayinfo *gameplay,
     return string;
 }
 
+/* Look for a solution that is shorter than the user's best answer,
+ * and which can be assembled from the moves explored so far by
+ * joining paths at positions with identical states. If one is found,
+ * it is saved as the user's new best answer. The search examines the
+ * whole session, so it is skipped unless a position has been linked
+ * to an identical one, or an endpoint has been added, since the last
+ * search. The return value is true if an answer was saved.
+ */
+static int saveassembledanswer(gameplayinfo *gameplay,
+                               redo_session *session)
+{
+    redo_position const *root;
+    unsigned long generation;
+    char *string;
+    int *moveids;
+    int size, i;
+
+    generation = redo_getsessiongeneration(session);
+    if (generation == searchedgeneration)
+        return FALSE;
+    searchedgeneration = generation;
+    root = redo_getfirstposition(session);
+    if (!root->solutionend)
+        return FALSE;
+    moveids = allocate(root->solutionsize * sizeof *moveids);
+    size = redo_findshortestsolution(session, root, moveids,
+                                     root->solutionsize);
+    if (size >= (int)root->solutionsize)
+        size = 0;
+    else if (gameplay->bestanswersize && size >= gameplay->bestanswersize)
+        size = 0;
+    if (size <= 0) {
+        deallocate(moveids);
+        return FALSE;
+    }
+    string = allocate(size + 1);
+    restoresavedstate(gameplay, root);
+    for (i = 0 ; i < size ; ++i) {
+        string[i] = moveidtocmd(gameplay, moveids[i]);
+        applymove(gameplay, string[i]);
+    }
+    string[size] = '\0';
+    restoresavedstate(gameplay, currentposition);
+    saveanswer(gameplay->gameid, string);
+    gameplay->bestanswersize = size;
+    deallocate(string);
+    deallocate(moveids);
+    return TRUE;
+}
+
 /*
  * Handling move deletion.
  */
@@ -240,6 +353,10 @@ static redo_position *forgetposition(gameplayinfo *gameplay,
 {
     redo_position *pos;
 
+    if (!position->next)
+        expandunloaded(gameplay, session, position);
+    if (positionlogger && position->prev && !position->next)
+        positionlogger(position, FALSE);
     pos = redo_dropposition(session, position);
     if (pos == position)
         return NULL;
@@ -249,7 +366,7 @@ static redo_position *forgetposition(gameplayinfo *gameplay,
     if (currentposition == position)
         currentposition = pos;
     if (backone == position)
-        backone = pos;
+        setbackone(session, pos);
     return pos;
 }
 
@@ -305,9 +422,10 @@ static movecmd_t findfoundationmove(gameplayinfo const *gameplay)
 
 /* Finish the process of a moving a card, as started by handlemove().
  * Game state is updated, and the move is added to the redo session.
- * If the move created a new and shorter answer, it is saved to
- * disk. Finally, if autoplay is enabled, a scan for foundation moves
- * is scheduled.
+ * If the move created a new and shorter answer, either directly or
+ * by completing a shorter combination of explored moves, it is saved
+ * to disk. Finally, if autoplay is enabled, a scan for foundation
+ * moves is scheduled.
  */
 static void handlemove_callback(void *data)
 {
@@ -328,24 +446,32 @@ static void handlemove_callback(void *data)
     finishmove(gameplay, move);
     moveid = mkmoveid(move.card, ismovecmd2(move.cmd));
 
-    backone = currentposition;
+    setbackone(session, currentposition);
     pos = redo_getnextposition(currentposition, moveid);
     if (pos) {
+        redo_visitposition(session, pos);
         currentposition = pos;
         return;
     }
 
     if (currentposition->next && !branchingredo)
         forgetundonepositions(gameplay, session, currentposition->next->p);
+    unloggedfrom = currentposition;
+    unloggedmove = moveid;
     currentposition = recordgamestate(gameplay, session, currentposition,
                                       moveid, redo_check);
+    if (positionlogger && unloggedfrom)
+        positionlogger(currentposition, TRUE);
+    unloggedfrom = NULL;
     if (currentposition->next)
         updategrafted(gameplay, session, currentposition);
 
     pos = redo_getfirstposition(session);
-    if (pos->solutionsize != gameplay->bestanswersize) {
+    if (saveassembledanswer(gameplay, session)) {
+        showwriteindicator();
+    } else if ((int)pos->solutionsize != gameplay->bestanswersize) {
         if (!gameplay->bestanswersize ||
-                        gameplay->bestanswersize > pos->solutionsize) {
+                        gameplay->bestanswersize > (int)pos->solutionsize) {
             buf = createanswerstring(gameplay, session);
             if (buf) {
                 saveanswer(gameplay->gameid, buf);
@@ -408,13 +534,15 @@ static int handlemove(gameplayinfo *gameplay, redo_session *session,
  * current game. This function provides the last step of handling most
  * of the user commands involving state navigation.
  */
-static void moveposition(gameplayinfo *gameplay, redo_position *pos)
+static void moveposition(gameplayinfo *gameplay, redo_session *session,
+                         redo_position *pos)
 {
     if (!pos) {
         ding();
         return;
     }
-    backone = currentposition;
+    setbackone(session, currentposition);
+    redo_visitposition(session, pos);
     currentposition = pos;
     restoresavedstate(gameplay, pos);
 }
@@ -424,15 +552,15 @@ static void moveposition(gameplayinfo *gameplay, redo_position *pos)
  */
 static void setminimalpath(redo_position *pos)
 {
-    redo_branch *branch;
+    int i;
 
     while (pos && pos->solutionsize) {
-        for (branch = pos->next ; branch ; branch = branch->cdr)
-            if (branch->p->solutionsize == pos->solutionsize)
+        for (i = 0 ; i < (int)pos->nextcount ; ++i)
+            if (pos->next[i].p->solutionsize == pos->solutionsize)
                 break;
-        if (!branch)
+        if (i == (int)pos->nextcount)
             break;
-        pos = redo_getnextposition(pos, branch->move);
+        pos = redo_getnextposition(pos, pos->next[i].move);
     }
 }
 
@@ -475,19 +603,19 @@ static int handlenavkey(gameplayinfo *gameplay, redo_session *session,
       case cmd_erase:
         pos = forgetposition(gameplay, session, currentposition);
         if (pos)
-            moveposition(gameplay, pos);
+            moveposition(gameplay, session, pos);
         else
             ding();
         break;
       case cmd_jumptostart:
-        moveposition(gameplay, redo_getfirstposition(session));
+        moveposition(gameplay, session, redo_getfirstposition(session));
         break;
       case cmd_jumptoend:
         for (pos = currentposition ; pos->next ; pos = pos->next->p) ;
-        moveposition(gameplay, pos);
+        moveposition(gameplay, session, pos);
         break;
       case cmd_undo:
-        moveposition(gameplay, currentposition->prev);
+        moveposition(gameplay, session, currentposition->prev);
         break;
       case cmd_redo:
         if (currentposition->next)
@@ -499,14 +627,14 @@ static int handlenavkey(gameplayinfo *gameplay, redo_session *session,
         for (i = 0 ; i < 10 && pos->prev ; ++i)
             pos = pos->prev;
         if (pos != currentposition)
-            moveposition(gameplay, pos);
+            moveposition(gameplay, session, pos);
         break;
       case cmd_redo10:
         pos = currentposition;
         for (i = 0 ; i < 10 && pos->next ; ++i)
             pos = pos->next->p;
         if (pos != currentposition)
-            moveposition(gameplay, pos);
+            moveposition(gameplay, session, pos);
         break;
       case cmd_undotobranch:
         if (!currentposition->prev) {
@@ -519,7 +647,7 @@ static int handlenavkey(gameplayinfo *gameplay, redo_session *session,
             if (pos->nextcount > 1)
                 break;
         }
-        moveposition(gameplay, pos);
+        moveposition(gameplay, session, pos);
         break;
       case cmd_redotobranch:
         if (!currentposition->next) {
@@ -532,7 +660,7 @@ static int handlenavkey(gameplayinfo *gameplay, redo_session *session,
             if (pos->nextcount > 1)
                 break;
         }
-        moveposition(gameplay, pos);
+        moveposition(gameplay, session, pos);
         break;
       case cmd_switchtobetter:
         if (!currentposition->better) {
@@ -542,30 +670,30 @@ static int handlenavkey(gameplayinfo *gameplay, redo_session *session,
         pos = currentposition;
         while (pos->better)
             pos = pos->better;
-        moveposition(gameplay, pos);
+        moveposition(gameplay, session, pos);
         break;
       case cmd_switchtoprevious:
-        moveposition(gameplay, backone);
+        moveposition(gameplay, session, backone);
         break;
       case cmd_pushbookmark:
-        stackpush(currentposition);
+        stackpush(session, currentposition);
         break;
       case cmd_popbookmark:
         if (!isstackempty())
-            moveposition(gameplay, stackpop());
+            moveposition(gameplay, session, stackpop(session));
         break;
       case cmd_swapbookmark:
         if (!isstackempty()) {
-            pos = stackpop();
-            stackpush(currentposition);
-            moveposition(gameplay, pos);
+            pos = stackpop(session);
+            stackpush(session, currentposition);
+            moveposition(gameplay, session, pos);
         }
         break;
       case cmd_dropbookmark:
         if (isstackempty())
             ding();
         else
-            stackpop();
+            stackpop(session);
         break;
       case cmd_setminimalpath:
         setminimalpath(currentposition);
@@ -574,8 +702,11 @@ static int handlenavkey(gameplayinfo *gameplay, redo_session *session,
         if (changesettings(getcurrentsettings()))
             applysettings(TRUE);
         break;
+      case cmd_showstats:
+        showstats = !showstats;
+        break;
       case cmd_quit:
-        while (stackpop()) ;
+        while (stackpop(session)) ;
         return FALSE;
     }
     return TRUE;
@@ -606,6 +737,37 @@ void setbranching(int f)
     branchingredo = f;
 }
 
+/* Set the position limit for the redo session of subsequent games.
+ */
+void setpositionlimit(int limit)
+{
+    positionlimit = limit;
+}
+
+/* Pass a position that is being removed by the session's position
+ * limit on to the position logger, so that evictions are recorded in
+ * the same way as positions that the user deletes. If the eviction
+ * was caused by recording a move, the new position is logged first.
+ */
+static void logevictedposition(redo_position const *position)
+{
+    if (!positionlogger)
+        return;
+    if (unloggedfrom) {
+        positionlogger(redo_findnextposition(unloggedfrom, unloggedmove),
+                       TRUE);
+        unloggedfrom = NULL;
+    }
+    positionlogger(position, FALSE);
+}
+
+/* Set the function to notify of changes to the redo session.
+ */
+void setpositionlogger(void (*logger)(redo_position const*, int))
+{
+    positionlogger = logger;
+}
+
 /* Run the inner loop of game play. Display the game state, wait for a
  * command to be input, apply it to the game state and the redo
  * session, and loop. Continue until one of the quit commands is
@@ -614,21 +776,34 @@ void setbranching(int f)
 int gameplayloop(gameplayinfo *gameplay, redo_session *session)
 {
     renderparams params;
+    redo_sessionstats stats;
     command_t cmd;
 
     currentposition = redo_getfirstposition(session);
     gameplay->bestanswersize = currentposition->solutionsize;
     gameplay->locked = 0;
+    searchedgeneration = redo_getsessiongeneration(session);
     backone = currentposition;
+    redo_keepposition(session, backone, TRUE);
+    if (positionlimit)
+        expandunloaded(gameplay, session, NULL);
+    redo_setevictfunction(session, logevictedposition);
+    redo_setpositionlimit(session, positionlimit);
 
     for (;;) {
+        expandunloaded(gameplay, session, currentposition);
         params.gameplay = gameplay;
         params.position = currentposition;
         params.bookmark = !isstackempty();
+        params.stats = NULL;
+        if (showstats) {
+            redo_getsessionstats(session, &stats);
+            params.stats = &stats;
+        }
         rendergame(&params);
         cmd = getinput();
         if (cmd == cmd_quitprogram)
-            return FALSE;
+            break;
         if (cmd == cmd_autoplay)
             cmd = findfoundationmove(gameplay);
         if (ismovecmd(cmd)) {
@@ -640,8 +815,14 @@ int gameplayloop(gameplayinfo *gameplay, redo_session *session)
                 ding();
             continue;
         } else if (cmd) {
-            if (!handlenavkey(gameplay, session, cmd))
+            if (!handlenavkey(gameplay, session, cmd)) {
+                redo_setpositionlimit(session, 0);
+                redo_setevictfunction(session, NULL);
                 return TRUE;
+            }
         }
     }
+    redo_setpositionlimit(session, 0);
+    redo_setevictfunction(session, NULL);
+    return FALSE;
 }
@@ -22,6 +22,12 @@
 #define CMPSIZE_REDO_STATE  \
     (offsetof(gameplayinfo, cardat) - offsetof(gameplayinfo, covers))
 
+/* The function to call to load the parts of a redo session that have
+ * not been loaded yet, if any.
+ */
+static int (*positionexpander)(redo_session*, gameplayinfo*,
+                               redo_position*) = NULL;
+
 /* Return all gameplay state to empty.
  */
 static void clearstate(gameplayinfo *gameplay)
@@ -133,30 +139,75 @@ void finishmove(gameplayinfo *gameplay, moveinfo move)
     gameplay->endpoint = isgamewon(gameplay);
 }
 
-/* Recursively update the saved state of a subtree. This function is
- * called after a graft has occurred. The state of the grafted
- * positions must necessarily match for the covers array, but can have
- * different values for the cardat array. This function therefore
- * recalculates the game state for every position in the subtree and
- * updates the saved state with the correct cardat array contents.
+/* Update the saved state of a subtree. This function is called after
+ * a graft has occurred. The state of the grafted positions must
+ * necessarily match for the covers array, but can have different
+ * values for the cardat array. This function therefore recalculates
+ * the game state for every position in the subtree and updates the
+ * saved state with the correct cardat array contents. (The subtree is
+ * walked in the same order as a recursive traversal would use, but
+ * with an explicit stack of positions and their remaining branches,
+ * so that the depth of the subtree is not limited by the size of the
+ * native stack.) Any unloaded branches of the subtree are loaded
+ * before their positions' saved states are changed, since they were
+ * recorded relative to the old states. The game state is restored to
+ * the given position upon return.
  */
 void updategrafted(gameplayinfo *gameplay, redo_session *session,
                    redo_position *position)
 {
+    struct { redo_position *pos; int index; } *stack;
     redo_branch *branch;
+    int stacksize, count;
 
-    for (branch = position->next ; branch ; branch = branch->cdr) {
+    stacksize = 64;
+    stack = allocate(stacksize * sizeof *stack);
+    count = 0;
+    stack[count].pos = position;
+    stack[count].index = 0;
+    ++count;
+    while (count) {
+        if (stack[count - 1].index >= (int)stack[count - 1].pos->nextcount) {
+            --count;
+            continue;
+        }
+        branch = stack[count - 1].pos->next + stack[count - 1].index;
+        ++stack[count - 1].index;
+        restoresavedstate(gameplay, stack[count - 1].pos);
         applymove(gameplay, moveidtocmd(gameplay, branch->move));
+        expandunloaded(gameplay, session, branch->p);
 #if PARANOIA
         if (memcmp(redo_getsavedstate(branch->p), &gameplay->covers,
                    CMPSIZE_REDO_STATE))
-            warn("ERROR: applying move at count %d produced different state!",
-                 branch->p->movecount);
+            warn("ERROR: applying move at count %d produced"
+                 " different state!", branch->p->movecount);
 #endif
         redo_updatesavedstate(session, branch->p, &gameplay->covers);
-        updategrafted(gameplay, session, branch->p);
-        restoresavedstate(gameplay, position);
+        if (!branch->p->next)
+            continue;
+        if (count == stacksize) {
+            stacksize *= 2;
+            stack = reallocate(stack, stacksize * sizeof *stack);
+        }
+        stack[count].pos = branch->p;
+        stack[count].index = 0;
+        ++count;
     }
+    deallocate(stack);
+    restoresavedstate(gameplay, position);
+}
+
+/* Load any unloaded branches of the given position, or of every
+ * position if position is NULL, using the function supplied to
+ * setpositionexpander(). The return value is true if any positions
+ * were added to the session.
+ */
+int expandunloaded(gameplayinfo *gameplay, redo_session *session,
+                   redo_position *position)
+{
+    if (!positionexpander)
+        return FALSE;
+    return positionexpander(session, gameplay, position);
 }
 
 /*
@@ -176,6 +227,17 @@ redo_session *initializegame(gameplayinfo *gameplay)
                              SIZE_REDO_STATE, CMPSIZE_REDO_STATE);
 }
 
+/* Initialize the game state to the starting point of a game, and
+ * reset the given redo session to begin from the same point.
+ */
+int reinitializegame(gameplayinfo *gameplay, redo_session *session)
+{
+    clearstate(gameplay);
+    dealcards(gameplay, gameplay->gameid);
+    recalcmoveable(gameplay);
+    return redo_resetsession(session, &gameplay->covers);
+}
+
 /* Apply a move command to the game state directly, without any UI
  * component. The return value is false if the move is not valid.
  */
@@ -191,6 +253,14 @@ int applymove(gameplayinfo *gameplay, movecmd_t movecmd)
     return TRUE;
 }
 
+/* Set the function to call to load unloaded positions.
+ */
+void setpositionexpander(int (*expander)(redo_session*, gameplayinfo*,
+                                         redo_position*))
+{
+    positionexpander = expander;
+}
+
 /* Call redo_addposition() for the given game state.
  */
 redo_position *recordgamestate(gameplayinfo const *gameplay,
@@ -202,6 +272,23 @@ redo_position *recordgamestate(gameplayinfo const *gameplay,
                             &gameplay->covers, gameplay->endpoint, checkequiv);
 }
 
+/* Recreate a move made by the user, adding the new position to the
+ * redo session in the same way that the game loop does.
+ */
+redo_position *recordmove(gameplayinfo *gameplay, redo_session *session,
+                          redo_position *position, int moveid)
+{
+    redo_position *pos;
+
+    restoresavedstate(gameplay, position);
+    if (!applymove(gameplay, moveidtocmd(gameplay, moveid)))
+        return NULL;
+    pos = recordgamestate(gameplay, session, position, moveid, redo_check);
+    if (pos && pos->next)
+        updategrafted(gameplay, session, pos);
+    return pos;
+}
+
 /* Copy a saved state back into the given game. The game state is
  * formatted as a byte array, one entry per card with each entry
  * identifying the card it covers. The in-memory state data also
@@ -233,21 +320,85 @@ void restoresavedstate(gameplayinfo *gameplay, redo_position const *position)
     recalcmoveable(gameplay);
 }
 
+/* Copy a saved state into the given game, as with restoresavedstate(),
+ * but without recalculating the depth and moveable fields.
+ */
+void seedsavedstate(gameplayinfo *gameplay, redo_position const *position)
+{
+    memcpy(&gameplay->covers, redo_getsavedstate(position), SIZE_REDO_STATE);
+    gameplay->endpoint = position->endpoint;
+}
+
+/* Find the places that a recorded move took its card from and to, by
+ * locating the card in the cardat arrays of the saved states on
+ * either side of the branch.
+ */
+int getmoveplaces(redo_position const *position, redo_branch const *branch,
+                  place_t *from, place_t *to)
+{
+    card_t const *before, *after;
+    card_t card;
+    place_t p;
+
+    before = (card_t const*)redo_getsavedstate(position) + CMPSIZE_REDO_STATE;
+    after = (card_t const*)redo_getsavedstate(branch->p) + CMPSIZE_REDO_STATE;
+    card = moveidtocard(branch->move);
+    *from = *to = -1;
+    for (p = 0 ; p < NPLACES ; ++p) {
+        if (before[p] == card)
+            *from = p;
+        if (after[p] == card)
+            *to = p;
+    }
+    return *from >= 0 && *to >= 0 && *from != *to;
+}
+
+/* Move a card between two places without consulting the rules. Only
+ * the parts of the game state that are saved in the redo session are
+ * updated. The endpoint field is set when every foundation has a king
+ * on top.
+ */
+int replaymove(gameplayinfo *gameplay, int moveid, place_t from, place_t to)
+{
+    card_t card;
+    int n, i;
+
+    card = moveidtocard(moveid);
+    if (from < MOVEABLE_PLACE_1ST || from >= MOVEABLE_PLACE_END ||
+                to < 0 || to >= NPLACES || from == to ||
+                gameplay->cardat[from] != card)
+        return FALSE;
+    n = cardtoindex(card);
+    gameplay->cardat[from] = gameplay->covers[n];
+    gameplay->covers[n] = gameplay->cardat[to];
+    gameplay->cardat[to] = card;
+    gameplay->endpoint = TRUE;
+    for (i = 0 ; i < FOUNDATION_PLACE_COUNT ; ++i)
+        if (card_rank(gameplay->cardat[foundationplace(i)]) != KING)
+            gameplay->endpoint = FALSE;
+    return TRUE;
+}
+
 /* Re-enact an answer, recreating the game state for each move and
- * recording the answer in the redo session. The game state is
- * restored to the starting position upon return.
+ * recording the answer in the redo session. The states are collected
+ * first and then added to the session as a single path. The game
+ * state is restored to the starting position upon return.
  */
 int replayanswer(gameplayinfo *gameplay, redo_session *session)
 {
     answerinfo const *answer;
-    redo_position *position;
-    int moveid, i;
+    char *states;
+    int *moveids, *endpoints;
+    int moveid, n, i;
 
     answer = getanswerfor(gameplay->gameid);
     if (!answer)
         return FALSE;
 
-    position = redo_getfirstposition(session);
+    moveids = allocate(2 * answer->size * sizeof *moveids);
+    endpoints = moveids + answer->size;
+    states = allocate(answer->size * SIZE_REDO_STATE);
+    n = 0;
     for (i = 0 ; i < answer->size ; ++i) {
         if (!ismovecmd(answer->text[i])) {
             warn("game %d: move %d: illegal character \"%c\" in answer",
@@ -261,9 +412,16 @@ int replayanswer(gameplayinfo *gameplay, redo_session *session)
                  gameplay->gameid, i, answer->text[i]);
             break;
         }
-        position = recordgamestate(gameplay, session, position,
-                                   moveid, redo_nocheck);
+        moveids[n] = moveid;
+        memcpy(states + n * SIZE_REDO_STATE, &gameplay->covers,
+               SIZE_REDO_STATE);
+        endpoints[n] = gameplay->endpoint;
+        ++n;
     }
+    redo_addpath(session, redo_getfirstposition(session),
+                 moveids, states, endpoints, n, redo_nocheck);
+    deallocate(states);
+    deallocate(moveids);
 
     if (!gameplay->endpoint)
         warn("game %04d: saved answer is incomplete", gameplay->gameid);
@@ -2,6 +2,8 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include "./gen.h"
 #include "./types.h"
 #include "./ui.h"
 #include "./settings.h"
@@ -11,39 +13,74 @@
 #include "game/game.h"
 #include "files/files.h"
 
+/* The redo session. Rather than creating a new session for every
+ * game, a single session is created once and then reset each time a
+ * game is set up, so that the memory it has already allocated can be
+ * reused.
+ */
+static redo_session *recycledsession = NULL;
+
 /*
  * Entering the program's inner loop: playing a game.
  */
 
+/* Free the redo session at exit.
+ */
+static void freesession(void)
+{
+    redo_endsession(recycledsession);
+    recycledsession = NULL;
+}
+
 /* Set up a game and a redo session. Lay out the cards for the given
  * game, and load the previously saved session data and answer (if
  * any). If an answer exists separately from the session, then the
- * answer is "replayed" into the session data.
+ * answer is "replayed" into the session data, and the session is
+ * saved immediately so that the journal can refer to those moves. If
+ * the recycled session cannot be reset, it is replaced with a new
+ * one. The program exits if no session can be created at all.
  */
 static redo_session *setupgame(gameplayinfo *gameplay)
 {
+    static int registered = FALSE;
     redo_session *session;
-    char buf[16];
 
-    sprintf(buf, "session-%04d", gameplay->gameid);
-    setsessionfilename(buf);
-    session = initializegame(gameplay);
+    setsessiongame(gameplay->gameid);
+    if (recycledsession && !reinitializegame(gameplay, recycledsession)) {
+        redo_endsession(recycledsession);
+        recycledsession = NULL;
+    }
+    if (!recycledsession) {
+        recycledsession = initializegame(gameplay);
+        if (!recycledsession) {
+            warn("unable to create a redo session");
+            exit(EXIT_FAILURE);
+        }
+        if (!registered) {
+            atexit(freesession);
+            registered = TRUE;
+        }
+    }
+    session = recycledsession;
     redo_setgraftbehavior(session, redo_graftandcopy);
     loadsession(session, gameplay);
 
-    redo_clearsessionchanged(session);
     if (!redo_getfirstposition(session)->solutionsize)
-        replayanswer(gameplay, session);
+        if (replayanswer(gameplay, session))
+            savesession(session);
+    redo_clearsessionchanged(session);
     return session;
 }
 
-/* Retire the current redo session, saving any changes to disk.
+/* Retire the current redo session. The changes made during play are
+ * already in the session's journal, which is closed (and merged into
+ * the session file, if it has grown too large). The session itself is
+ * kept, to be reused by the next game.
  */
 static void closesession(redo_session *session)
 {
     if (redo_hassessionchanged(session))
-        savesession(session);
-    redo_endsession(session);
+        closejournal(session);
 }
 
 /* Create the game state and the redo session, and hand them off to
@@ -77,6 +114,8 @@ void gameselectionloop(void)
     int id, f;
 
     initializeanswers();
+    setpositionlogger(journalposition);
+    setdeferredloading(TRUE);
     for (;;) {
         settings = getcurrentsettings();
         id = selectgame(settings->gameid);
@@ -87,6 +126,7 @@ void gameselectionloop(void)
         if (!f)
             break;
     }
+    closeanswers();
 }
 
 /* An alternate main loop, this function briefly loads every data file
@@ -103,3 +143,69 @@ void filevalidationloop(void)
     for (g.gameid = 0 ; g.gameid < getdeckcount() ; ++g.gameid)
         closesession(setupgame(&g));
 }
+
+/* Another alternate main loop, this function checks every data file
+ * that has a checksum, which is much faster than loading it, and then
+ * loads the remaining files as filevalidationloop() does. Damaged
+ * files are loaded as well, so that the extent of the damage is
+ * reported.
+ */
+int filecheckloop(void)
+{
+    answerinfo *answers;
+    gameplayinfo g;
+    char *status;
+    int f, n, i;
+
+    loadinitfile(getcurrentsettings());
+    n = checkanswerfile();
+    f = n != CHECK_DAMAGED;
+    if (n != CHECK_VALID) {
+        n = loadanswerfile(&answers);
+        for (i = 0 ; i < n ; ++i)
+            deallocate(answers[i].text);
+        if (n >= 0)
+            deallocate(answers);
+    }
+    status = allocate(getdeckcount());
+    checksessionfiles(status);
+    for (g.gameid = 0 ; g.gameid < getdeckcount() ; ++g.gameid) {
+        if (status[g.gameid] == CHECK_VALID)
+            continue;
+        if (status[g.gameid] == CHECK_DAMAGED)
+            f = FALSE;
+        closesession(setupgame(&g));
+    }
+    deallocate(status);
+    return f;
+}
+
+/* Another alternate main loop, this function loads every session in
+ * turn and outputs a line of statistics for each non-empty one. (The
+ * lookup counts include the work done in loading the session.)
+ */
+void sessionstatsloop(void)
+{
+    redo_sessionstats stats;
+    redo_session *session;
+    gameplayinfo g;
+
+    loadinitfile(getcurrentsettings());
+    printf("game\tpositions\tfree\tbranches\tposbytes\tbranchbytes"
+           "\thashsize\thashused\tlookups\thashrejects\tfalsehits"
+           "\tprobes\tcomparisons\tgrafts\tevictions\tmaxdepth\n");
+    for (g.gameid = 0 ; g.gameid < getdeckcount() ; ++g.gameid) {
+        session = setupgame(&g);
+        redo_getsessionstats(session, &stats);
+        if (stats.positions > 1)
+            printf("%04d\t%lu\t%lu\t%lu\t%lu\t%lu\t%lu\t%lu\t%lu\t%lu"
+                   "\t%lu\t%lu\t%lu\t%lu\t%lu\t%lu\n",
+                   g.gameid, stats.positions, stats.freepositions,
+                   stats.branches, stats.positionbytes, stats.branchbytes,
+                   stats.hashsize, stats.hashused, stats.lookups,
+                   stats.hashrejects, stats.falsehits, stats.probes,
+                   stats.comparisons, stats.grafts, stats.evictions,
+                   stats.maxdepth);
+        closesession(session);
+    }
+}
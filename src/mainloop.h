@@ -16,4 +16,18 @@ extern void gameselectionloop(void);
  */
 extern void filevalidationloop(void);
 
+/* Verify every data file by its checksum, and then examine the
+ * contents of those files that could not be verified in this way, as
+ * filevalidationloop() does. The return value is false if any file
+ * was found to be damaged.
+ */
+extern int filecheckloop(void);
+
+/* Load every session file in turn and output statistics describing
+ * the resulting redo sessions on standard output, as tab-separated
+ * columns preceded by a line of column names. Games with no session
+ * data are omitted.
+ */
+extern void sessionstatsloop(void);
+
 #endif
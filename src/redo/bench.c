@@ -0,0 +1,393 @@
+/* redo/bench.c: A benchmarking program for the redo library.
+ *
+ * This program is not part of the game. It is built on request, and
+ * links only with the standalone library (libredo.a). It times the
+ * library's main operations on synthetic states, and compares the
+ * speed and collision rate of the built-in hash functions. The results
+ * are printed as tab-separated lines for use by other tools.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "redo/redo.h"
+
+/* The benchmark parameters, as set by the command-line options.
+ */
+static long positioncount = 100000;     /* positions in the initial tree */
+static int statesize = 64;              /* bytes of state per position */
+static int branching = 4;               /* branches per position */
+static long walksteps = 1000000;        /* steps taken by the random walks */
+static long checkcount = 2000;          /* positions added with checking */
+static long dropcount = 2000;           /* positions dropped */
+static long mergecount = 20000;         /* positions in a merged session */
+static long hashcount = 1000000;        /* states hashed per function */
+
+/* The state of the random-number generator.
+ */
+static unsigned long randomseed = 1;
+
+/* The list of positions in the initial tree, in order of creation.
+ */
+static redo_position **positions;
+
+/* Return a random number in the range [0, n).
+ */
+static long randomnumber(long n)
+{
+    randomseed = randomseed * 1103515245UL + 12345UL;
+    return (long)((randomseed >> 8) % (unsigned long)n);
+}
+
+/* Fill state with the synthetic state data for a given ID number.
+ * Distinct IDs produce distinct states. The bytes past the ID are
+ * filled with values derived from it, so that state comparisons must
+ * examine the entire buffer.
+ */
+static void makestate(unsigned char *state, unsigned long id)
+{
+    unsigned long x;
+    int i;
+
+    x = id * 2654435761UL + 1;
+    for (i = 0 ; i < statesize ; ++i) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        state[i] = (unsigned char)x;
+    }
+    memcpy(state, &id, (size_t)statesize < sizeof id ? 4 : sizeof id);
+}
+
+/* Fill state with a sparse state for a given ID number: all zero
+ * bytes, apart from the ID itself stored at the end. States such as
+ * these, which differ from each other in only a few bytes, are more
+ * typical of real programs than the random-looking ones above.
+ */
+static void makesparsestate(unsigned char *state, unsigned long id)
+{
+    int n;
+
+    n = (size_t)statesize < sizeof id ? statesize : (int)sizeof id;
+    memset(state, 0, statesize);
+    memcpy(state + statesize - n, &id, n);
+}
+
+/* Output the result of one benchmark. collisions is only given for
+ * the hash function benchmarks, and is negative otherwise.
+ */
+static void report(char const *name, long count, clock_t elapsed,
+                   long collisions)
+{
+    double seconds;
+
+    seconds = (double)elapsed / CLOCKS_PER_SEC;
+    printf("%s\t%d\t%d\t%ld\t%.6f\t%.0f", name, statesize, branching,
+           count, seconds, seconds > 0 ? count / seconds : 0.0);
+    if (collisions >= 0)
+        printf("\t%ld\n", collisions);
+    else
+        printf("\t-\n");
+}
+
+/* Build a tree of positioncount positions, in which every position
+ * (apart from those at the bottom) has the same number of branches.
+ */
+static void benchaddposition(redo_session *session, unsigned char *state)
+{
+    redo_position *prev;
+    clock_t start;
+    long i;
+
+    positions[0] = redo_getfirstposition(session);
+    start = clock();
+    for (i = 1 ; i < positioncount ; ++i) {
+        prev = positions[(i - 1) / branching];
+        makestate(state, i);
+        positions[i] = redo_addposition(session, prev,
+                                        (int)((i - 1) % branching),
+                                        state, 0, redo_nocheck);
+        if (!positions[i]) {
+            fprintf(stderr, "redo_addposition() failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    report("addposition", positioncount - 1, clock() - start, -1);
+}
+
+/* Follow random paths down the tree, returning to the root each time
+ * the bottom is reached.
+ */
+static void benchgetnextposition(redo_session *session)
+{
+    redo_position *root, *pos, *next;
+    clock_t start;
+    long i;
+
+    root = redo_getfirstposition(session);
+    pos = root;
+    start = clock();
+    for (i = 0 ; i < walksteps ; ++i) {
+        next = redo_getnextposition(pos, (int)randomnumber(branching));
+        pos = next ? next : root;
+    }
+    report("getnextposition", walksteps, clock() - start, -1);
+}
+
+/* Add new positions with equivalence checking. Half of the added
+ * positions duplicate a state already in the tree, and half are new.
+ */
+static void benchcheckequiv(redo_session *session, unsigned char *state)
+{
+    redo_position *prev;
+    clock_t start;
+    long i;
+
+    start = clock();
+    for (i = 0 ; i < checkcount ; ++i) {
+        prev = positions[randomnumber(positioncount)];
+        if (i % 2)
+            makestate(state, randomnumber(positioncount));
+        else
+            makestate(state, positioncount + i);
+        if (!redo_addposition(session, prev, branching + (int)i, state, 0,
+                              redo_check)) {
+            fprintf(stderr, "redo_addposition() failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    report("checkequiv", checkcount, clock() - start, -1);
+}
+
+/* Build a second session of mergecount positions, and merge it into
+ * the first one. The second tree has the same shape as the first, but
+ * uses different moves, so that every one of its positions is added,
+ * and each addition requires a search for an equivalent position.
+ * Half of its states duplicate a state already in the first tree, and
+ * half are new.
+ */
+static void benchmergesession(redo_session *session, unsigned char *state)
+{
+    redo_session *other;
+    redo_position **added;
+    clock_t start;
+    long i;
+    int n;
+
+    added = malloc(mergecount * sizeof *added);
+    makestate(state, 0);
+    other = redo_beginsession(state, statesize, 0);
+    if (!added || !other) {
+        fprintf(stderr, "out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    added[0] = redo_getfirstposition(other);
+    for (i = 1 ; i < mergecount ; ++i) {
+        if (i % 2 && i < positioncount)
+            makestate(state, i);
+        else
+            makestate(state, positioncount + checkcount + i);
+        added[i] = redo_addposition(other, added[(i - 1) / branching],
+                                    branching + (int)((i - 1) % branching),
+                                    state, 0, redo_nocheck);
+        if (!added[i]) {
+            fprintf(stderr, "redo_addposition() failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    start = clock();
+    n = redo_mergesession(session, other);
+    if (n < 0) {
+        fprintf(stderr, "redo_mergesession() failed\n");
+        exit(EXIT_FAILURE);
+    }
+    report("mergesession", mergecount - 1, clock() - start, -1);
+    redo_endsession(other);
+    free(added);
+}
+
+/* Delete leaf positions, starting with the most recently created
+ * positions of the initial tree.
+ */
+static void benchdropposition(redo_session *session)
+{
+    redo_position *pos;
+    clock_t start;
+    long i, n;
+
+    n = 0;
+    start = clock();
+    for (i = positioncount - 1 ; i > 0 && n < dropcount ; --i) {
+        pos = positions[i];
+        if (pos->next)
+            continue;
+        if (redo_dropposition(session, pos) != pos)
+            ++n;
+    }
+    report("dropposition", n, clock() - start, -1);
+}
+
+/* Comparison function for sorting hash values.
+ */
+static int cmphashvalues(void const *a, void const *b)
+{
+    unsigned int x = *(unsigned int const*)a;
+    unsigned int y = *(unsigned int const*)b;
+
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/* Hash hashcount distinct states with the given function. The states
+ * are generated in advance, in batches, so that only the hashing is
+ * timed. The number of collisions is the number of states that have
+ * the same hash value as an earlier state.
+ */
+static void benchhash(char const *name, redo_hashfunction *hashfunction,
+                      void (*make)(unsigned char*, unsigned long))
+{
+    enum { batchsize = 1024 };
+    unsigned char *states;
+    unsigned int *values;
+    clock_t elapsed, start;
+    long collisions, i, j, n;
+
+    states = malloc(batchsize * statesize);
+    values = malloc(hashcount * sizeof *values);
+    if (!states || !values) {
+        fprintf(stderr, "out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    elapsed = 0;
+    for (i = 0 ; i < hashcount ; i += n) {
+        n = hashcount - i < batchsize ? hashcount - i : batchsize;
+        for (j = 0 ; j < n ; ++j)
+            make(states + j * statesize, i + j);
+        start = clock();
+        for (j = 0 ; j < n ; ++j)
+            values[i + j] = hashfunction(states + j * statesize, statesize);
+        elapsed += clock() - start;
+    }
+
+    qsort(values, hashcount, sizeof *values, cmphashvalues);
+    collisions = 0;
+    for (i = 1 ; i < hashcount ; ++i)
+        if (values[i] == values[i - 1])
+            ++collisions;
+    report(name, hashcount, elapsed, collisions);
+    free(values);
+    free(states);
+}
+
+/* Display the program's options and exit.
+ */
+static void usage(char const *prog, int status)
+{
+    printf("Usage: %s [-n POSITIONS] [-s STATESIZE] [-b BRANCHING]"
+           " [-w STEPS] [-e CHECKS] [-m MERGES] [-d DROPS]"
+           " [-x HASHES]\n"
+           "  -n  positions in the initial tree (default: %ld)\n"
+           "  -s  size of the state data in bytes (default: %d)\n"
+           "  -b  number of branches from each position (default: %d)\n"
+           "  -w  steps to take with redo_getnextposition() (default: %ld)\n"
+           "  -e  positions to add with equivalence checks (default: %ld)\n"
+           "  -m  positions in a session to be merged (default: %ld)\n"
+           "  -d  positions to drop (default: %ld)\n"
+           "  -x  states to hash with each hash function (default: %ld)\n"
+           "Results are printed one per line, as tab-separated fields.\n",
+           prog, positioncount, statesize, branching, walksteps,
+           checkcount, mergecount, dropcount, hashcount);
+    exit(status);
+}
+
+/* Parse a numeric option argument, which must be within the given
+ * range.
+ */
+static long getnumber(char const *prog, char const *arg, long min, long max)
+{
+    char *p;
+    long n;
+
+    n = strtol(arg, &p, 10);
+    if (*p || n < min || n > max) {
+        fprintf(stderr, "%s: invalid argument: \"%s\"\n", prog, arg);
+        usage(prog, EXIT_FAILURE);
+    }
+    return n;
+}
+
+/* Read the options, and then run each benchmark in turn on a single
+ * session.
+ */
+int main(int argc, char *argv[])
+{
+    redo_session *session;
+    unsigned char *state;
+    int ch;
+
+    while ((ch = getopt(argc, argv, "n:s:b:w:e:m:d:x:h")) != EOF) {
+        switch (ch) {
+          case 'n': positioncount = getnumber(argv[0], optarg, 2, 0x7FFFFFF);
+                    break;
+          case 's': statesize = getnumber(argv[0], optarg, 4,
+                                          REDO_STATESIZE_MAX);
+                    break;
+          case 'b': branching = getnumber(argv[0], optarg, 1, 0x7FFF);
+                    break;
+          case 'w': walksteps = getnumber(argv[0], optarg, 0, 0x7FFFFFFF);
+                    break;
+          case 'e': checkcount = getnumber(argv[0], optarg, 0, 0x7FFFFFF);
+                    break;
+          case 'm': mergecount = getnumber(argv[0], optarg, 1, 0x7FFFFFF);
+                    break;
+          case 'd': dropcount = getnumber(argv[0], optarg, 0, 0x7FFFFFFF);
+                    break;
+          case 'x': hashcount = getnumber(argv[0], optarg, 1, 0x7FFFFFF);
+                    break;
+          case 'h': usage(argv[0], EXIT_SUCCESS);
+                    break;
+          default:  usage(argv[0], EXIT_FAILURE);
+                    break;
+        }
+    }
+    if (optind < argc)
+        usage(argv[0], EXIT_FAILURE);
+    if (branching == 1 && positioncount > (long)REDO_COUNT_MAX) {
+        fprintf(stderr, "%s: path would exceed the maximum length\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    state = malloc(statesize);
+    positions = malloc(positioncount * sizeof *positions);
+    if (!state || !positions) {
+        fprintf(stderr, "%s: out of memory\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    makestate(state, 0);
+    session = redo_beginsession(state, statesize, 0);
+    if (!session) {
+        fprintf(stderr, "%s: redo_beginsession() failed\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    printf("benchmark\tstatesize\tbranching\toperations\tseconds"
+           "\toperationspersecond\tcollisions\n");
+    benchaddposition(session, state);
+    benchgetnextposition(session);
+    benchcheckequiv(session, state);
+    benchmergesession(session, state);
+    benchdropposition(session);
+    benchhash("hash-meiyan", redo_hashmeiyan, makestate);
+    benchhash("hash-mix", redo_hashmix, makestate);
+    benchhash("hash-crc32c", redo_hashcrc32c, makestate);
+    benchhash("sparsehash-meiyan", redo_hashmeiyan, makesparsestate);
+    benchhash("sparsehash-mix", redo_hashmix, makesparsestate);
+    benchhash("sparsehash-crc32c", redo_hashcrc32c, makesparsestate);
+
+    redo_endsession(session);
+    free(positions);
+    free(state);
+    return 0;
+}
@@ -1,3 +1,47 @@
 # redo/module.mk: build rules for the redo module.
 
 SRC += redo/redo.c
+
+# Define REDO_WIDE_COUNTERS to build the redo library (and everything
+# that uses it) with 32-bit move counts, allowing for paths longer than
+# 65535 moves at the cost of a somewhat larger memory footprint.
+ifdef REDO_WIDE_COUNTERS
+override CFLAGS += -DREDO_WIDE_COUNTERS=1
+endif
+
+# The redo module can also be built as a standalone library, in both
+# static and shared forms, along with a program that benchmarks it.
+# These are only built on request, via "make libredo" and "make
+# redo-bench".
+.PHONY: libredo redo-bench
+
+# The shared library's version, which must be kept in step with
+# REDO_LIBRARY_VERSION in redo.h. The major number, which is changed
+# whenever the library's ABI changes, is used in the soname.
+REDO_VERSION = 1.0
+REDO_SOVERSION = 1
+
+libredo: redo/libredo.a redo/libredo.so redo/libredo.so.$(REDO_SOVERSION)
+redo-bench: redo/redo-bench$(EXEEXT)
+
+redo/libredo.a: redo/redo.o
+	$(AR) rcs $@ $^
+
+# The shared library needs its own position-independent object file.
+redo/redo-pic.o: redo/redo.c redo/redo.h
+	$(CC) $(CPPFLAGS) $(CFLAGS) -fPIC -c -o $@ $<
+
+redo/libredo.so.$(REDO_VERSION): redo/redo-pic.o
+	$(CC) $(LDFLAGS) -shared -Wl,-soname,libredo.so.$(REDO_SOVERSION) \
+	      -o $@ $^
+
+redo/libredo.so.$(REDO_SOVERSION) redo/libredo.so: \
+		redo/libredo.so.$(REDO_VERSION)
+	ln -sf $(notdir $<) $@
+
+redo/redo-bench$(EXEEXT): redo/bench.c redo/libredo.a
+	$(CC) $(CPPFLAGS) $(CFLAGS) $(LDFLAGS) -o $@ $^
+
+EXTRA += redo/libredo.a redo/libredo.so redo/libredo.so.$(REDO_SOVERSION)
+EXTRA += redo/libredo.so.$(REDO_VERSION) redo/redo-pic.o
+EXTRA += redo/redo-bench$(EXEEXT)
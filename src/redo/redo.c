@@ -9,9 +9,33 @@
 
 #include <stdlib.h>     /* malloc(), free(), size_t, and NULL */
 #include <string.h>     /* memcpy(), memset(), and memcmp() */
-#include <stdint.h>     /* uint32_t */
+#include <stdint.h>     /* uint32_t and uint64_t */
 #include "redo.h"
 
+/* On x86-64, CRC32C can be computed with the SSE4.2 instructions,
+ * if the processor supports them. GCC and Clang allow the
+ * instructions to be used in individual functions, with the support
+ * checked at run time, so the library doesn't need to be compiled for
+ * SSE4.2.
+ */
+#if defined(__x86_64__) && defined(__GNUC__)
+#define REDO_CRC32C_SSE42 1
+#include <nmmintrin.h>  /* _mm_crc32_u64() and _mm_crc32_u8() */
+#endif
+
+/* Sessions can only be backed by a memory-mapped file on systems that
+ * provide POSIX mmap().
+ */
+#if defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
+#define REDO_MAPPED_FILES 1
+#include <stddef.h>     /* ptrdiff_t */
+#include <fcntl.h>      /* open() */
+#include <unistd.h>     /* close(), ftruncate(), pread() */
+#include <sys/file.h>   /* flock() */
+#include <sys/mman.h>   /* mmap(), msync(), munmap() */
+#include <sys/stat.h>   /* fstat() */
+#endif
+
 /* There are three ways for a solution to be an improvement over what
  * a position currently has: either the position lacks a solution, the
  * position's solution has a lower endpoint value, or the position's
@@ -23,35 +47,133 @@
          (pos)->solutionend < (end) || \
          ((pos)->solutionend == (end) && (pos)->solutionsize > (size))))
 
+/* The header of a chunk of allocated positions. The position structs
+ * immediately follow the header in memory.
+ */
+typedef struct poschunk poschunk;
+struct poschunk {
+    poschunk *next;             /* the next chunk in the list */
+    int used;                   /* how many elements have been handed out */
+};
+
+/* The header of a chunk of allocated branches.
+ */
+typedef struct branchchunk branchchunk;
+struct branchchunk {
+    branchchunk *next;          /* the next chunk in the list */
+    int used;                   /* how many elements have been handed out */
+    int size;                   /* how many elements the chunk holds */
+};
+
+/* The number of size classes for external next arrays. The arrays in
+ * the smallest class hold twice as many branches as can be stored
+ * inside a position, and each class after that holds twice as many
+ * as the one before.
+ */
+#define SPILLCLASSES 24
+#define spillsize(c) ((2 * REDO_INLINE_BRANCHES) << (c))
+
+/* An entry in the cached path used by redo_suppresscycle().
+ */
+typedef struct pathentry {
+    redo_position *position;    /* the position at this depth in the path */
+    int link;                   /* the next entry in the same hash bucket */
+} pathentry;
+
+/* A dropped next array is kept on a free list, the link to the next
+ * array on the list being stored in place of its first element.
+ */
+typedef union freearray freearray;
+union freearray {
+    freearray *next;
+    redo_branch branch;
+};
+
+/* The memory-mapped file backing a session, if there is one.
+ */
+typedef struct maparena maparena;
+
 /* A redo session.
  */
 struct redo_session {
     redo_position *root;        /* the session tree's root position */
-    redo_position *parray;      /* the allocated redo_position array */
-    redo_position *pfree;       /* pointer to a redo_position not in use */
-    redo_branch *barray;        /* the allocated redo_branch array */
-    redo_branch *bfree;         /* pointer to a redo_branch not in use */
+    poschunk *pchunks;          /* the list of position chunks in use */
+    poschunk *pspare;           /* the list of empty position chunks */
+    redo_position *pfree;       /* list of dropped redo_positions */
+    branchchunk *bchunks;       /* the list of branch chunks in use */
+    branchchunk *bspare;        /* the list of empty branch chunks */
+    freearray *bfree[SPILLCLASSES]; /* lists of dropped next arrays */
     unsigned char *hashtable;   /* the session's hash table, if present */
+    redo_hashfunction *hashfunction; /* computes the states' hash values */
+    redo_evictfunction *evictfunction; /* notified of evicted positions */
+    redo_position **stack;      /* work stack for walking subtrees */
+    int stacksize;              /* the allocated size of the work stack */
+    pathentry *path;            /* cached path of the last cycle check */
+    int pathcount;              /* the number of positions in the path */
+    int pathsize;               /* the allocated size of the path */
+    int *pathbuckets;           /* the path's entries, indexed by hash */
+    redo_position **solutions;  /* the endpoint positions in the tree */
+    int solutioncount;          /* the number of endpoint positions */
+    int solutionssize;          /* the allocated size of the solutions */
+    int solutionorder;          /* the state of the solutions array */
     unsigned int positioncount; /* how many positions are in the tree */
-    unsigned short statesize;   /* the size of the stored game state */
-    unsigned short cmpsize;     /* how much of the state to compare */
-    unsigned short elementsize; /* total byte size for each position */
+    unsigned int statesize;     /* the size of the stored game state */
+    unsigned int cmpsize;       /* how much of the state to compare */
+    unsigned int elementsize;   /* total byte size for each position */
+    unsigned int poschunksize;  /* number of positions in each chunk */
+    unsigned int positionlimit; /* the maximum number of positions, or 0 */
+    unsigned int evictthreshold; /* the size that triggers eviction */
+    unsigned int visitclock;    /* the time of the most recent visit */
+    redo_sessionstats counters; /* the session's lookup and graft counts */
+    unsigned long generation;   /* increased by new links and endpoints */
+    maparena *map;              /* the session's backing file, if any */
     unsigned char changeflag;   /* used to track changes to the session */
     unsigned char grafting;     /* should grafts leave the solution path? */
 };
 
+/* The number of elements in each allocated chunk. (The number of
+ * positions in a chunk is reduced as necessary to keep the chunk size
+ * under maxchunkbytes, so that sessions with very large states don't
+ * allocate excessively large chunks.)
+ */
+static int const poschunksize = 1024;
+static int const branchchunksize = 1024;
+static unsigned int const maxchunkbytes = 0x400000;
+
 /* The size, in bits, of a hash table. This size is chosen to be large
  * enough to work well with a wide range of tree sizes, while still
  * not taking up much space.
  */
 static int const hashtablebitsize = 8191;
 
+/* The largest value of a session's visit clock, as determined by the
+ * size of the lastvisit field.
+ */
+static unsigned int const maxvisitclock = 0xFFFFFF;
+
+/* The number of hash buckets used to index the cached path.
+ */
+static int const pathbucketcount = 1024;
+
 /* Increment a redo_position pointer. (Although the size of a position
  * is constant for a given session, it is not available at compile
  * time, so the program must do its own pointer arithmetic.)
  */
 #define incpos(s, p) ((redo_position*)((char*)(p) + (s)->elementsize))
 
+/* Return the nth redo_position struct in a chunk.
+ */
+#define chunkposition(s, c, n) \
+    ((redo_position*)((char*)((c) + 1) + (n) * (s)->elementsize))
+
+/* Loop over every redo_position struct that has been handed out from
+ * the session's chunks, including ones that are not currently in use.
+ */
+#define foreachposition(s, c, p, i) \
+    for ((c) = (s)->pchunks ; (c) ; (c) = (c)->next) \
+        for ((i) = 0, (p) = chunkposition(s, c, 0) ; (i) < (c)->used ; \
+             ++(i), (p) = incpos(s, p))
+
 /*
  * The position hash table.
  *
@@ -71,17 +193,28 @@ static int const hashtablebitsize = 8191;
  * slower), it is not treated as an error if it is absent.
  */
 
-/* Compute the hash value for a given state. Every stored block of
- * state data is assigned a hash value, whether or not a hash table is
- * being used. (This is the Meiyan hash function, created by Sanmayce,
- * slightly simplified.)
+/*
+ * The hash functions.
+ *
+ * Every stored block of state data is assigned a hash value, whether
+ * or not a hash table is being used. The full value is kept with each
+ * position, so that two states are only compared byte by byte if
+ * their hash values are identical. A session uses a built-in hash
+ * function unless the program supplies its own.
+ */
+
+/* Compute the Meiyan hash function, created by Sanmayce, slightly
+ * simplified. This was originally the library's only hash function,
+ * and its result is limited to 16 bits.
  */
-unsigned short gethashvalue(unsigned int const *data, size_t len)
+unsigned int redo_hashmeiyan(void const *state, int size)
 {
     uint32_t const m = 0x000AD3E7;
     uint32_t const seed = 0x811C9DC5;
-    uint32_t h, k, i;
+    unsigned int const *data = state;
+    uint32_t h, k, i, len;
 
+    len = size;
     for (h = seed ; len >= 2 * sizeof *data ; len -= 2 * sizeof *data) {
         k = *data++;
         k = ((k << 5) | (k >> 27)) ^ *data++;
@@ -93,6 +226,151 @@ unsigned short gethashvalue(unsigned int const *data, size_t len)
     return (h ^ (h >> 16)) & 0xFFFF;
 }
 
+/* Compute a hash value by mixing the state eight bytes at a time,
+ * using the multiply-and-shift steps of the MurmurHash3 finalizer.
+ */
+unsigned int redo_hashmix(void const *state, int size)
+{
+    uint64_t const m1 = UINT64_C(0xFF51AFD7ED558CCD);
+    uint64_t const m2 = UINT64_C(0xC4CEB9FE1A85EC53);
+    unsigned char const *p = state;
+    uint64_t h, k;
+
+    h = UINT64_C(0x9E3779B97F4A7C15) ^ (uint64_t)size;
+    for ( ; size >= 8 ; size -= 8, p += 8) {
+        memcpy(&k, p, 8);
+        k *= m1;
+        k ^= k >> 33;
+        h = (h ^ k) * m2;
+        h = (h << 27) | (h >> 37);
+    }
+    if (size > 0) {
+        k = 0;
+        memcpy(&k, p, size);
+        h = (h ^ (k * m1)) * m2;
+    }
+    h ^= h >> 33;
+    h *= m1;
+    h ^= h >> 33;
+    h *= m2;
+    h ^= h >> 33;
+    return (unsigned int)(h ^ (h >> 32));
+}
+
+/* The CRC32C polynomial, in the reversed form, applied to each of the
+ * sixteen possible values of a four-bit nibble.
+ */
+static uint32_t const crc32cnibbles[16] = {
+    0x00000000, 0x105EC76F, 0x20BD8EDE, 0x30E349B1,
+    0x417B1DBC, 0x5125DAD3, 0x61C69362, 0x7198540D,
+    0x82F63B78, 0x92A8FC17, 0xA24BB5A6, 0xB21572C9,
+    0xC38D26C4, 0xD3D3E1AB, 0xE330A81A, 0xF36E6F75
+};
+
+/* Compute a CRC32C in software, a nibble at a time.
+ */
+static uint32_t crc32csoftware(uint32_t crc, unsigned char const *p,
+                               size_t size)
+{
+    for ( ; size ; --size, ++p) {
+        crc ^= *p;
+        crc = (crc >> 4) ^ crc32cnibbles[crc & 15];
+        crc = (crc >> 4) ^ crc32cnibbles[crc & 15];
+    }
+    return crc;
+}
+
+#ifdef REDO_CRC32C_SSE42
+
+/* Compute a CRC32C using the SSE4.2 instructions. The caller must
+ * verify that the processor supports them.
+ */
+__attribute__((target("sse4.2")))
+static uint32_t crc32chardware(uint32_t crc, unsigned char const *p,
+                               size_t size)
+{
+    uint64_t k, c;
+
+    c = crc;
+    for ( ; size >= 8 ; size -= 8, p += 8) {
+        memcpy(&k, p, 8);
+        c = _mm_crc32_u64(c, k);
+    }
+    crc = (uint32_t)c;
+    for ( ; size ; --size, ++p)
+        crc = _mm_crc32_u8(crc, *p);
+    return crc;
+}
+
+/* Return true if the processor can compute CRCs in hardware.
+ */
+#define hascrc32chardware() (__builtin_cpu_supports("sse4.2"))
+
+/* The CRC32C hash function used when the hardware is known to be
+ * present.
+ */
+static unsigned int hashcrc32chardware(void const *state, int size)
+{
+    return ~crc32chardware(0xFFFFFFFF, state, size);
+}
+
+#else
+
+#define hascrc32chardware() 0
+
+#endif
+
+/* Compute the CRC32C of the state (the checksum used by iSCSI and
+ * ext4, among others), using the processor's instructions for it when
+ * they are available.
+ */
+unsigned int redo_hashcrc32c(void const *state, int size)
+{
+#ifdef REDO_CRC32C_SSE42
+    if (hascrc32chardware())
+        return hashcrc32chardware(state, size);
+#endif
+    return ~crc32csoftware(0xFFFFFFFF, state, size);
+}
+
+/* Return the hash function used by a session that hasn't been given
+ * one. CRC32C is used if the processor supports it directly, as it is
+ * both fast and well distributed. Otherwise the mixing hash is used,
+ * as a CRC computed in software is comparatively slow.
+ */
+static redo_hashfunction *getdefaulthashfunction(void)
+{
+#ifdef REDO_CRC32C_SSE42
+    if (hascrc32chardware())
+        return hashcrc32chardware;
+#endif
+    return redo_hashmix;
+}
+
+/* Return a number identifying a built-in hash function, or zero if
+ * the function was supplied by the program. The number is stored in a
+ * session's backing file, so that the file's hash values are not used
+ * with a different function.
+ */
+static unsigned int gethashfunctionid(redo_hashfunction *hashfunction)
+{
+#ifdef REDO_CRC32C_SSE42
+    if (hashfunction == hashcrc32chardware)
+        return 1;
+#endif
+    if (hashfunction == redo_hashcrc32c)
+        return 1;
+    else if (hashfunction == redo_hashmix)
+        return 2;
+    else if (hashfunction == redo_hashmeiyan)
+        return 3;
+    return 0;
+}
+
+/* Compute the hash value for a given state.
+ */
+#define gethashvalue(s, state) ((s)->hashfunction((state), (s)->cmpsize))
+
 /* Reset the contents of the hash table.
  */
 static void emptyhashtable(redo_session *session)
@@ -112,7 +390,7 @@ static int createhashtable(redo_session *session)
 
 /* Mark a hash value as being present in the session.
  */
-static int sethashentry(redo_session *session, unsigned short value)
+static int sethashentry(redo_session *session, unsigned int value)
 {
     int n;
 
@@ -129,7 +407,7 @@ static int sethashentry(redo_session *session, unsigned short value)
  * state is present, and similarly nothing certain can be said if the
  * hash table itself does not exist.
  */
-static int notintable(redo_session const *session, unsigned short value)
+static int notintable(redo_session const *session, unsigned int value)
 {
     int n;
 
@@ -139,6 +417,230 @@ static int notintable(redo_session const *session, unsigned short value)
     return !(session->hashtable[n / 8] & (1 << n % 8));
 }
 
+/*
+ * The cached path.
+ *
+ * redo_suppresscycle() needs to compare a state against every
+ * position on the path leading from the root to a given position. To
+ * avoid walking the whole path each time, the session keeps a copy of
+ * the most recently checked path in an array, indexed by move count,
+ * along with a set of hash buckets that link together the entries
+ * with the same hash value. Since the caller typically moves only a
+ * short distance from one check to the next, the path is updated by
+ * discarding entries down to the nearest common ancestor and then
+ * adding the new positions. Dropped positions are removed from the
+ * path as they are dropped; any change that alters the move counts of
+ * existing positions (i.e. a graft) simply empties the path.
+ */
+
+/* Remove entries from the end of the path until only count remain.
+ * Since entries are always added at the end, the entry being removed
+ * is necessarily at the head of its hash bucket.
+ */
+static void truncatepath(redo_session *session, int count)
+{
+    pathentry *entry;
+
+    while (session->pathcount > count) {
+        --session->pathcount;
+        entry = session->path + session->pathcount;
+        session->pathbuckets[entry->position->hashvalue % pathbucketcount] =
+                                                                entry->link;
+    }
+}
+
+/* Empty the path.
+ */
+static void invalidatepath(redo_session *session)
+{
+    int i;
+
+    if (!session->pathbuckets)
+        return;
+    for (i = 0 ; i < pathbucketcount ; ++i)
+        session->pathbuckets[i] = -1;
+    session->pathcount = 0;
+}
+
+/* Return true if position is currently in the path.
+ */
+static int ispathmember(redo_session const *session,
+                        redo_position const *position)
+{
+    return (int)position->movecount < session->pathcount &&
+           session->path[position->movecount].position == position;
+}
+
+/* Add a position to the end of the path. False is returned if memory
+ * could not be allocated.
+ */
+static int appendpath(redo_session *session, redo_position *position)
+{
+    pathentry *path;
+    int size, n;
+
+    if (session->pathcount == session->pathsize) {
+        size = session->pathsize ? 2 * session->pathsize : 256;
+        path = realloc(session->path, size * sizeof *path);
+        if (!path)
+            return 0;
+        session->path = path;
+        session->pathsize = size;
+    }
+    n = position->hashvalue % pathbucketcount;
+    session->path[session->pathcount].position = position;
+    session->path[session->pathcount].link = session->pathbuckets[n];
+    session->pathbuckets[n] = session->pathcount;
+    ++session->pathcount;
+    return 1;
+}
+
+/*
+ * The solution index.
+ *
+ * The session keeps a list of every endpoint position in the tree,
+ * ordered from the best solution to the worst, so that the best
+ * solutions can be found without walking the tree. Positions are
+ * inserted at their place in the order when they are added, and the
+ * list is sorted again when a graft changes the move counts of
+ * endpoints, so that the queries never need to change the session. If
+ * the list cannot be maintained (because memory could not be
+ * allocated), it is marked as stale, and is rebuilt from the session's
+ * chunks the next time that an endpoint is added or removed.
+ */
+
+/* The possible states of the solution index.
+ */
+enum { solutionsstale = 0, solutionssorted };
+
+/* Mark the solution index as needing to be rebuilt.
+ */
+static void invalidatesolutions(redo_session *session)
+{
+    session->solutioncount = 0;
+    session->solutionorder = solutionsstale;
+}
+
+/* Comparison function for ordering the solution index, best solution
+ * first. Solutions that are equally good are ordered by address, so
+ * that the order is at least consistent.
+ */
+static int cmpsolutions(void const *a, void const *b)
+{
+    redo_position const *p = *(redo_position* const*)a;
+    redo_position const *q = *(redo_position* const*)b;
+
+    if (p->endpoint != q->endpoint)
+        return p->endpoint > q->endpoint ? -1 : 1;
+    if (p->movecount != q->movecount)
+        return p->movecount < q->movecount ? -1 : 1;
+    return p < q ? -1 : p > q ? 1 : 0;
+}
+
+/* Sort the solution index, after the move counts of some of its
+ * entries have changed.
+ */
+static void sortsolutions(redo_session *session)
+{
+    if (session->solutionorder == solutionssorted)
+        qsort(session->solutions, session->solutioncount,
+              sizeof *session->solutions, cmpsolutions);
+}
+
+/* Rebuild a stale solution index from the positions in the session.
+ * False is returned if memory could not be allocated, in which case
+ * the index remains stale.
+ */
+static int rebuildsolutions(redo_session *session)
+{
+    redo_position **solutions;
+    redo_position *pos;
+    poschunk *chunk;
+    int count, i;
+
+    if (session->solutionorder != solutionsstale)
+        return 1;
+    count = 0;
+    foreachposition(session, chunk, pos, i)
+        if (pos->inuse && pos->endpoint)
+            ++count;
+    if (count > session->solutionssize) {
+        solutions = realloc(session->solutions, count * sizeof *solutions);
+        if (!solutions)
+            return 0;
+        session->solutions = solutions;
+        session->solutionssize = count;
+    }
+    count = 0;
+    foreachposition(session, chunk, pos, i)
+        if (pos->inuse && pos->endpoint)
+            session->solutions[count++] = pos;
+    session->solutioncount = count;
+    session->solutionorder = solutionssorted;
+    sortsolutions(session);
+    return 1;
+}
+
+/* Add an endpoint position to the solution index, at its place in the
+ * order. (If the index is stale, it is rebuilt instead, which picks
+ * up the new position along with the rest.)
+ */
+static void addsolution(redo_session *session, redo_position *position)
+{
+    redo_position **solutions;
+    int size, lo, hi, mid;
+
+    if (session->solutionorder == solutionsstale) {
+        rebuildsolutions(session);
+        return;
+    }
+    if (session->solutioncount == session->solutionssize) {
+        size = session->solutionssize ? 2 * session->solutionssize : 64;
+        solutions = realloc(session->solutions, size * sizeof *solutions);
+        if (!solutions) {
+            invalidatesolutions(session);
+            return;
+        }
+        session->solutions = solutions;
+        session->solutionssize = size;
+    }
+    solutions = session->solutions;
+    lo = 0;
+    hi = session->solutioncount;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (cmpsolutions(&solutions[mid], &position) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    memmove(solutions + lo + 1, solutions + lo,
+            (session->solutioncount - lo) * sizeof *solutions);
+    solutions[lo] = position;
+    ++session->solutioncount;
+}
+
+/* Remove an endpoint position from the solution index, keeping the
+ * remaining entries in order.
+ */
+static void removesolution(redo_session *session, redo_position *position)
+{
+    redo_position **solutions;
+    int i;
+
+    if (!rebuildsolutions(session))
+        return;
+    solutions = session->solutions;
+    for (i = session->solutioncount - 1 ; i >= 0 ; --i) {
+        if (solutions[i] == position) {
+            --session->solutioncount;
+            memmove(solutions + i, solutions + i + 1,
+                    (session->solutioncount - i) * sizeof *solutions);
+            return;
+        }
+    }
+}
+
 /*
  * State data handling.
  */
@@ -163,7 +665,7 @@ static void savestatedata(redo_session const *session, redo_position *position,
                           void const *state, int endpoint)
 {
     position->endpoint = endpoint;
-    position->hashvalue = gethashvalue(state, session->cmpsize);
+    position->hashvalue = gethashvalue(session, state);
     memcpy(getwriteablestatedata(position), state, session->statesize);
 }
 
@@ -187,237 +689,716 @@ static void saveextrastatedata(redo_session const *session,
            session->statesize - session->cmpsize);
 }
 
+/* Recompute the stored hash value of every position in the session.
+ */
+static void rehashpositions(redo_session *session)
+{
+    redo_position *pos;
+    poschunk *chunk;
+    int i;
+
+    foreachposition(session, chunk, pos, i)
+        if (pos->inuse)
+            pos->hashvalue = gethashvalue(session, getstatedata(pos));
+}
+
 /*
- * Memory management.
+ * The mapped backing store.
  *
- * redo_position structs are allocated in chunks, rather than have
- * each struct be a separate allocation. Unused structs are kept in a
- * linked list by reusing the prev field. (The inuse field indicates
- * whether or not a struct is currently being used.) The pfree field
- * of redo_session holds the head of this linked list. In addition,
- * each chunk is itself a member in a linked list: the last element in
- * each chunk is never used as a redo_position; instead, its prev
- * field points to the next chunk in the list of chunks. The parray
- * field of redo_session holds the head of this linked list. Every
- * redo_position struct is immediately followed by its own state
- * buffer. Because the state buffer's size is determined by the
- * caller, iterating over the elements of a chunk requires special
- * code to increment the element pointer.
+ * A session created by redo_beginmappedsession() allocates its chunks
+ * from a file that is mapped into memory, instead of from the heap.
+ * The file begins with a header, which holds a copy of the session's
+ * own memory management fields, and the chunks follow. A large range
+ * of address space is reserved when the file is opened, and the file
+ * is mapped into the start of this range, so that the mapping can be
+ * extended as the file grows without moving the chunks. When the file
+ * is reopened, an attempt is made to reserve the same address range
+ * as before; if this fails, every pointer in the session is adjusted
+ * by the distance that the chunks have moved.
  *
- * redo_branch structs are also allocated in chunks. Unused structs
- * are kept in a linked list by reusing the cdr field; a NULL value in
- * the p field indicates that a struct is unused. The redo_position
- * chunks reserve the first element, instead of the last, to hold the
- * pointer to the next chunk. redo_session usees the bfree and barray
- * fields to point to the heads of these lists.
+ * The header contains two generation numbers. The first is
+ * incremented every time a checkpoint is made, and the second is set
+ * to match it only once every change to the file has been flushed to
+ * disk. As soon as the session is modified after a checkpoint, the
+ * second number is cleared (and this change is flushed to disk before
+ * the modification goes ahead). A file whose two generation numbers
+ * do not match therefore has contents that may be inconsistent --
+ * e.g. after the program crashed -- and it is discarded when opened.
  */
 
-/* Allocate a new array of positions and add it to the linked list.
+#ifdef REDO_MAPPED_FILES
+
+/* The header at the start of a session's backing file. The pointer
+ * fields are copies of the corresponding fields in redo_session.
  */
-static int newposarray(redo_session *session)
-{
-    static int const size = 1024;
-    redo_position *array, *pos, *last;
-    int i;
+typedef struct mapheader {
+    char magic[8];              /* identifies the file format */
+    unsigned long generation;   /* the number of the last checkpoint */
+    unsigned int layout;        /* the struct sizes used to build the file */
+    unsigned int statesize;     /* the session's statesize field */
+    unsigned int cmpsize;       /* the session's cmpsize field */
+    unsigned int poschunksize;  /* the session's poschunksize field */
+    unsigned int hashfunction;  /* the built-in hash function used, if any */
+    char *base;                 /* the address the file was mapped at */
+    size_t used;                /* how many bytes of the file are in use */
+    redo_position *root;
+    poschunk *pchunks;
+    poschunk *pspare;
+    redo_position *pfree;
+    branchchunk *bchunks;
+    branchchunk *bspare;
+    freearray *bfree[SPILLCLASSES];
+    unsigned int positioncount;
+    unsigned int visitclock;
+    unsigned char grafting;
+    unsigned long cleangeneration; /* equal to generation if consistent */
+} mapheader;
+
+/* The state of a session's backing file.
+ */
+struct maparena {
+    int fd;                     /* the open file */
+    char *base;                 /* the start of the reserved address range */
+    size_t reserved;            /* the size of the reserved address range */
+    size_t mapped;              /* how much of the file is mapped */
+    size_t used;                /* how many bytes have been handed out */
+    int clean;                  /* true if the file is marked consistent */
+};
 
-    array = malloc(size * (sizeof *array + session->elementsize));
-    if (!array)
-        return 0;
-    pos = array;
-    for (i = 0 ; i < size - 1 ; ++i) {
-        pos->inuse = 0;
-        pos->inarray = 1;
-        last = pos;
-        pos->prev = incpos(session, pos);
-        pos = pos->prev;
-    }
-    last->prev = NULL;
-    pos->inuse = 0;
-    pos->inarray = 0;
-    pos->prev = session->parray;
-    session->parray = array;
-    session->pfree = array;
-    return 1;
-}
+/* The identifying bytes at the start of a backing file.
+ */
+static char const mapmagic[8] = "libredo";
 
-/* Allocate a new array of redo_branch structs and add it to the
- * linked list.
+/* A value that identifies the layout of the structs stored in a file.
+ * A file built by a differently configured library cannot be used.
  */
-static int newbrancharray(redo_session *session)
-{
-    static int const size = 1024;
-    redo_branch *array;
-    int i;
+#define MAPLAYOUT ((unsigned int)(sizeof(redo_position) | \
+                                  sizeof(void*) << 12 | \
+                                  sizeof(mapheader) << 16))
 
-    array = malloc(size * sizeof *array);
-    if (!array)
-        return 0;
-    for (i = 1 ; i < size ; ++i) {
-        array[i].p = NULL;
-        array[i].cdr = &array[i + 1];
-    }
-    array[size - 1].cdr = NULL;
-    array[0].p = NULL;
-    array[0].cdr = session->barray;
-    session->barray = array;
-    session->bfree = array + 1;
-    return 1;
-}
+/* The amount of address space reserved for a backing file, which
+ * limits the size of the file, and the granularity with which the
+ * file grows.
+ */
+static size_t const mapreservesize =
+                        sizeof(void*) >= 8 ? 0x40000000 : 0x4000000;
+static size_t const mapgrowsize = 0x100000;
 
-/* Grab an unused redo_position and initialize it with the given state.
+/* The offset of the first chunk in a backing file.
  */
-static redo_position *getpositionstruct(redo_session *session,
-                                        void const *state, int endpoint)
-{
-    redo_position *position;
+#define MAPDATASTART ((sizeof(mapheader) + 63) & ~(size_t)63)
+
+/* Return a pointer to the file's header.
+ */
+#define mapgetheader(map) ((mapheader*)(map)->base)
 
-    position = session->pfree;
-    session->pfree = session->pfree->prev;
-    if (!session->pfree)
-        if (!newposarray(session))
+/* Allocate size bytes from the backing file, extending the file as
+ * necessary. NULL is returned if the file cannot be extended.
+ */
+static void *mapallocate(maparena *map, size_t size)
+{
+    size_t newsize;
+    void *p;
+
+    size = (size + 15) & ~(size_t)15;
+    if (map->used + size > map->mapped) {
+        newsize = map->used + size;
+        newsize += mapgrowsize - 1;
+        newsize -= newsize % mapgrowsize;
+        if (newsize > map->reserved)
             return NULL;
-    savestatedata(session, position, state, endpoint);
-    position->inuse = 1;
-    ++session->positioncount;
-    return position;
+        if (ftruncate(map->fd, (off_t)newsize))
+            return NULL;
+        p = mmap(map->base + map->mapped, newsize - map->mapped,
+                 PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+                 map->fd, (off_t)map->mapped);
+        if (p == MAP_FAILED)
+            return NULL;
+        map->mapped = newsize;
+    }
+    p = map->base + map->used;
+    map->used += size;
+    return p;
 }
 
-/* Mark a redo_position as unused.
+/* Mark the backing file as possibly inconsistent, in preparation for
+ * a change to the session. Nothing is done if the file has already
+ * been changed since the last checkpoint.
  */
-static void droppositionstruct(redo_session *session, redo_position *position)
+static void touchmap(redo_session const *session)
 {
-    position->inuse = 0;
-    position->prev = session->pfree;
-    session->pfree = position;
-    --session->positioncount;
+    maparena *map;
+
+    map = session->map;
+    if (!map || !map->clean)
+        return;
+    mapgetheader(map)->cleangeneration = 0;
+    msync(map->base, MAPDATASTART, MS_SYNC);
+    map->clean = 0;
 }
 
-/* Grab an unused redo_branch.
+/* Flush the session's contents to its backing file, and then update
+ * the header to mark the file as consistent.
  */
-static redo_branch *getbranchstruct(redo_session *session, redo_position *p,
-                                    int move, redo_branch *cdr)
+static int syncmap(redo_session *session)
 {
-    redo_branch *branch;
+    maparena *map;
+    mapheader *header;
+    int i;
 
-    branch = session->bfree;
-    session->bfree = branch->cdr;
-    if (!session->bfree)
-        if (!newbrancharray(session))
-            return NULL;
-    branch->p = p;
-    branch->move = move;
-    branch->cdr = cdr;
-    return branch;
+    map = session->map;
+    if (map->clean)
+        return 1;
+    header = mapgetheader(map);
+    header->base = map->base;
+    header->used = map->used;
+    header->root = session->root;
+    header->pchunks = session->pchunks;
+    header->pspare = session->pspare;
+    header->pfree = session->pfree;
+    header->bchunks = session->bchunks;
+    header->bspare = session->bspare;
+    for (i = 0 ; i < SPILLCLASSES ; ++i)
+        header->bfree[i] = session->bfree[i];
+    header->positioncount = session->positioncount;
+    header->visitclock = session->visitclock;
+    header->grafting = session->grafting;
+    header->hashfunction = gethashfunctionid(session->hashfunction);
+    if (msync(map->base, map->used, MS_SYNC))
+        return 0;
+    ++header->generation;
+    header->cleangeneration = header->generation;
+    if (msync(map->base, MAPDATASTART, MS_SYNC))
+        return 0;
+    map->clean = 1;
+    return 1;
 }
 
-/* Mark a redo_branch as unused.
+/* Return a pointer that has been moved by delta bytes.
+ */
+#define relocated(p, delta) \
+    ((p) ? (void*)((char*)(p) + (delta)) : NULL)
+
+/* Adjust every pointer in the session by delta, after the backing
+ * file has been mapped at a different address than before.
  */
-static void dropbranchstruct(redo_session *session, redo_branch *branch)
+static void relocatesession(redo_session *session, ptrdiff_t delta)
 {
-    branch->p = NULL;
-    branch->cdr = session->bfree;
-    session->bfree = branch;
+    redo_position *pos;
+    poschunk *pchunk, **plink;
+    branchchunk **blink;
+    freearray **flink;
+    int i, j;
+
+    session->root = relocated(session->root, delta);
+    session->pfree = relocated(session->pfree, delta);
+    for (plink = &session->pchunks ; *plink ; plink = &(*plink)->next)
+        *plink = relocated(*plink, delta);
+    for (plink = &session->pspare ; *plink ; plink = &(*plink)->next)
+        *plink = relocated(*plink, delta);
+    for (blink = &session->bchunks ; *blink ; blink = &(*blink)->next)
+        *blink = relocated(*blink, delta);
+    for (blink = &session->bspare ; *blink ; blink = &(*blink)->next)
+        *blink = relocated(*blink, delta);
+    for (i = 0 ; i < SPILLCLASSES ; ++i)
+        for (flink = &session->bfree[i] ; *flink ; flink = &(*flink)->next)
+            *flink = relocated(*flink, delta);
+    foreachposition(session, pchunk, pos, i) {
+        pos->prev = relocated(pos->prev, delta);
+        if (!pos->inuse)
+            continue;
+        pos->better = relocated(pos->better, delta);
+        pos->next = relocated(pos->next, delta);
+        for (j = 0 ; j < (int)pos->nextcount ; ++j)
+            pos->next[j].p = relocated(pos->next[j].p, delta);
+    }
 }
 
-/* Create a branch from the given position via the given move, if it
- * does not already exists.
+/* Unmap and close the backing file.
  */
-static redo_branch *insertmoveto(redo_session *session,
-                                 redo_position *from, redo_position *to,
-                                 int move)
+static void closemap(redo_session *session)
 {
-    redo_branch *branch;
-
-    for (branch = from->next ; branch ; branch = branch->cdr)
-        if (branch->move == move)
-            return branch;
+    maparena *map;
 
-    branch = getbranchstruct(session, to, move, from->next);
-    if (!branch)
-        return NULL;
-    from->next = branch;
-    ++from->nextcount;
-    return branch;
+    map = session->map;
+    munmap(map->base, map->reserved);
+    close(map->fd);
+    free(map);
+    session->map = NULL;
 }
 
-/* Delete a branch representing a move between two positions. The
- * function does nothing if no such move exists.
+/* Open the backing file and map it into memory. If the file holds a
+ * consistent session with the same state sizes, its contents are
+ * restored into the session and true is returned. Otherwise the file
+ * is emptied, and false is returned. -1 is returned if the file
+ * cannot be used at all.
  */
-static redo_branch *dropmoveto(redo_session *session,
-                               redo_position *from, redo_position *to)
+static int openmap(redo_session *session, char const *filename)
 {
-    redo_branch *branch, *next;
+    maparena *map;
+    mapheader header;
+    struct stat st;
+    char *hint;
+    void *p;
+    int valid, i;
+
+    map = malloc(sizeof *map);
+    if (!map)
+        return -1;
+    map->fd = open(filename, O_RDWR | O_CREAT, 0666);
+    if (map->fd < 0) {
+        free(map);
+        return -1;
+    }
+    if (flock(map->fd, LOCK_EX | LOCK_NB) || fstat(map->fd, &st)) {
+        close(map->fd);
+        free(map);
+        return -1;
+    }
 
-    next = from->next;
-    if (!next)
-        return NULL;
+    valid = st.st_size >= (off_t)MAPDATASTART &&
+            st.st_size % mapgrowsize == 0 &&
+            pread(map->fd, &header, sizeof header, 0) == sizeof header &&
+            !memcmp(header.magic, mapmagic, sizeof mapmagic) &&
+            header.layout == MAPLAYOUT &&
+            header.generation == header.cleangeneration &&
+            header.statesize == session->statesize &&
+            header.cmpsize == session->cmpsize &&
+            header.poschunksize == session->poschunksize &&
+            header.used >= MAPDATASTART &&
+            header.used <= (size_t)st.st_size &&
+            (size_t)st.st_size <= mapreservesize;
+    if (!valid && ftruncate(map->fd, 0)) {
+        close(map->fd);
+        free(map);
+        return -1;
+    }
 
-    if (next->p == to) {
-        from->next = next->cdr;
-    } else {
-        for (;;) {
-            branch = next;
-            next = next->cdr;
-            if (!next)
-                break;
-            if (next->p == to) {
-                branch->cdr = next->cdr;
-                break;
-            }
+    hint = valid ? header.base : NULL;
+    map->reserved = mapreservesize;
+    for (;;) {
+        p = mmap(hint, map->reserved, PROT_NONE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (p != MAP_FAILED)
+            break;
+        map->reserved /= 2;
+        if (map->reserved < mapgrowsize ||
+                        (valid && map->reserved < (size_t)st.st_size)) {
+            close(map->fd);
+            free(map);
+            return -1;
         }
     }
-    if (next) {
-        dropbranchstruct(session, next);
-        --from->nextcount;
+    map->base = p;
+    map->mapped = 0;
+    map->used = 0;
+    map->clean = 0;
+    session->map = map;
+
+    if (valid) {
+        p = mmap(map->base, st.st_size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_FIXED, map->fd, 0);
+        if (p == MAP_FAILED) {
+            closemap(session);
+            return -1;
+        }
+        map->mapped = st.st_size;
+        map->used = header.used;
+        session->root = header.root;
+        session->pchunks = header.pchunks;
+        session->pspare = header.pspare;
+        session->pfree = header.pfree;
+        session->bchunks = header.bchunks;
+        session->bspare = header.bspare;
+        for (i = 0 ; i < SPILLCLASSES ; ++i)
+            session->bfree[i] = header.bfree[i];
+        session->positioncount = header.positioncount;
+        session->visitclock = header.visitclock;
+        session->grafting = header.grafting;
+        invalidatesolutions(session);
+        map->clean = 1;
+        if (map->base != header.base) {
+            touchmap(session);
+            relocatesession(session, map->base - header.base);
+        }
+        if (!header.hashfunction || header.hashfunction !=
+                        gethashfunctionid(session->hashfunction)) {
+            touchmap(session);
+            rehashpositions(session);
+        }
+        rebuildsolutions(session);
+        return 1;
     }
 
-    return next;
+    if (!mapallocate(map, MAPDATASTART)) {
+        closemap(session);
+        return -1;
+    }
+    memset(map->base, 0, MAPDATASTART);
+    memcpy(mapgetheader(map)->magic, mapmagic, sizeof mapmagic);
+    mapgetheader(map)->layout = MAPLAYOUT;
+    mapgetheader(map)->statesize = session->statesize;
+    mapgetheader(map)->cmpsize = session->cmpsize;
+    mapgetheader(map)->poschunksize = session->poschunksize;
+    mapgetheader(map)->base = map->base;
+    return 0;
 }
 
-/* Compare the given state with all the states in the session. If any
- * positions with identical states are found, return the one with the
- * smallest move count. NULL is returned if no positions have a
- * matching state.
+#else
+
+/* Without mmap(), a session never has a backing file.
  */
-static redo_position *checkforequiv(redo_session const *session,
-                                    void const *state)
-{
-    redo_position *equiv, *pos;
-    unsigned short hashvalue;
+#define touchmap(session) ((void)(session))
 
-    hashvalue = gethashvalue(state, session->cmpsize);
-    if (notintable(session, hashvalue))
-        return NULL;
-    for (pos = session->parray  ; pos ; pos = pos->prev) {
-        for ( ; pos->inarray ; pos = incpos(session, pos)) {
-            if (!pos->inuse)
-                continue;
-            if (!pos->setbetter && pos->hashvalue == hashvalue &&
-                                   comparestatedata(session, pos, state)) {
-                equiv = pos;
-                while (equiv->better)
-                    equiv = equiv->better;
-                return equiv;
-            }
-        }
-    }
-    return NULL;
-}
+#endif
 
-/* Empty the hash table and repopulate it from scratch, walking the
- * tree of positions.
+/* Allocate memory for a chunk, either from the backing file or the
+ * heap.
+ */
+static void *allocatechunk(redo_session *session, size_t size)
+{
+#ifdef REDO_MAPPED_FILES
+    if (session->map)
+        return mapallocate(session->map, size);
+#else
+    (void)session;
+#endif
+    return malloc(size);
+}
+
+/*
+ * Memory management.
+ *
+ * redo_position structs are allocated in chunks, rather than have
+ * each struct be a separate allocation. Each chunk begins with a
+ * small header, and the chunks are kept in a linked list, the head of
+ * which is stored in the pchunks field of redo_session. Every
+ * redo_position struct is immediately followed by its own state
+ * buffer. Because the state buffer's size is determined by the
+ * caller, iterating over the elements of a chunk requires special
+ * code to increment the element pointer.
+ *
+ * Structs are handed out from each chunk in order, and the used field
+ * of the chunk header records how many have been handed out so far.
+ * New chunks are added to the head of the list, so the first chunk
+ * is the one currently being handed out from, and scans of the list
+ * see the most recently created positions first. Structs that are
+ * removed from the tree are kept in a linked list by reusing the prev
+ * field (the inuse field indicates whether or not a struct is
+ * currently being used), and the pfree field of redo_session holds
+ * the head of this linked list. Structs on the free list are reused
+ * before any new ones are handed out.
+ *
+ * A position's branches are normally stored in the inlinenext array
+ * of the position struct itself. When a position has more branches
+ * than will fit there, they are moved to an external array instead.
+ * These arrays come in a small number of size classes, and are
+ * carved out of chunks of redo_branch structs, which are managed in
+ * the same way as the position chunks. Arrays that are no longer
+ * needed are kept on a separate free list for each size class.
+ * redo_session uses the bchunks, bspare, and bfree fields to manage
+ * these chunks.
+ *
+ * Because of this arrangement, the entire contents of a session can
+ * be discarded without freeing any memory, simply by moving every
+ * chunk onto the spare lists, from which they are later reused before
+ * any new chunks are allocated.
+ */
+
+/* Add a new chunk of positions to the head of the linked list,
+ * allocating one if no spare chunks are available.
+ */
+static int newposchunk(redo_session *session)
+{
+    poschunk *chunk;
+
+    if (session->pspare) {
+        chunk = session->pspare;
+        session->pspare = chunk->next;
+    } else {
+        chunk = allocatechunk(session, sizeof *chunk +
+                        session->poschunksize * (size_t)session->elementsize);
+        if (!chunk)
+            return 0;
+    }
+    chunk->used = 0;
+    chunk->next = session->pchunks;
+    session->pchunks = chunk;
+    return 1;
+}
+
+/* Add a new chunk of redo_branch structs, holding at least size
+ * elements, to the head of the linked list, allocating one if no
+ * suitable spare chunk is available.
+ */
+static int newbranchchunk(redo_session *session, int size)
+{
+    branchchunk *chunk, **link;
+
+    for (link = &session->bspare ; *link ; link = &(*link)->next)
+        if ((*link)->size >= size)
+            break;
+    if (*link) {
+        chunk = *link;
+        *link = chunk->next;
+    } else {
+        chunk = allocatechunk(session,
+                              sizeof *chunk + size * sizeof(redo_branch));
+        if (!chunk)
+            return 0;
+        chunk->size = size;
+    }
+    chunk->used = 0;
+    chunk->next = session->bchunks;
+    session->bchunks = chunk;
+    return 1;
+}
+
+/* Grab an unused redo_position and initialize it with the given state.
+ */
+static redo_position *getpositionstruct(redo_session *session,
+                                        void const *state, int endpoint)
+{
+    redo_position *position;
+    poschunk *chunk;
+
+    if (session->pfree) {
+        position = session->pfree;
+        session->pfree = position->prev;
+    } else {
+        chunk = session->pchunks;
+        if (!chunk || chunk->used == (int)session->poschunksize) {
+            if (!newposchunk(session))
+                return NULL;
+            chunk = session->pchunks;
+        }
+        position = chunkposition(session, chunk, chunk->used);
+        ++chunk->used;
+    }
+    savestatedata(session, position, state, endpoint);
+    position->inuse = 1;
+    ++session->positioncount;
+    return position;
+}
+
+/* Mark a redo_position as unused.
+ */
+static void droppositionstruct(redo_session *session, redo_position *position)
+{
+    if (ispathmember(session, position))
+        truncatepath(session, position->movecount);
+    if (position->endpoint)
+        removesolution(session, position);
+    position->inuse = 0;
+    position->prev = session->pfree;
+    session->pfree = position;
+    --session->positioncount;
+}
+
+/* Grab an unused next array from the given size class.
+ */
+static redo_branch *getbrancharray(redo_session *session, int c)
+{
+    redo_branch *array;
+    branchchunk *chunk;
+    int n;
+
+    if (session->bfree[c]) {
+        array = &session->bfree[c]->branch;
+        session->bfree[c] = session->bfree[c]->next;
+        return array;
+    }
+    n = spillsize(c);
+    chunk = session->bchunks;
+    if (!chunk || chunk->used + n > chunk->size) {
+        if (!newbranchchunk(session, n < branchchunksize ? branchchunksize
+                                                          : n))
+            return NULL;
+        chunk = session->bchunks;
+    }
+    array = (redo_branch*)(chunk + 1) + chunk->used;
+    chunk->used += n;
+    return array;
+}
+
+/* Mark a next array from the given size class as unused.
+ */
+static void dropbrancharray(redo_session *session, redo_branch *array, int c)
+{
+    freearray *entry;
+
+    entry = (freearray*)array;
+    entry->next = session->bfree[c];
+    session->bfree[c] = entry;
+}
+
+/* Mark every position and branch in the session as unused, without
+ * releasing any memory, by moving all of the chunks to the spare
+ * lists.
+ */
+static void emptychunks(redo_session *session)
+{
+    poschunk *pchunk;
+    branchchunk *bchunk;
+
+    while (session->pchunks) {
+        pchunk = session->pchunks;
+        session->pchunks = pchunk->next;
+        pchunk->next = session->pspare;
+        session->pspare = pchunk;
+    }
+    while (session->bchunks) {
+        bchunk = session->bchunks;
+        session->bchunks = bchunk->next;
+        bchunk->next = session->bspare;
+        session->bspare = bchunk;
+    }
+    session->pfree = NULL;
+    memset(session->bfree, 0, sizeof session->bfree);
+    session->positioncount = 0;
+    session->solutioncount = 0;
+    session->solutionorder = solutionssorted;
+}
+
+/* Create a branch from the given position via the given move, if it
+ * does not already exists. The new branch is placed at the front of
+ * the next array, moving the branches to an external array if they
+ * no longer fit in the current one.
+ */
+static redo_branch *insertmoveto(redo_session *session,
+                                 redo_position *from, redo_position *to,
+                                 int move)
+{
+    redo_branch *array;
+    int count, c, i;
+
+    count = from->nextcount;
+    for (i = 0 ; i < count ; ++i)
+        if (from->next[i].move == move)
+            return from->next + i;
+
+    c = from->spillclass;
+    if (count < REDO_INLINE_BRANCHES) {
+        array = from->inlinenext;
+    } else if (count > REDO_INLINE_BRANCHES && count < spillsize(c)) {
+        array = from->next;
+    } else {
+        if (count > REDO_INLINE_BRANCHES)
+            ++c;
+        else
+            c = 0;
+        if (c >= SPILLCLASSES)
+            return NULL;
+        array = getbrancharray(session, c);
+        if (!array)
+            return NULL;
+    }
+    if (count)
+        memmove(array + 1, from->next, count * sizeof *array);
+    if (array != from->next && count > REDO_INLINE_BRANCHES)
+        dropbrancharray(session, from->next, from->spillclass);
+    from->spillclass = c;
+    array->p = to;
+    array->move = move;
+    from->next = array;
+    ++from->nextcount;
+    return array;
+}
+
+/* Delete a branch representing a move between two positions. The
+ * order of the remaining branches is preserved, and they are moved
+ * back inside the position if they fit. False is returned if no such
+ * move exists.
+ */
+static int dropmoveto(redo_session *session,
+                      redo_position *from, redo_position *to)
+{
+    redo_branch *array;
+    int count, i;
+
+    count = from->nextcount;
+    for (i = 0 ; i < count ; ++i)
+        if (from->next[i].p == to)
+            break;
+    if (i == count)
+        return 0;
+
+    --count;
+    array = count > REDO_INLINE_BRANCHES ? from->next : from->inlinenext;
+    memmove(array, from->next, i * sizeof *array);
+    memmove(array + i, from->next + i + 1, (count - i) * sizeof *array);
+    if (array != from->next)
+        dropbrancharray(session, from->next, from->spillclass);
+    from->next = count ? array : NULL;
+    from->nextcount = count;
+    return 1;
+}
+
+/* Compare the given state with all the states in the session. If any
+ * positions with identical states are found, return the one with the
+ * smallest move count. NULL is returned if no positions have a
+ * matching state. The session's lookup counters are updated.
+ */
+static redo_position *checkforequiv(redo_session *session, void const *state)
+{
+    redo_position *equiv, *pos;
+    poschunk *chunk;
+    unsigned int hashvalue;
+    int i;
+
+    ++session->counters.lookups;
+    hashvalue = gethashvalue(session, state);
+    if (notintable(session, hashvalue)) {
+        ++session->counters.hashrejects;
+        return NULL;
+    }
+    foreachposition(session, chunk, pos, i) {
+        if (!pos->inuse)
+            continue;
+        ++session->counters.probes;
+        if (pos->setbetter || pos->hashvalue != hashvalue)
+            continue;
+        ++session->counters.comparisons;
+        if (comparestatedata(session, pos, state)) {
+            equiv = pos;
+            while (equiv->better)
+                equiv = equiv->better;
+            return equiv;
+        }
+    }
+    ++session->counters.falsehits;
+    return NULL;
+}
+
+/* Empty the hash table and repopulate it from scratch, walking the
+ * tree of positions.
  */
 static void recalchashtable(redo_session *session)
 {
     redo_position *pos;
+    poschunk *chunk;
+    int i;
 
     if (!session->hashtable)
         return;
     emptyhashtable(session);
-    for (pos = session->parray  ; pos ; pos = pos->prev)
-        for ( ; pos->inarray ; pos = incpos(session, pos))
-            if (pos->inuse)
-                sethashentry(session, pos->hashvalue);
+    foreachposition(session, chunk, pos, i)
+        if (pos->inuse)
+            sethashentry(session, pos->hashvalue);
+}
+
+/* Redirect any better fields that point to position, which is about
+ * to be removed from the session, to position's own better field.
+ */
+static void replacebetter(redo_session *session, redo_position *position)
+{
+    redo_position *pos;
+    poschunk *chunk;
+    int i;
+
+    foreachposition(session, chunk, pos, i)
+        if (pos->inuse && pos->better == position)
+            pos->better = position->better;
 }
 
 /* Delete the nodes in the path leading from branchpoint to leaf in
@@ -432,6 +1413,7 @@ static int prunebranch(redo_session *session, redo_position *leaf,
     redo_position *pos;
     int done;
 
+    touchmap(session);
     done = 1;
     pos = leaf;
     while (pos && pos != branchpoint) {
@@ -442,6 +1424,7 @@ static int prunebranch(redo_session *session, redo_position *leaf,
         leaf = pos;
         pos = pos->prev;
         dropmoveto(session, pos, leaf);
+        replacebetter(session, leaf);
         droppositionstruct(session, leaf);
         session->changeflag = 1;
     }
@@ -450,57 +1433,166 @@ static int prunebranch(redo_session *session, redo_position *leaf,
     return done;
 }
 
+/* Push a position onto the session's work stack, which currently
+ * holds count entries. The stack is enlarged as necessary. The return
+ * value is the new count, or zero if memory could not be allocated.
+ * (The work stack allows subtrees of arbitrary depth to be walked
+ * without recursion, so that deep trees cannot exhaust the native
+ * stack.)
+ */
+static int pushwork(redo_session *session, int count, redo_position *position)
+{
+    redo_position **stack;
+    int size;
+
+    if (count == session->stacksize) {
+        size = session->stacksize ? 2 * session->stacksize : 256;
+        stack = realloc(session->stack, size * sizeof *stack);
+        if (!stack)
+            return 0;
+        session->stack = stack;
+        session->stacksize = size;
+    }
+    session->stack[count] = position;
+    return count + 1;
+}
+
+/* Make sure that the session's work stack has room for at least size
+ * entries, so that pushes up to that depth cannot fail. False is
+ * returned if memory could not be allocated.
+ */
+static int reservework(redo_session *session, int size)
+{
+    redo_position **stack;
+
+    if (size <= session->stacksize)
+        return 1;
+    stack = realloc(session->stack, size * sizeof *stack);
+    if (!stack)
+        return 0;
+    session->stack = stack;
+    session->stacksize = size;
+    return 1;
+}
+
+/* Update the cached path so that it runs from the root to position.
+ * Entries below the nearest position already in the path are
+ * discarded, and the positions above it are added. False is returned
+ * if memory could not be allocated, in which case the path is left
+ * empty.
+ */
+static int syncpath(redo_session *session, redo_position *position)
+{
+    redo_position *p;
+    int i, n;
+
+    if (!session->pathbuckets) {
+        session->pathbuckets =
+                malloc(pathbucketcount * sizeof *session->pathbuckets);
+        if (!session->pathbuckets)
+            return 0;
+        invalidatepath(session);
+    }
+    n = 0;
+    for (p = position ; p && !ispathmember(session, p) ; p = p->prev) {
+        n = pushwork(session, n, p);
+        if (!n) {
+            invalidatepath(session);
+            return 0;
+        }
+    }
+    truncatepath(session, p ? p->movecount + 1 : 0);
+    for (i = n - 1 ; i >= 0 ; --i) {
+        if (!appendpath(session, session->stack[i])) {
+            invalidatepath(session);
+            return 0;
+        }
+    }
+    return 1;
+}
+
 /* Change the movecount of the nodes of the subtree rooted at position
  * by delta. The solutionsize fields, if non-zero, are likewise
- * adjusted.
+ * adjusted, and the solution index is sorted again if any endpoints
+ * were moved. Since the better links can be altered along the way, the
+ * nodes are visited in depth-first order, with each node's branches
+ * taken in array order. Every node is pushed onto the work stack at
+ * most once, so the caller must first reserve room on the stack for
+ * every position in the session.
  */
-static void adjustmovecount(redo_position *position, int delta)
+static void adjustmovecount(redo_session *session, redo_position *position,
+                            int delta)
 {
-    redo_branch *branch;
-
-    position->movecount += delta;
-    if (position->solutionsize)
-        position->solutionsize += delta;
-    if (position->better &&
-                position->better->movecount > position->movecount) {
-        position->better->better = position;
-        position->better = NULL;
+    int moved, count, i;
+
+    moved = 0;
+    session->stack[0] = position;
+    count = 1;
+    while (count) {
+        position = session->stack[--count];
+        position->movecount += delta;
+        if (position->solutionsize)
+            position->solutionsize += delta;
+        if (position->endpoint)
+            moved = 1;
+        if (position->better &&
+                    position->better->movecount > position->movecount) {
+            position->better->better = position;
+            position->better = NULL;
+        }
+        for (i = position->nextcount - 1 ; i >= 0 ; --i)
+            session->stack[count++] = position->next[i].p;
     }
-    for (branch = position->next ; branch ; branch = branch->cdr)
-        if (branch->p)
-            adjustmovecount(branch->p, delta);
+    if (moved)
+        sortsolutions(session);
 }
 
 /* Move the entire subtree rooted at src to dest, leaving src a leaf
- * node upon return. No nodes are allocated or freed by this function.
+ * node upon return. No nodes are allocated or freed by this function,
+ * though the work stack may need to be enlarged first. If it cannot
+ * be, false is returned and nothing is changed.
  */
-static void graftbranch(redo_position *dest, redo_position *src)
+static int graftbranch(redo_session *session,
+                       redo_position *dest, redo_position *src)
 {
-    redo_branch *branch;
-    int n, e;
+    redo_count size;
+    int n, e, i;
 
-    dest->next = src->next;
+    if (!reservework(session, (int)session->positioncount))
+        return 0;
+    if (src->nextcount > REDO_INLINE_BRANCHES) {
+        dest->next = src->next;
+        dest->spillclass = src->spillclass;
+    } else if (src->nextcount) {
+        memcpy(dest->inlinenext, src->next,
+               src->nextcount * sizeof *dest->inlinenext);
+        dest->next = dest->inlinenext;
+    } else {
+        dest->next = NULL;
+    }
     dest->nextcount = src->nextcount;
     src->next = NULL;
     src->nextcount = 0;
-    for (branch = dest->next ; branch ; branch = branch->cdr)
-        if (branch->p)
-            branch->p->prev = dest;
-    n = dest->movecount - src->movecount;
+    ++session->counters.grafts;
+    invalidatepath(session);
+    for (i = 0 ; i < (int)dest->nextcount ; ++i)
+        dest->next[i].p->prev = dest;
+    n = (int)dest->movecount - (int)src->movecount;
     dest->movecount = src->movecount;
     dest->solutionsize = src->solutionsize;
     dest->solutionend = src->solutionend;
-    adjustmovecount(dest, n);
+    adjustmovecount(session, dest, n);
     if (src->solutionend) {
         e = dest->solutionend;
-        n = dest->solutionsize;
+        size = dest->solutionsize;
         for (dest = dest->prev ; dest ; dest = dest->prev) {
-            if (!isimprovedsolution(dest, e, n))
+            if (!isimprovedsolution(dest, e, size))
                 break;
             dest->solutionend = e;
-            dest->solutionsize = n;
+            dest->solutionsize = size;
         }
     }
+    return 1;
 }
 
 /* Refresh the solutionsize field for each node along the path leading
@@ -508,16 +1600,18 @@ static void graftbranch(redo_position *dest, redo_position *src)
  */
 static void recalcsolutionsize(redo_position *position)
 {
-    redo_branch *branch;
-    int size, end;
+    redo_position *p;
+    redo_count size;
+    int end, i;
 
     while (position) {
         end = 0;
         size = 0;
-        for (branch = position->next ; branch ; branch = branch->cdr) {
-            if (branch->p && !isimprovedsolution(branch->p, end, size)) {
-                size = branch->p->solutionsize;
-                end = branch->p->solutionend;
+        for (i = 0 ; i < (int)position->nextcount ; ++i) {
+            p = position->next[i].p;
+            if (!isimprovedsolution(p, end, size)) {
+                size = p->solutionsize;
+                end = p->solutionend;
             }
         }
         position->solutionsize = size;
@@ -526,23 +1620,558 @@ static void recalcsolutionsize(redo_position *position)
     }
 }
 
-/*
- * Exported functions.
+/* Link a newly added position with an existing position that has an
+ * identical state. Whichever of the two has fewer moves becomes the
+ * better of the other, and if it is the new position, the session's
+ * grafting option is applied. (If a graft cannot be done for lack of
+ * memory, the positions are left as they would be under
+ * redo_nograft.)
+ */
+static void linkequiv(redo_session *session, redo_position *position,
+                      redo_position *equiv)
+{
+    ++session->generation;
+    if (position->movecount >= equiv->movecount) {
+        position->better = equiv;
+    } else {
+        equiv->better = position;
+        if (session->grafting == redo_copypath) {
+            redo_duplicatepath(session, position, equiv);
+        } else if (session->grafting != redo_nograft) {
+            if (!graftbranch(session, position, equiv))
+                return;
+            recalcsolutionsize(equiv);
+            if (session->grafting == redo_graftandcopy)
+                redo_duplicatepath(session, equiv, position);
+        }
+    }
+}
+
+/* Halve the visit times of every position, along with the session's
+ * clock, so that the clock can continue to advance without
+ * overflowing the lastvisit fields. The order of the visits is
+ * preserved, apart from adjacent visits that may become tied.
+ */
+static void agevisits(redo_session *session)
+{
+    redo_position *pos;
+    poschunk *chunk;
+    int i;
+
+    foreachposition(session, chunk, pos, i)
+        pos->lastvisit >>= 1;
+    session->visitclock >>= 1;
+}
+
+/* Record that a position has just been visited.
+ */
+static void visitposition(redo_session *session, redo_position *position)
+{
+    touchmap(session);
+    if (session->visitclock >= maxvisitclock)
+        agevisits(session);
+    position->lastvisit = ++session->visitclock;
+}
+
+/* Create a new position, reached from prev via the given move, and
+ * add it to the session. If the position is an endpoint, its own
+ * solution fields are set, but the solutions of its ancestors are
+ * left for the caller to update.
+ */
+static redo_position *appendposition(redo_session *session,
+                                     redo_position *prev, int move,
+                                     void const *state, int endpoint,
+                                     int setbetter)
+{
+    redo_position *position;
+
+    position = getpositionstruct(session, state, endpoint);
+    if (!position)
+        return NULL;
+    if (prev && !insertmoveto(session, prev, position, move)) {
+        droppositionstruct(session, position);
+        return NULL;
+    }
+    sethashentry(session, position->hashvalue);
+
+    position->better = NULL;
+    position->setbetter = setbetter;
+    position->prev = prev;
+    position->next = NULL;
+    position->nextcount = 0;
+    position->spillclass = 0;
+    position->movecount = prev ? prev->movecount + 1 : 0;
+    position->solutionend = endpoint;
+    position->solutionsize = endpoint ? position->movecount : 0;
+    position->keep = 0;
+    if (endpoint) {
+        addsolution(session, position);
+        ++session->generation;
+    }
+    visitposition(session, position);
+    return position;
+}
+
+/* Update the solution fields of every position on the path leading to
+ * position, using the endpoints found along the path. The path is
+ * walked once, carrying the best endpoint seen so far upwards.
+ */
+static void propagatesolutions(redo_position *position)
+{
+    redo_position *p;
+    redo_count size;
+    int end;
+
+    end = 0;
+    size = 0;
+    for (p = position ; p ; p = p->prev) {
+        if (isimprovedsolution(p, end, size)) {
+            p->solutionend = end;
+            p->solutionsize = size;
+        }
+        if (p->endpoint && (end == 0 || end < p->endpoint ||
+                            (end == p->endpoint && size > p->movecount))) {
+            end = p->endpoint;
+            size = p->movecount;
+        }
+    }
+}
+
+/* An index of the states of a path being added by addpath(). It
+ * allows equivalent positions to be found for every state on the path
+ * with a single scan of the session, instead of one scan per state.
+ */
+typedef struct pathindex {
+    unsigned int *hashes;       /* the hash value of each state */
+    int *links;                 /* the next state in the same bucket */
+    int *buckets;               /* the first state in each bucket */
+    redo_position **equivs;     /* the first match found for each state */
+    redo_position **added;      /* the position created for each state */
+    int bucketcount;            /* the number of buckets (a power of 2) */
+} pathindex;
+
+/* Free the memory used by a path index.
+ */
+static void freepathindex(pathindex *index)
+{
+    free(index->hashes);
+    free(index->links);
+    free(index->buckets);
+    free(index->equivs);
+    free(index->added);
+}
+
+/* Build an index of the count states in the states buffer, and then
+ * scan the session for positions with identical states. As with
+ * checkforequiv(), the first match found for each state is recorded.
+ * False is returned if memory could not be allocated.
+ */
+static int buildpathindex(redo_session *session, pathindex *index,
+                          char const *states, int count)
+{
+    redo_position *pos;
+    poschunk *chunk;
+    int matched, i, n;
+
+    for (n = 16 ; n < count ; n *= 2) ;
+    index->bucketcount = n;
+    index->hashes = malloc(count * sizeof *index->hashes);
+    index->links = malloc(count * sizeof *index->links);
+    index->buckets = malloc(n * sizeof *index->buckets);
+    index->equivs = malloc(count * sizeof *index->equivs);
+    index->added = malloc(count * sizeof *index->added);
+    if (!index->hashes || !index->links || !index->buckets ||
+                        !index->equivs || !index->added) {
+        freepathindex(index);
+        return 0;
+    }
+    for (i = 0 ; i < n ; ++i)
+        index->buckets[i] = -1;
+    for (i = count - 1 ; i >= 0 ; --i) {
+        index->hashes[i] = gethashvalue(session,
+                                        states + i * session->statesize);
+        index->equivs[i] = NULL;
+        index->added[i] = NULL;
+        n = index->hashes[i] & (index->bucketcount - 1);
+        index->links[i] = index->buckets[n];
+        index->buckets[n] = i;
+    }
+
+    matched = 0;
+    foreachposition(session, chunk, pos, n) {
+        if (!pos->inuse || pos->setbetter)
+            continue;
+        ++session->counters.probes;
+        i = index->buckets[pos->hashvalue & (index->bucketcount - 1)];
+        for ( ; i >= 0 ; i = index->links[i]) {
+            if (index->equivs[i] || index->hashes[i] != pos->hashvalue)
+                continue;
+            ++session->counters.comparisons;
+            if (comparestatedata(session, pos,
+                                 states + i * session->statesize)) {
+                index->equivs[i] = pos;
+                ++matched;
+            }
+        }
+        if (matched == count)
+            break;
+    }
+    return 1;
+}
+
+/* Return a position whose state is identical to the ith state of an
+ * indexed path, or NULL if there is none. If the state did not match
+ * any position already in the session, the positions added earlier
+ * in the same path are checked. As with checkforequiv(), the better
+ * fields of the match are followed to the end.
+ */
+static redo_position *findpathequiv(redo_session *session,
+                                    pathindex const *index,
+                                    void const *state, int i)
+{
+    redo_position *equiv;
+    int j;
+
+    ++session->counters.lookups;
+    equiv = index->equivs[i];
+    if (!equiv) {
+        j = index->buckets[index->hashes[i] & (index->bucketcount - 1)];
+        for ( ; j >= 0 && j < i ; j = index->links[j]) {
+            if (index->added[j] && index->hashes[j] == index->hashes[i] &&
+                        comparestatedata(session, index->added[j], state)) {
+                equiv = index->added[j];
+                break;
+            }
+        }
+    }
+    if (!equiv)
+        return NULL;
+    while (equiv->better)
+        equiv = equiv->better;
+    return equiv;
+}
+
+/* An index of every position in a session, used by
+ * redo_mergesession() to find equivalent positions without scanning
+ * the session once per added position. The table is open-addressed,
+ * keyed on the positions' hash values, and is made large enough at
+ * the outset for every position the merge can add.
+ */
+typedef struct mergeindex {
+    redo_position **slots;      /* the indexed positions, or NULL */
+    unsigned int slotcount;     /* the number of slots (a power of 2) */
+} mergeindex;
+
+/* Add a position to a merge index.
+ */
+static void addtomergeindex(mergeindex *index, redo_position *position)
+{
+    unsigned int n;
+
+    n = position->hashvalue & (index->slotcount - 1);
+    while (index->slots[n])
+        n = (n + 1) & (index->slotcount - 1);
+    index->slots[n] = position;
+}
+
+/* Build an index of the positions in a session, with room for extra
+ * more positions to be added to it afterwards. False is returned if
+ * memory could not be allocated.
+ */
+static int buildmergeindex(redo_session *session, mergeindex *index,
+                           unsigned int extra)
+{
+    redo_position *pos;
+    poschunk *chunk;
+    unsigned int n;
+    int i;
+
+    for (n = 16 ; n < 2 * (session->positioncount + extra) ; n *= 2) ;
+    index->slotcount = n;
+    index->slots = calloc(n, sizeof *index->slots);
+    if (!index->slots)
+        return 0;
+    foreachposition(session, chunk, pos, i)
+        if (pos->inuse && !pos->setbetter)
+            addtomergeindex(index, pos);
+    return 1;
+}
+
+/* Return a position in a merge index whose state is identical to the
+ * given state, or NULL if there is none. As with checkforequiv(), the
+ * better fields of the match are followed to the end, and the
+ * session's lookup counters are updated.
+ */
+static redo_position *findmergeequiv(redo_session *session,
+                                     mergeindex const *index,
+                                     void const *state)
+{
+    redo_position *equiv;
+    unsigned int hashvalue, n;
+
+    ++session->counters.lookups;
+    hashvalue = gethashvalue(session, state);
+    if (notintable(session, hashvalue)) {
+        ++session->counters.hashrejects;
+        return NULL;
+    }
+    n = hashvalue & (index->slotcount - 1);
+    for ( ; index->slots[n] ; n = (n + 1) & (index->slotcount - 1)) {
+        equiv = index->slots[n];
+        ++session->counters.probes;
+        if (equiv->hashvalue != hashvalue)
+            continue;
+        ++session->counters.comparisons;
+        if (comparestatedata(session, equiv, state)) {
+            while (equiv->better)
+                equiv = equiv->better;
+            return equiv;
+        }
+    }
+    ++session->counters.falsehits;
+    return NULL;
+}
+
+/* Add a new node to the session, leading from prev via move. If such
+ * a node already exists, it is returned; otherwise, the node is
+ * created, fully initialized, and returned. In the latter case, the
+ * state data is stored with the new position. If checkequiv's value
+ * is redo_check, then the function will check for equivalent nodes in
+ * the session. If one is found, the better field will be intialized
+ * to point to it, or, if the new node is actually the other node's
+ * better, grafting behavior with be applied.
+ */
+static redo_position *addposition(redo_session *session,
+                                  redo_position *prev, int move,
+                                  void const *state, int endpoint,
+                                  int checkequiv)
+{
+    redo_position *position, *equiv;
+
+    if (prev) {
+        position = redo_getnextposition(prev, move);
+        if (position) {
+            visitposition(session, position);
+            return position;
+        }
+        if (prev->movecount >= REDO_COUNT_MAX)
+            return NULL;
+    }
+    touchmap(session);
+
+    if (checkequiv == redo_check && endpoint == 0)
+        equiv = checkforequiv(session, state);
+    else
+        equiv = NULL;
+
+    position = appendposition(session, prev, move, state, endpoint,
+                              checkequiv == redo_checklater);
+    if (!position)
+        return NULL;
+    if (endpoint)
+        propagatesolutions(position);
+
+    if (equiv)
+        linkequiv(session, position, equiv);
+
+    session->changeflag = 1;
+    return position;
+}
+
+/* Add a sequence of positions to the session, each one following
+ * from the one before. When checking for equivalent positions, the
+ * session is scanned once for the entire path, and the solutions of
+ * the path's ancestors are updated once at the end.
+ */
+static redo_position *addpath(redo_session *session, redo_position *from,
+                              int const *moves, void const *states,
+                              int const *endpoints, int count,
+                              int checkequiv)
+{
+    pathindex index;
+    redo_position *position, *next, *equiv;
+    char const *state;
+    int indexed, added, endpoint, i;
+
+    memset(&index, 0, sizeof index);
+    indexed = checkequiv == redo_check && count > 1 &&
+              buildpathindex(session, &index, states, count);
+    position = from;
+    state = states;
+    added = 0;
+    for (i = 0 ; i < count ; ++i, state += session->statesize) {
+        next = redo_getnextposition(position, moves[i]);
+        if (next) {
+            position = next;
+            continue;
+        }
+        if (position->movecount >= REDO_COUNT_MAX)
+            break;
+        touchmap(session);
+        endpoint = endpoints ? endpoints[i] : 0;
+        equiv = NULL;
+        if (checkequiv == redo_check && endpoint == 0)
+            equiv = indexed ? findpathequiv(session, &index, state, i)
+                            : checkforequiv(session, state);
+        next = appendposition(session, position, moves[i], state, endpoint,
+                              checkequiv == redo_checklater);
+        if (!next)
+            break;
+        if (indexed)
+            index.added[i] = next;
+        if (equiv)
+            linkequiv(session, next, equiv);
+        if (endpoint)
+            added = 1;
+        position = next;
+    }
+    if (indexed)
+        freepathindex(&index);
+
+    if (added)
+        propagatesolutions(position);
+    if (position != from) {
+        visitposition(session, position);
+        session->changeflag = 1;
+    }
+    return i == count ? position : NULL;
+}
+
+/* Return true if a position can be removed from the session in order
+ * to keep it within its position limit: it must be an unprotected
+ * leaf, other than the root, that is not the endpoint of a solution.
+ */
+#define isevictable(p) \
+    ((p)->prev && !(p)->nextcount && !(p)->keep && !(p)->solutionend)
+
+/* Move the entry at index n in a heap of positions towards the top of
+ * the heap, so that the least recently visited position is on top.
+ */
+static void heapup(redo_position **heap, int n)
+{
+    redo_position *pos;
+    int parent;
+
+    pos = heap[n];
+    while (n > 0) {
+        parent = (n - 1) / 2;
+        if (heap[parent]->lastvisit <= pos->lastvisit)
+            break;
+        heap[n] = heap[parent];
+        n = parent;
+    }
+    heap[n] = pos;
+}
+
+/* Move the entry at index n in a heap of count positions towards the
+ * bottom of the heap.
+ */
+static void heapdown(redo_position **heap, int count, int n)
+{
+    redo_position *pos;
+    int child;
+
+    pos = heap[n];
+    for (;;) {
+        child = 2 * n + 1;
+        if (child >= count)
+            break;
+        if (child + 1 < count &&
+                    heap[child + 1]->lastvisit < heap[child]->lastvisit)
+            ++child;
+        if (pos->lastvisit <= heap[child]->lastvisit)
+            break;
+        heap[n] = heap[child];
+        n = child;
+    }
+    heap[n] = pos;
+}
+
+/* If the session has grown past its position limit, remove the least
+ * recently visited leaves until it is back below the limit, less a
+ * margin. The leaves are kept in a heap, built on the work stack, and
+ * when a leaf's parent becomes a leaf itself it is added to the heap.
+ * The position given by except is never removed. If there are not
+ * enough leaves that can be removed, the session is not examined
+ * again until it has grown by the same margin, so that the cost of
+ * searching the session is not incurred on every call.
  */
+static void evictpositions(redo_session *session,
+                           redo_position const *except)
+{
+    redo_position *pos, *prev;
+    poschunk *chunk;
+    unsigned int limit, margin, target;
+    int count, n, i;
 
-/* Create a new session with a single position at the root.
+    limit = session->positionlimit;
+    if (!limit || session->positioncount <= session->evictthreshold)
+        return;
+    margin = limit / 8;
+    target = limit - margin;
+
+    count = 0;
+    foreachposition(session, chunk, pos, i) {
+        if (pos->inuse && pos != except && isevictable(pos)) {
+            count = pushwork(session, count, pos);
+            if (!count)
+                return;
+        }
+    }
+    for (i = count / 2 - 1 ; i >= 0 ; --i)
+        heapdown(session->stack, count, i);
+
+    touchmap(session);
+    n = 0;
+    while (count && session->positioncount > target) {
+        pos = session->stack[0];
+        session->stack[0] = session->stack[--count];
+        heapdown(session->stack, count, 0);
+        prev = pos->prev;
+        if (session->evictfunction)
+            session->evictfunction(pos);
+        if (!dropmoveto(session, prev, pos))
+            continue;
+        droppositionstruct(session, pos);
+        ++n;
+        if (prev != except && isevictable(prev)) {
+            count = pushwork(session, count, prev);
+            if (!count)
+                break;
+            heapup(session->stack, count - 1);
+        }
+    }
+
+    if (n) {
+        foreachposition(session, chunk, pos, i)
+            if (pos->inuse)
+                while (pos->better && !pos->better->inuse)
+                    pos->better = pos->better->better;
+        recalchashtable(session);
+        session->counters.evictions += n;
+        session->changeflag = 1;
+    }
+    if (session->positioncount > limit)
+        session->evictthreshold = session->positioncount + margin;
+    else
+        session->evictthreshold = limit;
+}
+
+/* Allocate and initialize a session with no positions. NULL is
+ * returned if the sizes are invalid.
  */
-redo_session *redo_beginsession(void const *initialstate,
-                                int size, int cmpsize)
+static redo_session *newsession(int size, int cmpsize)
 {
     redo_session *session;
     int n;
 
     if (size <= 0 || cmpsize < 0 || cmpsize > size)
         return NULL;
+    if (size > REDO_STATESIZE_MAX)
+        return NULL;
     n = sizeof(redo_position) + size + (sizeof(void*) - 1);
     n = n - n % sizeof(void*);
-    if (n > 0xFFFF)
+    if (n > REDO_STATESIZE_MAX)
         return NULL;
     session = malloc(sizeof *session);
     if (!session)
@@ -550,24 +2179,128 @@ redo_session *redo_beginsession(void const *initialstate,
     session->statesize = size;
     session->cmpsize = cmpsize ? cmpsize : size;
     session->elementsize = n;
+    session->poschunksize = poschunksize;
+    while (session->poschunksize > 1 &&
+           session->poschunksize > maxchunkbytes / session->elementsize)
+        session->poschunksize /= 2;
     session->grafting = redo_graft;
-    session->parray = NULL;
+    session->positionlimit = 0;
+    session->evictthreshold = 0;
+    session->visitclock = 0;
+    session->generation = 0;
+    session->hashfunction = getdefaulthashfunction();
+    session->evictfunction = NULL;
+    session->pchunks = NULL;
+    session->pspare = NULL;
     session->pfree = NULL;
-    session->barray = NULL;
-    session->bfree = NULL;
+    session->bchunks = NULL;
+    session->bspare = NULL;
+    memset(session->bfree, 0, sizeof session->bfree);
     session->positioncount = 0;
+    session->stack = NULL;
+    session->stacksize = 0;
+    session->path = NULL;
+    session->pathcount = 0;
+    session->pathsize = 0;
+    session->pathbuckets = NULL;
+    session->solutions = NULL;
+    session->solutioncount = 0;
+    session->solutionssize = 0;
+    session->solutionorder = solutionssorted;
+    memset(&session->counters, 0, sizeof session->counters);
+    session->map = NULL;
+    session->root = NULL;
+    session->changeflag = 0;
     createhashtable(session);
-    if (!newposarray(session) || !newbrancharray(session)) {
+    return session;
+}
+
+/* Create the first chunks of a new session and add its root position.
+ */
+static int addroot(redo_session *session, void const *initialstate)
+{
+    if (!newposchunk(session) || !newbranchchunk(session, branchchunksize))
+        return 0;
+    session->root = addposition(session, NULL, 0, initialstate, 0, 0);
+    session->changeflag = 0;
+    return session->root != NULL;
+}
+
+/*
+ * Exported functions.
+ */
+
+/* Create a new session with a single position at the root.
+ */
+redo_session *redo_beginsession(void const *initialstate,
+                                int size, int cmpsize)
+{
+    redo_session *session;
+
+    session = newsession(size, cmpsize);
+    if (!session)
+        return NULL;
+    if (!addroot(session, initialstate)) {
         redo_endsession(session);
         return NULL;
     }
-    session->root = redo_addposition(session, NULL, 0, initialstate, 0, 0);
-    if (!session->root) {
+    return session;
+}
+
+/* Create a session whose positions are stored in a memory-mapped file,
+ * restoring the positions already in the file if possible.
+ */
+redo_session *redo_beginmappedsession(char const *filename,
+                                      void const *initialstate,
+                                      int size, int cmpsize)
+{
+#ifdef REDO_MAPPED_FILES
+    redo_session *session;
+    int f;
+
+    session = newsession(size, cmpsize);
+    if (!session)
+        return NULL;
+    f = openmap(session, filename);
+    if (f < 0) {
+        redo_endsession(session);
+        return NULL;
+    }
+    if (f) {
+        if (comparestatedata(session, session->root, initialstate)) {
+            recalchashtable(session);
+            return session;
+        }
+        if (!redo_resetsession(session, initialstate)) {
+            redo_endsession(session);
+            return NULL;
+        }
+        return session;
+    }
+    if (!addroot(session, initialstate)) {
         redo_endsession(session);
         return NULL;
     }
-    session->changeflag = 0;
     return session;
+#else
+    (void)filename;
+    (void)initialstate;
+    (void)size;
+    (void)cmpsize;
+    return NULL;
+#endif
+}
+
+/* Flush a mapped session to its file.
+ */
+int redo_checkpointsession(redo_session *session)
+{
+#ifdef REDO_MAPPED_FILES
+    if (session->map)
+        return syncmap(session);
+#endif
+    (void)session;
+    return 1;
 }
 
 /* Change the grafting behavior option.
@@ -577,10 +2310,77 @@ int redo_setgraftbehavior(redo_session *session, int grafting)
     int oldvalue;
 
     oldvalue = session->grafting;
+    if (grafting != oldvalue)
+        touchmap(session);
     session->grafting = grafting;
     return oldvalue;
 }
 
+/* Change the session's position limit, and remove positions if the
+ * session is already over the new limit.
+ */
+int redo_setpositionlimit(redo_session *session, int limit)
+{
+    int oldvalue;
+
+    oldvalue = session->positionlimit;
+    session->positionlimit = limit > 0 ? limit : 0;
+    session->evictthreshold = session->positionlimit;
+    evictpositions(session, NULL);
+    return oldvalue;
+}
+
+/* Update a position's visit time.
+ */
+void redo_visitposition(redo_session *session, redo_position *position)
+{
+    visitposition(session, position);
+}
+
+/* Change a position's protection from eviction.
+ */
+void redo_keepposition(redo_session *session, redo_position *position,
+                       int keep)
+{
+    if (position->keep != (keep ? 1 : 0)) {
+        touchmap(session);
+        position->keep = keep ? 1 : 0;
+    }
+}
+
+/* Change the function notified of evicted positions.
+ */
+redo_evictfunction *redo_setevictfunction(redo_session *session,
+                                          redo_evictfunction *evictfunction)
+{
+    redo_evictfunction *oldvalue;
+
+    oldvalue = session->evictfunction;
+    session->evictfunction = evictfunction;
+    return oldvalue;
+}
+
+/* Change the session's hash function, and recompute the hash values
+ * of the existing positions.
+ */
+redo_hashfunction *redo_sethashfunction(redo_session *session,
+                                        redo_hashfunction *hashfunction)
+{
+    redo_hashfunction *oldvalue;
+
+    oldvalue = session->hashfunction;
+    if (!hashfunction)
+        hashfunction = getdefaulthashfunction();
+    if (hashfunction != oldvalue) {
+        touchmap(session);
+        session->hashfunction = hashfunction;
+        rehashpositions(session);
+        recalchashtable(session);
+        invalidatepath(session);
+    }
+    return oldvalue;
+}
+
 /* Return the session's root position.
  */
 redo_position *redo_getfirstposition(redo_session const *session)
@@ -607,114 +2407,78 @@ void const *redo_getsavedstate(redo_position const *position)
 void redo_updatesavedstate(redo_session const *session,
                            redo_position *position, void const *state)
 {
+    touchmap(session);
     saveextrastatedata(session, position, state);
 }
 
-/* Return the redo_branch for the branch originating at this position
- * and labelled with this move. NULL is returned if there is no such
- * branch in the session. If the branch is found, it is automatically
- * moved to the head of the next list.
+/* Return the position that the branch originating at this position
+ * and labelled with this move leads to. NULL is returned if there is
+ * no such branch in the session. If the branch is found, it is
+ * automatically moved to the front of the next array.
  */
 redo_position *redo_getnextposition(redo_position *position, int move)
 {
-    redo_branch *branch, *cdr;
+    redo_branch branch;
+    int i;
 
-    if (!position->next)
-        return NULL;
-    if (position->next->move == move)
-        return position->next->p;
-    for (branch = position->next ; branch->cdr ; branch = branch->cdr) {
-        if (branch->cdr->move == move) {
-            cdr = branch->cdr;
-            branch->cdr = branch->cdr->cdr;
-            cdr->cdr = position->next;
-            position->next = cdr;
-            return cdr->p;
+    for (i = 0 ; i < (int)position->nextcount ; ++i) {
+        if (position->next[i].move == move) {
+            if (i) {
+                branch = position->next[i];
+                memmove(position->next + 1, position->next,
+                        i * sizeof branch);
+                position->next[0] = branch;
+            }
+            return position->next->p;
         }
     }
     return NULL;
 }
 
-/* Add a new node to the session, leading from prev via move. If such
- * a node already exists, it is returned; otherwise, the node is
- * created, fully initialized, and returned. In the latter case, the
- * state data is stored with the new position. If checkequiv's value
- * is redo_check, then the function will check for equivalent nodes in
- * the session. If one is found, the better field will be intialized
- * to point to it, or, if the new node is actually the other node's
- * better, grafting behavior with be applied.
+/* Return the position that the branch originating at this position
+ * and labelled with this move leads to, without altering the order of
+ * the branches.
+ */
+redo_position *redo_findnextposition(redo_position const *position, int move)
+{
+    int i;
+
+    for (i = 0 ; i < (int)position->nextcount ; ++i)
+        if (position->next[i].move == move)
+            return position->next[i].p;
+    return NULL;
+}
+
+/* Add a new node to the session, leading from prev via move, as
+ * with addposition(), and then remove positions if the session is
+ * over its limit.
  */
 redo_position *redo_addposition(redo_session *session,
                                 redo_position *prev, int move,
                                 void const *state, int endpoint,
                                 int checkequiv)
 {
-    redo_position *position, *equiv, *p;
-    redo_branch *branch;
-    unsigned short size;
-
-    if (prev) {
-        position = redo_getnextposition(prev, move);
-        if (position)
-            return position;
-    }
-
-    if (checkequiv == redo_check && endpoint == 0)
-        equiv = checkforequiv(session, state);
-    else
-        equiv = NULL;
-
-    position = getpositionstruct(session, state, endpoint);
-    if (!position)
-        return NULL;
-    if (prev) {
-        branch = insertmoveto(session, prev, position, move);
-        if (!branch) {
-            droppositionstruct(session, position);
-            return NULL;
-        }
-    }
-    sethashentry(session, position->hashvalue);
+    redo_position *position;
 
-    position->better = NULL;
-    position->setbetter = checkequiv == redo_checklater;
-    position->prev = prev;
-    position->next = NULL;
-    position->nextcount = 0;
+    position = addposition(session, prev, move, state, endpoint, checkequiv);
+    if (position)
+        evictpositions(session, position);
+    return position;
+}
 
-    position->movecount = prev ? prev->movecount + 1 : 0;
-    if (endpoint) {
-        size = position->movecount;
-        position->solutionend = endpoint;
-        position->solutionsize = size;
-        for (p = position->prev ; p ; p = p->prev) {
-            if (isimprovedsolution(p, endpoint, size)) {
-                p->solutionend = endpoint;
-                p->solutionsize = size;
-            }
-        }
-    } else {
-        position->solutionend = 0;
-        position->solutionsize = 0;
-    }
-
-    if (equiv) {
-        if (position->movecount >= equiv->movecount) {
-            position->better = equiv;
-        } else {
-            equiv->better = position;
-            if (session->grafting == redo_copypath) {
-                redo_duplicatepath(session, position, equiv);
-            } else if (session->grafting != redo_nograft) {
-                graftbranch(position, equiv);
-                recalcsolutionsize(equiv);
-                if (session->grafting == redo_graftandcopy)
-                    redo_duplicatepath(session, equiv, position);
-            }
-        }
-    }
+/* Add a sequence of positions to the session, as with addpath(), and
+ * then remove positions if the session is over its limit.
+ */
+redo_position *redo_addpath(redo_session *session, redo_position *from,
+                            int const *moves, void const *states,
+                            int const *endpoints, int count, int checkequiv)
+{
+    redo_position *position;
 
-    session->changeflag = 1;
+    position = addpath(session, from, moves, states, endpoints, count,
+                       checkequiv);
+    if (position)
+        evictpositions(session, position);
     return position;
 }
 
@@ -726,20 +2490,15 @@ redo_position *redo_dropposition(redo_session *session,
                                  redo_position *position)
 {
     redo_position *prev;
-    redo_position *better, *pos;
 
     if (!position->prev || position->next)
         return position;
     prev = position->prev;
+    touchmap(session);
     if (!dropmoveto(session, prev, position))
         return position;
 
-    better = position->better;
-    for (pos = session->parray ; pos ; pos = pos->prev)
-        for ( ; pos->inarray ; pos = incpos(session, pos))
-            if (pos->inuse && pos->better == position)
-                pos->better = better;
-
+    replacebetter(session, position);
     droppositionstruct(session, position);
     recalcsolutionsize(prev);
     recalchashtable(session);
@@ -750,13 +2509,34 @@ redo_position *redo_dropposition(redo_session *session,
 /* Check that the given state isn't a revisiting of a state already
  * seen in the given move path. If it is, change *pposition to the
  * earlier position. If the intermediate steps are a single line and
- * within the length of prunelimit, then they are dropped.
+ * within the length of prunelimit, then they are dropped. The search
+ * uses the session's cached path, so the cost is independent of the
+ * path's length as long as successive calls stay close to each other
+ * in the tree.
  */
 int redo_suppresscycle(redo_session *session, redo_position **pposition,
                        void const *state, int prunelimit)
 {
     redo_position *p;
-    int n;
+    unsigned int hashvalue;
+    int i, n;
+
+    if (syncpath(session, *pposition)) {
+        hashvalue = gethashvalue(session, state);
+        i = session->pathbuckets[hashvalue % pathbucketcount];
+        for ( ; i >= 0 ; i = session->path[i].link) {
+            p = session->path[i].position;
+            if (p->hashvalue != hashvalue ||
+                        !comparestatedata(session, p, state))
+                continue;
+            n = session->pathcount - 1 - i;
+            if (n < prunelimit)
+                prunebranch(session, *pposition, p);
+            *pposition = p;
+            return 1;
+        }
+        return 0;
+    }
 
     for (p = *pposition, n = 0 ; p ; p = p->prev, ++n) {
         if (comparestatedata(session, p, state)) {
@@ -769,70 +2549,352 @@ int redo_suppresscycle(redo_session *session, redo_position **pposition,
     return 0;
 }
 
+/* Return the branch of a position that leads towards its best
+ * solution, or NULL if it has none.
+ */
+static redo_branch const *getsolutionbranch(redo_position const *position)
+{
+    int i;
+
+    if (!position->solutionend)
+        return NULL;
+    for (i = 0 ; i < (int)position->nextcount ; ++i)
+        if (position->next[i].p->solutionend == position->solutionend &&
+                position->next[i].p->solutionsize == position->solutionsize)
+            return position->next + i;
+    return NULL;
+}
+
 /* Find the path of the best solution emanating from src and make a
- * copy of it rooted at dest.
+ * copy of it rooted at dest. The path is added with a single call to
+ * addpath(), after which the positions of the copy are linked to
+ * their counterparts along the original.
  */
 int redo_duplicatepath(redo_session *session,
                        redo_position *dest, redo_position const *src)
 {
-    redo_branch *branch;
+    redo_branch const *branch;
+    redo_position const *pos;
     redo_position *next;
+    char *states;
+    int *moves, *endpoints;
+    int count, i;
 
     if (!src->solutionend)
         return 0;
 
-    while (src && src->solutionend) {
-        for (branch = src->next ; branch ; branch = branch->cdr)
-            if (branch->p && branch->p->solutionend == src->solutionend
-                          && branch->p->solutionsize == src->solutionsize)
-                break;
-        if (!branch)
-            break;
-        next = redo_addposition(session, dest, branch->move,
-                                getstatedata(branch->p),
-                                branch->p->endpoint, 0);
-        if (!next)
-            return 0;
-        if (!dest->better && dest->movecount >= src->movecount)
+    count = 0;
+    for (pos = src ; (branch = getsolutionbranch(pos)) ; pos = branch->p)
+        ++count;
+    if (!count)
+        return 1;
+    moves = malloc(2 * count * sizeof *moves);
+    states = malloc(count * session->statesize);
+    if (!moves || !states) {
+        free(moves);
+        free(states);
+        return 0;
+    }
+    endpoints = moves + count;
+    i = 0;
+    for (pos = src ; (branch = getsolutionbranch(pos)) ; pos = branch->p) {
+        moves[i] = branch->move;
+        endpoints[i] = branch->p->endpoint;
+        memcpy(states + i * session->statesize, getstatedata(branch->p),
+               session->statesize);
+        ++i;
+    }
+    next = addpath(session, dest, moves, states, endpoints, count,
+                   redo_nocheck);
+    free(states);
+
+    for (i = 0 ; i < count && dest ; ++i) {
+        if (!dest->better && dest->movecount >= src->movecount) {
             dest->better = src->better ? src->better : (redo_position*)src;
-        src = branch->p;
-        dest = next;
+            ++session->generation;
+        }
+        src = getsolutionbranch(src)->p;
+        dest = redo_findnextposition(dest, moves[i]);
     }
-    return 1;
+    free(moves);
+    return next != NULL;
+}
+
+/* Walk the tree of src, adding each of its positions to dest. The
+ * work stack holds pairs of corresponding positions in the two
+ * sessions whose branches have yet to be merged. The branches are
+ * visited in reverse order so that new branches in dest end up in the
+ * same order that they have in src. Equivalent positions are found
+ * with a merge index of dest, to which each new position is added.
+ */
+int redo_mergesession(redo_session *dest, redo_session const *src)
+{
+    struct { redo_position const *from; redo_position *to; } *stack, *s;
+    redo_position const *from;
+    redo_position *to, *pos, *equiv;
+    redo_branch const *branch;
+    mergeindex index;
+    void const *state;
+    unsigned int startcount;
+    int count, size, i;
+
+    if (dest->statesize != src->statesize || dest->cmpsize != src->cmpsize)
+        return -1;
+    if (!comparestatedata(dest, dest->root, getstatedata(src->root)))
+        return -1;
+
+    startcount = dest->positioncount;
+    if (!buildmergeindex(dest, &index, src->positioncount))
+        return -1;
+    size = 256;
+    stack = malloc(size * sizeof *stack);
+    if (!stack) {
+        free(index.slots);
+        return -1;
+    }
+    stack[0].from = src->root;
+    stack[0].to = dest->root;
+    count = 1;
+    while (count) {
+        --count;
+        from = stack[count].from;
+        to = stack[count].to;
+        if (dest->grafting == redo_graft ||
+                        dest->grafting == redo_graftandcopy)
+            while (to->better)
+                to = to->better;
+        for (i = (int)from->nextcount - 1 ; i >= 0 ; --i) {
+            branch = from->next + i;
+            state = getstatedata(branch->p);
+            pos = redo_getnextposition(to, branch->move);
+            if (pos) {
+                visitposition(dest, pos);
+            } else {
+                equiv = NULL;
+                if (!branch->p->endpoint)
+                    equiv = findmergeequiv(dest, &index, state);
+                pos = addposition(dest, to, branch->move, state,
+                                  branch->p->endpoint, redo_nocheck);
+                if (pos) {
+                    if (equiv)
+                        linkequiv(dest, pos, equiv);
+                    addtomergeindex(&index, pos);
+                }
+            }
+            if (!pos) {
+                free(stack);
+                free(index.slots);
+                return -1;
+            }
+            if (count == size) {
+                size *= 2;
+                s = realloc(stack, size * sizeof *stack);
+                if (!s) {
+                    free(stack);
+                    free(index.slots);
+                    return -1;
+                }
+                stack = s;
+            }
+            stack[count].from = branch->p;
+            stack[count].to = pos;
+            ++count;
+        }
+    }
+    free(stack);
+    free(index.slots);
+    count = (int)(dest->positioncount - startcount);
+    evictpositions(dest, NULL);
+    return count;
+}
+
+/* Return the size of the session's solution index.
+ */
+int redo_getsolutioncount(redo_session const *session)
+{
+    if (session->solutionorder == solutionsstale)
+        return -1;
+    return session->solutioncount;
+}
+
+/* Copy the first k entries of the session's solution index.
+ */
+int redo_getbestsolutions(redo_session const *session, int k,
+                          redo_position **out)
+{
+    if (session->solutionorder == solutionsstale)
+        return -1;
+    if (k > session->solutioncount)
+        k = session->solutioncount;
+    if (k > 0)
+        memcpy(out, session->solutions, k * sizeof *out);
+    return k < 0 ? 0 : k;
+}
+
+/* Return one entry of the session's solution index.
+ */
+redo_position *redo_getsolution(redo_session const *session, int index)
+{
+    if (session->solutionorder == solutionsstale)
+        return NULL;
+    if (index < 0 || index >= session->solutioncount)
+        return NULL;
+    return session->solutions[index];
+}
+
+/* Return the index of a position in the list made by
+ * redo_findshortestsolution(), using the list's open-addressed table
+ * of indexes. The position must be in the list.
+ */
+static int getlistindex(redo_position *const *list, int const *table,
+                        int mask, redo_position const *position)
+{
+    int i;
+
+    i = (int)((((size_t)position >> 4) * 2654435761U) & (size_t)mask);
+    while (list[table[i]] != position)
+        i = (i + 1) & mask;
+    return table[i];
+}
+
+/* Search the graph that is implied by the session's tree, in which
+ * all the positions that are connected by better fields are merged
+ * into a single node. Since every move counts equally, a
+ * breadth-first search suffices. Each node is represented by the
+ * position at the end of its better chain, and the positions of each
+ * node are kept in a linked list, so that the branches of all of them
+ * can be followed when the node is reached. The first node reached
+ * for each endpoint value is the nearest one with that value.
+ */
+int redo_findshortestsolution(redo_session const *session,
+                              redo_position const *from,
+                              int *moves, int size)
+{
+    redo_position **list;
+    redo_position *pos;
+    poschunk *chunk;
+    int *table, *node, *members, *link, *dist, *parent, *via, *queue;
+    int count, mask, head, tail, best, bestend, r, t, i, n;
+
+    for (n = 16 ; n < 2 * (int)session->positioncount ; n *= 2) ;
+    mask = n - 1;
+    count = session->positioncount;
+    list = malloc(count * sizeof *list);
+    table = malloc((n + 7 * count) * sizeof *table);
+    if (!list || !table) {
+        free(list);
+        free(table);
+        return -1;
+    }
+    node = table + n;
+    members = node + count;
+    link = members + count;
+    dist = link + count;
+    parent = dist + count;
+    via = parent + count;
+    queue = via + count;
+
+    for (i = 0 ; i < n ; ++i)
+        table[i] = -1;
+    i = 0;
+    foreachposition(session, chunk, pos, r) {
+        if (!pos->inuse)
+            continue;
+        list[i] = pos;
+        t = (int)((((size_t)pos >> 4) * 2654435761U) & (size_t)mask);
+        while (table[t] >= 0)
+            t = (t + 1) & mask;
+        table[t] = i;
+        members[i] = -1;
+        dist[i] = -1;
+        ++i;
+    }
+    for (i = 0 ; i < count ; ++i) {
+        for (pos = list[i] ; pos->better ; pos = pos->better) ;
+        r = getlistindex(list, table, mask, pos);
+        node[i] = r;
+        link[i] = members[r];
+        members[r] = i;
+    }
+
+    r = node[getlistindex(list, table, mask, from)];
+    dist[r] = 0;
+    queue[0] = r;
+    head = 0;
+    tail = 1;
+    best = -1;
+    bestend = 0;
+    while (head < tail) {
+        r = queue[head++];
+        for (i = members[r] ; i >= 0 ; i = link[i]) {
+            pos = list[i];
+            if (pos->endpoint && (best < 0 || (int)pos->endpoint > bestend)) {
+                best = r;
+                bestend = pos->endpoint;
+            }
+            for (n = 0 ; n < (int)pos->nextcount ; ++n) {
+                t = node[getlistindex(list, table, mask, pos->next[n].p)];
+                if (dist[t] >= 0)
+                    continue;
+                dist[t] = dist[r] + 1;
+                parent[t] = r;
+                via[t] = pos->next[n].move;
+                queue[tail++] = t;
+            }
+        }
+    }
+
+    n = best < 0 ? 0 : dist[best];
+    if (moves)
+        for (t = best ; n && dist[t] > 0 ; t = parent[t])
+            if (dist[t] <= size)
+                moves[dist[t] - 1] = via[t];
+    free(table);
+    free(list);
+    return n;
 }
 
 /* Find all positions with setbetter flagged and initialize their
  * better field.
  */
-int redo_setbetterfields(redo_session const *session)
+int redo_setbetterfields(redo_session *session)
 {
     redo_position *position, *other;
-    int count;
+    poschunk *chunk;
+    int count, i;
 
     count = 0;
-    for (position = session->parray ; position ; position = position->prev) {
-        for ( ; position->inarray ; position = incpos(session, position)) {
-            if (!position->inuse)
-                continue;
-            if (position->setbetter) {
-                other = checkforequiv(session, getstatedata(position));
-                position->better = other;
-                if (other)
-                    ++count;
-                if (other && other->movecount > position->movecount) {
-                    position->better = NULL;
-                    if (!other->better) {
-                        other->better = position;
-                        other->setbetter = 0;
-                    }
+    foreachposition(session, chunk, position, i) {
+        if (!position->inuse)
+            continue;
+        if (position->setbetter) {
+            touchmap(session);
+            other = checkforequiv(session, getstatedata(position));
+            position->better = other;
+            if (other) {
+                ++count;
+                ++session->generation;
+            }
+            if (other && other->movecount > position->movecount) {
+                position->better = NULL;
+                if (!other->better) {
+                    other->better = position;
+                    other->setbetter = 0;
                 }
-                position->setbetter = 0;
             }
+            position->setbetter = 0;
         }
     }
     return count;
 }
 
+/* Return the session's generation number.
+ */
+unsigned long redo_getsessiongeneration(redo_session const *session)
+{
+    return session->generation;
+}
+
 /* Return the change flag's current value.
  */
 int redo_hassessionchanged(redo_session const *session)
@@ -849,24 +2911,103 @@ int redo_clearsessionchanged(redo_session *session)
     return flag;
 }
 
-/* Free all memory associated with the session.
+/* Discard every position in the session and start over with a new
+ * root position. The allocated memory is retained for reuse.
+ */
+int redo_resetsession(redo_session *session, void const *initialstate)
+{
+    touchmap(session);
+    invalidatepath(session);
+    emptychunks(session);
+    emptyhashtable(session);
+    memset(&session->counters, 0, sizeof session->counters);
+    session->visitclock = 0;
+    session->evictthreshold = session->positionlimit;
+    session->root = addposition(session, NULL, 0, initialstate, 0, 0);
+    session->changeflag = 0;
+    return session->root != NULL;
+}
+
+/* Gather statistics on the session. The memory usage and the contents
+ * of the tree are measured afresh each time.
+ */
+void redo_getsessionstats(redo_session const *session,
+                          redo_sessionstats *stats)
+{
+    redo_position *pos;
+    poschunk *pchunk;
+    branchchunk *bchunk;
+    unsigned long n;
+    int i;
+
+    *stats = session->counters;
+    stats->positions = session->positioncount;
+    stats->branches = 0;
+    stats->maxdepth = 0;
+    foreachposition(session, pchunk, pos, i) {
+        if (!pos->inuse)
+            continue;
+        stats->branches += pos->nextcount;
+        if (stats->maxdepth < pos->movecount)
+            stats->maxdepth = pos->movecount;
+    }
+
+    n = 0;
+    for (pchunk = session->pchunks ; pchunk ; pchunk = pchunk->next)
+        ++n;
+    for (pchunk = session->pspare ; pchunk ; pchunk = pchunk->next)
+        ++n;
+    stats->freepositions = n * session->poschunksize - session->positioncount;
+    stats->positionbytes = n * (sizeof *pchunk + session->poschunksize *
+                                                 session->elementsize);
+    n = 0;
+    for (bchunk = session->bchunks ; bchunk ; bchunk = bchunk->next)
+        n += sizeof *bchunk + bchunk->size * sizeof(redo_branch);
+    for (bchunk = session->bspare ; bchunk ; bchunk = bchunk->next)
+        n += sizeof *bchunk + bchunk->size * sizeof(redo_branch);
+    stats->branchbytes = n;
+
+    stats->hashsize = 0;
+    stats->hashused = 0;
+    if (session->hashtable) {
+        stats->hashsize = hashtablebitsize;
+        for (i = 0 ; i < hashtablebitsize ; ++i)
+            if (session->hashtable[i / 8] & (1 << i % 8))
+                ++stats->hashused;
+    }
+}
+
+/* Free all memory associated with the session. A mapped session is
+ * flushed to its file first.
  */
 void redo_endsession(redo_session *session)
 {
-    redo_position *position, *p;
-    redo_branch *branch, *b;
+    poschunk *pchunk, *pnext;
+    branchchunk *bchunk, *bnext;
 
     if (!session)
         return;
-    for (position = session->parray ; position ; position = p) {
-        for (p = position ; p->inarray ; p = incpos(session, p)) ;
-        p = p->prev;
-        free(position);
+#ifdef REDO_MAPPED_FILES
+    if (session->map) {
+        syncmap(session);
+        closemap(session);
+        session->pchunks = session->pspare = NULL;
+        session->bchunks = session->bspare = NULL;
+    }
+#endif
+    emptychunks(session);
+    for (pchunk = session->pspare ; pchunk ; pchunk = pnext) {
+        pnext = pchunk->next;
+        free(pchunk);
     }
-    for (branch = session->barray ; branch ; branch = b) {
-        b = branch->cdr;
-        free(branch);
+    for (bchunk = session->bspare ; bchunk ; bchunk = bnext) {
+        bnext = bchunk->next;
+        free(bchunk);
     }
+    free(session->stack);
+    free(session->path);
+    free(session->pathbuckets);
+    free(session->solutions);
     free(session->hashtable);
     free(session);
 }
@@ -14,14 +14,32 @@
 extern "C" {
 #endif
 
-/* The library version: 0.9
+/* The library version: 1.0
  */
-#define REDO_LIBRARY_VERSION 0x0009
+#define REDO_LIBRARY_VERSION 0x0100
 
 /*
  * Types.
  */
 
+/* The type used to hold move counts. By default this is a 16-bit
+ * value, which keeps the position struct compact but limits a session
+ * to paths of at most 65535 moves, and a state size of at most ~63k.
+ * If REDO_WIDE_COUNTERS is defined, a 32-bit value is used instead,
+ * and the state size limit is raised to ~16M. (Since this changes the
+ * layout of the structs below, the same setting must be used both
+ * when building the library and when building code that uses it.)
+ */
+#ifdef REDO_WIDE_COUNTERS
+typedef unsigned int redo_count;
+#define REDO_COUNT_MAX 0xFFFFFFFFU
+#define REDO_STATESIZE_MAX 0xFFFFFF
+#else
+typedef unsigned short redo_count;
+#define REDO_COUNT_MAX 0xFFFFU
+#define REDO_STATESIZE_MAX 0xFFFF
+#endif
+
 /* The list of objects used by the library. redo_session is opaque;
  * the other two are defined here.
  */
@@ -29,30 +47,103 @@ typedef struct redo_session redo_session;
 typedef struct redo_position redo_position;
 typedef struct redo_branch redo_branch;
 
-/* The information associated with a visited state.
+/* The number of branches that are stored directly inside a position.
+ * Positions with more branches than this keep them in a separately
+ * allocated array instead.
+ */
+#define REDO_INLINE_BRANCHES 2
+
+/* A labeled branch in the tree of visited states.
+ */
+struct redo_branch {
+    redo_position *p;           /* the position that the move leads to */
+    int move;                   /* the move that this branch represents */
+};
+
+/* The information associated with a visited state. The next field
+ * points to an array of nextcount branches, ordered from the most
+ * recently used to the least, or is NULL if there are no branches.
  */
 struct redo_position {
     redo_position *prev;        /* position that points to this position */
-    redo_branch *next;          /* linked list of moves from this position */
+    redo_branch *next;          /* array of moves from this position */
     redo_position *better;      /* position equal to this one in fewer moves */
-    unsigned short movecount;   /* number of moves to reach this position */
-    unsigned short solutionsize; /* size of best solution from this position */
-    unsigned short nextcount;   /* number of moves in next list */
+    redo_count movecount;       /* number of moves to reach this position */
+    redo_count solutionsize;    /* size of best solution from this position */
+    redo_count nextcount;       /* number of moves in next array */
     signed char endpoint;       /* non-zero if this position is an endpoint */
     signed char solutionend;    /* endpoint for best solution from here */
-    unsigned int hashvalue:16;  /* internal: the state hash value */
+    unsigned int hashvalue;     /* internal: the state hash value */
     unsigned int setbetter:1;   /* internal: set by redo_checkequivlater */
     unsigned int inuse:1;       /* internal: false if not in the tree */
-    unsigned int inarray:1;     /* internal: false at the end of the array */
+    unsigned int spillclass:5;  /* internal: size of an external next array */
+    unsigned int keep:1;        /* internal: protected from eviction */
+    unsigned int lastvisit:24;  /* internal: when the position was visited */
+    redo_branch inlinenext[REDO_INLINE_BRANCHES];
+                                /* internal: storage for short next arrays */
 };
 
-/* A labeled branch in the tree of visited states.
+/* Statistics describing a session, as returned by
+ * redo_getsessionstats(). The lookup and graft counters accumulate
+ * from the time that the session was created or last reset; the other
+ * fields describe the session's current contents.
+ */
+typedef struct redo_sessionstats {
+    unsigned long positions;    /* positions currently in the tree */
+    unsigned long freepositions; /* allocated positions not in the tree */
+    unsigned long branches;     /* branches currently in the tree */
+    unsigned long positionbytes; /* memory allocated for positions */
+    unsigned long branchbytes;  /* memory allocated for external branches */
+    unsigned long hashsize;     /* hash table buckets, or zero if none */
+    unsigned long hashused;     /* hash table buckets currently occupied */
+    unsigned long lookups;      /* searches for an equivalent position */
+    unsigned long hashrejects;  /* lookups ruled out by the hash table */
+    unsigned long falsehits;    /* lookups passed by the table that failed */
+    unsigned long probes;       /* positions examined by lookups */
+    unsigned long comparisons;  /* full state comparisons made by lookups */
+    unsigned long grafts;       /* subtrees moved onto shorter paths */
+    unsigned long evictions;    /* positions removed to stay under the limit */
+    unsigned long maxdepth;     /* the largest move count in the tree */
+} redo_sessionstats;
+
+/* A function that computes a hash value for a state. size is the
+ * number of bytes in the state to be examined (i.e. the session's
+ * cmpsize). The function must return the same value for identical
+ * states, and should return different values for different states as
+ * often as possible.
+ */
+typedef unsigned int redo_hashfunction(void const *state, int size);
+
+/* A function that is notified of each position that is removed from
+ * a session to keep it under its position limit. It is called just
+ * before the position is removed, while its prev field and its
+ * parent's branch to it are still intact. The function must not
+ * change the session.
+ */
+typedef void redo_evictfunction(redo_position const *position);
+
+/*
+ * Thread safety.
+ *
+ * The library has no modifiable global state, and sessions share no
+ * data with each other, so separate sessions can be used freely and
+ * simultaneously by separate threads without any locking. A single
+ * session, on the other hand, does no locking of its own. Functions
+ * that change a session (including redo_getnextposition(), which
+ * reorders a position's branches, and redo_setbetterfields() and
+ * redo_suppresscycle(), which update internal bookkeeping) must not
+ * be called while any other thread is using the same session. When no
+ * such call is in progress, any number of threads may read a session
+ * at the same time, using redo_getfirstposition(),
+ * redo_getsessionsize(), redo_getsavedstate(),
+ * redo_findnextposition(), redo_hassessionchanged(),
+ * redo_getsessiongeneration(), redo_getsolutioncount(),
+ * redo_getbestsolutions(), redo_getsolution(),
+ * redo_findshortestsolution(), and redo_getsessionstats(), or by
+ * reading the fields of the position structs directly. It is up to
+ * the caller to provide a lock (such as a reader-writer lock) if
+ * readers and writers need to share a session.
  */
-struct redo_branch {
-    redo_branch *cdr;           /* a sibling branch */
-    redo_position *p;           /* the position that the move leads to */
-    int move;                   /* the move that this branch represents */
-};
 
 /*
  * Functions.
@@ -62,7 +153,8 @@ struct redo_branch {
  * buffer that contains the representation of the state of the
  * starting position, from which all other positions will descend.
  * size is the size of the state representation in bytes. It cannot be
- * larger than ~63k (and ideally should be as small as possible).
+ * larger than ~63k, or ~16M if the library is built with wide
+ * counters (and ideally should be as small as possible).
  * cmpsize is number of bytes in the state representation to actually
  * compare, or zero to use the entire state representation. NULL is
  * returned if the arguments are invalid, or if memory for the session
@@ -71,6 +163,58 @@ struct redo_branch {
 extern redo_session *redo_beginsession(void const *initialstate,
                                        int size, int cmpsize);
 
+/* Create and return a redo session whose positions are stored in a
+ * memory-mapped file, so that the session can be reopened later
+ * without recreating the positions one at a time. filename names the
+ * file, which is created if necessary. The other arguments are the
+ * same as for redo_beginsession(). If the file already holds a
+ * session with the same state sizes and an identical initial state,
+ * built by the same version of the library on the same system, then
+ * that session's positions are restored. Otherwise the file's
+ * contents are discarded, and the session starts out with just the
+ * root position. A file is also discarded if it was modified after
+ * its last checkpoint, i.e. if the program exited without calling
+ * redo_checkpointsession() or redo_endsession(). (Changes to the
+ * order of branches made by redo_getnextposition() alone do not count
+ * as modifications, and may or may not be preserved.) Only one
+ * process can have the file open at a time. NULL is returned if the
+ * file cannot be opened or mapped, or if the system does not support
+ * memory-mapped files.
+ */
+extern redo_session *redo_beginmappedsession(char const *filename,
+                                             void const *initialstate,
+                                             int size, int cmpsize);
+
+/* Flush all changes to a session created by redo_beginmappedsession()
+ * to its file, and mark the file as consistent. This function does
+ * nothing for other sessions. false is returned if the changes could
+ * not be written.
+ */
+extern int redo_checkpointsession(redo_session *session);
+
+/* The built-in hash functions. redo_hashcrc32c() computes a CRC32C,
+ * using the SSE4.2 instructions if the processor has them.
+ * redo_hashmix() is a fast 64-bit multiply-and-shift hash.
+ * redo_hashmeiyan() is the function used by earlier versions of the
+ * library, and only produces 16-bit values.
+ */
+extern unsigned int redo_hashcrc32c(void const *state, int size);
+extern unsigned int redo_hashmix(void const *state, int size);
+extern unsigned int redo_hashmeiyan(void const *state, int size);
+
+/* Change the function used to compute the hash values of the
+ * session's states. The hash values are used to avoid comparing
+ * states that cannot be identical, when searching for equivalent
+ * positions. hashfunction can be one of the built-in functions above,
+ * a function supplied by the program, or NULL to select the default.
+ * The default is redo_hashcrc32c() if the processor supports it
+ * directly, and redo_hashmix() otherwise. The hash values of the
+ * positions already in the session are recomputed. The return value
+ * is the previous hash function.
+ */
+extern redo_hashfunction *redo_sethashfunction(redo_session *session,
+                                            redo_hashfunction *hashfunction);
+
 /* Possible values for the grafting argument to redo_setgraftbehavior().
  */
 enum { redo_nograft = 0, redo_graft, redo_copypath, redo_graftandcopy };
@@ -90,6 +234,48 @@ enum { redo_nograft = 0, redo_graft, redo_copypath, redo_graftandcopy };
  */
 extern int redo_setgraftbehavior(redo_session *session, int grafting);
 
+/* Set a limit on the number of positions in the session, or remove
+ * the limit if limit is zero (the default). Whenever positions are
+ * added that take the session over its limit, the least recently
+ * visited positions are removed until the session is comfortably
+ * below the limit again. Only positions that are leaves of the tree
+ * are removed (though their parents may then become leaves in turn),
+ * and positions that lie on the path of a solution, or that have been
+ * protected with redo_keepposition(), are never removed. A position
+ * counts as visited when it is added or returned by
+ * redo_addposition() or redo_addpath(), or passed to
+ * redo_visitposition(). The caller must not retain pointers to
+ * positions that might be removed. The limit is applied immediately,
+ * and the return value is the previous limit.
+ */
+extern int redo_setpositionlimit(redo_session *session, int limit);
+
+/* Mark a position as having just been visited, so that it will be
+ * among the last to be removed when the session exceeds its position
+ * limit. A program should call this whenever it navigates to an
+ * existing position without going through redo_addposition().
+ */
+extern void redo_visitposition(redo_session *session,
+                               redo_position *position);
+
+/* Protect a position from being removed when the session exceeds its
+ * position limit, or remove the protection if keep is false. Since
+ * only leaves are removed, the position's ancestors are protected as
+ * well.
+ */
+extern void redo_keepposition(redo_session *session,
+                              redo_position *position, int keep);
+
+/* Set a function to be notified of the positions removed by the
+ * position limit, or NULL to stop the notifications (the default).
+ * This allows a program that keeps its own record of the session's
+ * contents to keep that record up to date. Positions are removed in
+ * an order in which each one is a leaf at the time it is removed. The
+ * return value is the previous function.
+ */
+extern redo_evictfunction *redo_setevictfunction(redo_session *session,
+                                            redo_evictfunction *evictfunction);
+
 /* Return the position for the initial state.
  */
 extern redo_position *redo_getfirstposition(redo_session const *session);
@@ -105,13 +291,24 @@ extern void const *redo_getsavedstate(redo_position const *position);
 
 /* Return the position reached by making move from the given position.
  * Calling this function causes the given move to become the most
- * recently used move for the first position. NULL is returned if the
- * move in question has not yet been added to the session.
+ * recently used move for the first position, moving it to the front
+ * of the position's next array. NULL is returned if the move in
+ * question has not yet been added to the session.
  */
 extern redo_position *redo_getnextposition(redo_position *position, int move);
 
+/* Return the position reached by making move from the given position,
+ * or NULL if the move has not been added to the session. Unlike
+ * redo_getnextposition(), this function does not alter the order of
+ * the position's branches, and so it can be used by threads that
+ * share a session for reading.
+ */
+extern redo_position *redo_findnextposition(redo_position const *position,
+                                            int move);
+
 
-/* Possible values for the checkequiv argument to redo_addposition().
+/* Possible values for the checkequiv argument to redo_addposition()
+ * and redo_addpath().
  */
 enum { redo_nocheck = 0, redo_check, redo_checklater };
 
@@ -129,13 +326,35 @@ enum { redo_nocheck = 0, redo_check, redo_checklater };
  * redo_checklater will delay this check until the next call to
  * redo_setbetterfields(). Finally, a value of redo_nocheck will
  * bypass this check entirely. NULL is returned if a new position
- * cannot be allocated.
+ * cannot be allocated, or if its move count would exceed the maximum
+ * value that can be stored in a redo_count.
  */
 extern redo_position *redo_addposition(redo_session *session,
                                        redo_position *prev, int move,
                                        void const *state, int endpoint,
                                        int checkequiv);
 
+/* Add a path of count positions to the session, starting at from. The
+ * ith position is reached by making moves[i] from the position
+ * before it. states points to a buffer holding the count states of
+ * the new positions, one after another. endpoints is an array giving
+ * the endpoint value for each position, or NULL if none of them are
+ * final states. checkequiv is applied as with redo_addposition(), but
+ * the states are compared with the session's positions in a single
+ * pass over the session, and the solution fields of the path's
+ * ancestors are updated once, after the path has been added. (Because
+ * of this, when a state has more than one match in the session, the
+ * position chosen may not be the same one that a sequence of calls to
+ * redo_addposition() would choose.) Positions along the path that
+ * already exist are reused. The return value is the final position
+ * of the path, or NULL if a position could not be added, in which
+ * case the positions before it remain in the session.
+ */
+extern redo_position *redo_addpath(redo_session *session,
+                                   redo_position *from, int const *moves,
+                                   void const *states, int const *endpoints,
+                                   int count, int checkequiv);
+
 /* Delete a position from the session. In order to be deleted, the
  * position must be a leaf node, i.e. it must not have any branches
  * emanating from it to other positions. Any better fields in the
@@ -170,6 +389,70 @@ extern int redo_suppresscycle(redo_session *session, redo_position **pposition,
 extern int redo_duplicatepath(redo_session *session,
                               redo_position *dest, redo_position const *src);
 
+/* Add every position in src to dest. Each path in src is followed
+ * from the root, reusing the positions in dest that are reached by
+ * the same moves, and adding the rest as if by redo_addposition()
+ * with redo_check (so that positions whose states are already present
+ * in dest are linked to them, or grafted, per dest's grafting
+ * behavior option). The two sessions must have the same state sizes
+ * and identical root states. src is not changed. The return value is
+ * the number of positions added to dest, or -1 if the sessions are
+ * incompatible or memory could not be allocated (in which case dest
+ * may have been partially updated).
+ */
+extern int redo_mergesession(redo_session *dest, redo_session const *src);
+
+/* Return the number of endpoint positions in the session, i.e. the
+ * number of distinct solutions that have been found, or -1 if memory
+ * could not be allocated to index them.
+ */
+extern int redo_getsolutioncount(redo_session const *session);
+
+/* Store pointers to the k best endpoint positions in the session in
+ * out, which must have room for k pointers. Solutions are ordered
+ * from best to worst, in the same sense as the solutionend and
+ * solutionsize fields: a higher endpoint value is better, and for
+ * equal endpoint values, fewer moves are better. The session keeps
+ * its endpoint positions in this order as they are added and moved,
+ * so this does not require a walk of the tree. The return value is
+ * the number of positions stored, which is less than k if the session
+ * has fewer solutions, or -1 if memory could not be allocated to
+ * index them.
+ */
+extern int redo_getbestsolutions(redo_session const *session, int k,
+                                 redo_position **out);
+
+/* Return the nth best endpoint position in the session, counting from
+ * zero, or NULL if there are not that many (or if memory could not
+ * be allocated to index them). Calling this function with increasing
+ * values of index, until NULL is returned, visits all of the
+ * solutions in order.
+ */
+extern redo_position *redo_getsolution(redo_session const *session,
+                                       int index);
+
+/* Find the shortest solution that can be reached from the given
+ * position using only moves that are already in the session. Unlike
+ * the solutionsize field, which only counts moves along the branches
+ * of the tree, this search treats positions that are linked by their
+ * better fields as being the same position, and so can find a
+ * solution that combines parts of several paths. As with the
+ * solutionend field, a solution with a higher endpoint value is
+ * preferred over a shorter one. If moves is not NULL, the moves of
+ * the solution are stored in it, up to a maximum of size moves. The
+ * return value is the number of moves in the solution, counted from
+ * the given position. Since solutionsize counts moves from the start
+ * of the game, a shorter solution has been assembled when the return
+ * value is less than the position's solutionsize minus its movecount.
+ * Zero is returned if no solution can be reached (or if the position
+ * is itself an endpoint), and -1 if memory could not be allocated.
+ * (This function examines every position in the session, and so is
+ * not intended to be called in time-critical code.)
+ */
+extern int redo_findshortestsolution(redo_session const *session,
+                                     redo_position const *from,
+                                     int *moves, int size);
+
 /* Update the "extra" state data for an existing position, after the
  * compared state data. If redo_beginsession() was called without
  * creating extra state data (i.e. with a non-zero cmpsize argument),
@@ -183,10 +466,21 @@ extern void redo_updatesavedstate(redo_session const *session,
  * their better fields re-initialized. (The purpose of this function
  * is to allow a serializer to omit the value of the better fields,
  * merely noting which ones have a non-NULL value. This function can
- * then recreate the values on deserialization.) The return value is
- * the number of better pointers that were set.
+ * then recreate the values on deserialization.) The positions are
+ * looked up in the same way as by redo_addposition(), and so the
+ * session's lookup counters are updated. The return value is the
+ * number of better pointers that were set.
  */
-extern int redo_setbetterfields(redo_session const *session);
+extern int redo_setbetterfields(redo_session *session);
+
+/* Return the session's generation number. This number is increased
+ * whenever a position's better field is set, or an endpoint position
+ * is added, and is never decreased (not even by redo_resetsession()).
+ * Since redo_findshortestsolution() can only find a shorter solution
+ * after such a change, a program can compare generation numbers to
+ * avoid repeating a search that cannot have a different result.
+ */
+extern unsigned long redo_getsessiongeneration(redo_session const *session);
 
 /* Return true if positions have been added to or removed from the
  * session since it was initialized, or since the last call to
@@ -198,7 +492,38 @@ extern int redo_hassessionchanged(redo_session const *session);
  */
 extern int redo_clearsessionchanged(redo_session *session);
 
-/* Delete the sesssion and free all associated memory.
+/* Discard every position in the session, leaving it as if it had
+ * just been created by redo_beginsession() with initialstate as the
+ * state of the new root position. The memory allocated for the
+ * discarded positions is kept and reused, so that a program which
+ * plays many games in succession can recycle one session instead of
+ * repeatedly creating and deleting them. Any position pointers
+ * obtained from the session prior to the reset become invalid. false
+ * is returned if the new root position could not be created.
+ *
+ * The session's settings are kept: the state and comparison sizes,
+ * the grafting behavior, the hash function, the position limit, the
+ * eviction function, and the backing file, if any. Everything that
+ * describes the old positions is cleared: the solution index, the
+ * cached path, the hash table, the statistics counters, the change
+ * flag, and the visit clock used to age the positions' lastvisit
+ * fields. (The generation number is the one exception, as described
+ * under redo_getsessiongeneration().)
+ */
+extern int redo_resetsession(redo_session *session, void const *initialstate);
+
+/* Fill in stats with information about the session's memory usage
+ * and the work that it has done. The hash table's false positive rate
+ * is falsehits / (lookups - hashrejects). (This function examines
+ * every position in the session, and so is not intended to be called
+ * in time-critical code.)
+ */
+extern void redo_getsessionstats(redo_session const *session,
+                                 redo_sessionstats *stats);
+
+/* Delete the sesssion and free all associated memory. A session
+ * created by redo_beginmappedsession() is checkpointed and its file
+ * closed.
  */
 extern void redo_endsession(redo_session *session);
 
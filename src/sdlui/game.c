@@ -96,6 +96,8 @@ static int keyguidesize;
 static gameplayinfo const *gameplay;    /* current game state */
 static redo_position const *position;   /* current redo position */
 static int bookmarkflag;                /* true if a bookmark exists */
+static int statsflag;                   /* true if stats should be shown */
+static redo_sessionstats stats;         /* current session statistics */
 
 /* Size of the user's most recent best answer for the current game. A
  * negative value indicates that this variable has not yet been
@@ -568,14 +570,15 @@ static void rendernavinfo(gameplayinfo const *gameplay,
     redo_branch const *branch;
     char buf[2];
     SDL_Rect rect;
-    int x, y, spacing;
+    int x, y, spacing, i;
 
     if (gameplay->locked & (1 << place))
         return;
 
     firstpos = NULL;
     secondpos = NULL;
-    for (branch = position->next ; branch ; branch = branch->cdr) {
+    for (i = 0 ; i < (int)position->nextcount ; ++i) {
+        branch = position->next + i;
         if (branch->move == cardtomoveid1(gameplay->cardat[place]))
             firstpos = branch->p;
         else if (branch->move == cardtomoveid2(gameplay->cardat[place]))
@@ -734,6 +737,41 @@ static void rendersidebar(void)
         renderimage(IMAGE_BOOKMARK, bookmark.x, bookmark.y);
 }
 
+/* Render the redo session's statistics as lines of text, placed in
+ * the bottom left corner of the tableau area.
+ */
+static void renderstats(void)
+{
+    char lines[9][64];
+    unsigned long n;
+    int lineheight, count, i, y;
+
+    count = 0;
+    sprintf(lines[count++], "positions: %lu (%lu free)",
+            stats.positions, stats.freepositions);
+    sprintf(lines[count++], "branches: %lu", stats.branches);
+    sprintf(lines[count++], "memory: %lu kB positions, %lu kB branches",
+            stats.positionbytes / 1024, stats.branchbytes / 1024);
+    if (stats.hashsize)
+        sprintf(lines[count++], "hash table: %lu of %lu buckets used",
+                stats.hashused, stats.hashsize);
+    n = stats.lookups - stats.hashrejects;
+    sprintf(lines[count++], "lookups: %lu (%lu%% false positives)",
+            stats.lookups, n ? 100 * stats.falsehits / n : 0);
+    sprintf(lines[count++], "probes: %lu (%lu comparisons)",
+            stats.probes, stats.comparisons);
+    sprintf(lines[count++], "grafts: %lu", stats.grafts);
+    sprintf(lines[count++], "evictions: %lu", stats.evictions);
+    sprintf(lines[count++], "max depth: %lu", stats.maxdepth);
+
+    lineheight = TTF_FontLineSkip(_graph.smallfont);
+    y = tableau.y + tableau.h - _graph.margin - count * lineheight;
+    settextcolor(_graph.dimmedcolor);
+    for (i = 0 ; i < count ; ++i, y += lineheight)
+        drawsmalltext(lines[i], tableau.x, y, +1);
+    settextcolor(_graph.defaultcolor);
+}
+
 /* Render the complete game display, back to front.
  */
 static void render(void)
@@ -746,6 +784,8 @@ static void render(void)
     if (keyschkbox.state & BSTATE_SELECT)
         renderkeyguides();
     rendersidebar();
+    if (statsflag)
+        renderstats();
     renderoverlays();
     if (optionsopen)
         renderoptions();
@@ -764,6 +804,7 @@ static command_t handlekeyevent(SDL_Keysym key)
 
     if (key.mod & KMOD_CTRL) {
         switch (key.sym) {
+          case SDLK_d:          return cmd_showstats;
           case SDLK_o:          return cmd_changesettings;
           case SDLK_y:          return cmd_redo;
           case SDLK_z:          return cmd_undo;
@@ -878,14 +919,19 @@ void resetgamedisplay(void)
         setoptionsdisplay(FALSE);
 }
 
-/* Store the latest parameters describing the game state.
+/* Store the latest parameters describing the game state. The session
+ * statistics, if present, are copied.
  */
 void updategamestate(gameplayinfo const *newgameplay,
-                     redo_position const *newposition, int newbookmarkflag)
+                     redo_position const *newposition, int newbookmarkflag,
+                     redo_sessionstats const *newstats)
 {
     gameplay = newgameplay;
     position = newposition;
     bookmarkflag = newbookmarkflag;
+    statsflag = newstats != NULL;
+    if (newstats)
+        stats = *newstats;
     if (prevbestanswersize < 0)
         prevbestanswersize = gameplay->bestanswersize;
 }
@@ -219,12 +219,14 @@ extern void resetgamedisplay(void);
 extern void showoptions(settingsinfo *settings, int display);
 
 /* Update the most recent game state. The arguments provide all the
- * information necessary to correctly render the game display. (This
+ * information necessary to correctly render the game display. stats
+ * is NULL if the session statistics are not to be displayed. (This
  * "side channel" is necessary because the render() displaymap
  * function takes no arguments.)
  */
 extern void updategamestate(gameplayinfo const *gameplay,
-                            redo_position const *position, int bookmark);
+                            redo_position const *position, int bookmark,
+                            redo_sessionstats const *stats);
 
 /*
  * Functions defined in help.c.
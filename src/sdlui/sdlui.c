@@ -156,6 +156,7 @@ static char const *gamecommandshelptext =
     "Redo all undone moves\tEnd\n"
     "Return to the previously viewed position\t" GLYPH_DASH "\n"
     "Display the options menu\tCtrl-O\n"
+    "Show or hide session statistics\tCtrl-D\n"
     "Display this help\t? or F1\n"
     "Quit and select a new layout\tQ or Esc\n"
     "Quit and exit the program\tShift-Q";
@@ -1109,7 +1110,8 @@ void stopanimation(animinfo *anim, int finish)
  */
 static void sdlui_rendergame(renderparams const *params)
 {
-    updategamestate(params->gameplay, params->position, params->bookmark);
+    updategamestate(params->gameplay, params->position, params->bookmark,
+                    params->stats);
     render();
 }
 
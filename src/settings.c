@@ -18,6 +18,7 @@
 #define DEFAULT_ANIMATION  1
 #define DEFAULT_AUTOPLAY  1
 #define DEFAULT_BRANCHING  0
+#define DEFAULT_POSITIONLIMIT  0
 #define DEFAULT_READONLY  0
 #define DEFAULT_FORCETEXTMODE  0
 
@@ -39,6 +40,7 @@ void initializesettings(void)
     settings->animation = -1;
     settings->autoplay = -1;
     settings->branching = -1;
+    settings->positionlimit = -1;
     settings->readonly = -1;
     settings->forcetextmode = -1;
 }
@@ -57,6 +59,8 @@ void setdefaultsettings(void)
         settings->autoplay = DEFAULT_AUTOPLAY;
     if (settings->branching < 0)
         settings->branching = DEFAULT_BRANCHING;
+    if (settings->positionlimit < 0)
+        settings->positionlimit = DEFAULT_POSITIONLIMIT;
     if (settings->readonly < 0)
         settings->readonly = DEFAULT_READONLY;
     if (settings->forcetextmode < 0)
@@ -88,6 +92,8 @@ void applysettings(int write)
         setautoplay(settings->autoplay);
     if (settings->branching >= 0)
         setbranching(settings->branching);
+    if (settings->positionlimit >= 0)
+        setpositionlimit(settings->positionlimit);
     if (settings->readonly >= 0)
         setreadonly(settings->readonly);
     if (write)
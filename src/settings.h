@@ -19,6 +19,7 @@ struct settingsinfo {
     int animation;              /* setting for animating card movements */
     int showkeys;               /* setting for displaying move key guides */
     int branching;              /* setting for enabling branching undo */
+    int positionlimit;          /* maximum redo session size, or zero */
     int forcetextmode;          /* true if the terminal UI should be used */
     int readonly;               /* true to prevent files from being changed */
 };
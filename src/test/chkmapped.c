@@ -0,0 +1,239 @@
+/* chkmapped.c: libredo testing code for memory-mapped sessions.
+ *
+ * Copyright (C) 2013 by Brian Raiter. This program is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "redo/redo.h"
+
+/* The size of the state data, and the number of positions along the
+ * main path of the test session.
+ */
+#define SIZE_STATE 24
+#define PATH_LENGTH 3000
+
+/* The name of the session's backing file.
+ */
+static char filename[] = "/tmp/chkmapped-XXXXXX";
+
+/* The state buffer.
+ */
+static char sbuf[SIZE_STATE];
+
+/* Set the state buffer to the state for the given number.
+ */
+static void *makestate(int n)
+{
+    memset(sbuf, '-', sizeof sbuf);
+    memcpy(sbuf, &n, sizeof n);
+    return sbuf;
+}
+
+/* Open the session file.
+ */
+static redo_session *opensession(void)
+{
+    redo_session *session;
+
+    session = redo_beginmappedsession(filename, makestate(0), SIZE_STATE, 0);
+    assert(session);
+    return session;
+}
+
+/* Add a long path to the session, with a side branch at every tenth
+ * position and a solution at the end.
+ */
+static void buildsession(redo_session *session)
+{
+    redo_position *pos, *side;
+    int i;
+
+    pos = redo_getfirstposition(session);
+    for (i = 1 ; i <= PATH_LENGTH ; ++i) {
+        pos = redo_addposition(session, pos, 'a', makestate(i),
+                               i == PATH_LENGTH, redo_check);
+        assert(pos);
+        if (i % 10 == 0) {
+            side = redo_addposition(session, pos, 'b', makestate(-i), 0,
+                                    redo_check);
+            assert(side);
+        }
+    }
+}
+
+/* Verify that the session contains what buildsession() added.
+ */
+static void checksession(redo_session *session)
+{
+    redo_position *pos, *side;
+    int n, i;
+
+    assert(redo_getsessionsize(session) ==
+                        1 + PATH_LENGTH + PATH_LENGTH / 10);
+    pos = redo_getfirstposition(session);
+    assert(pos->solutionsize == PATH_LENGTH);
+    for (i = 1 ; i <= PATH_LENGTH ; ++i) {
+        pos = redo_findnextposition(pos, 'a');
+        assert(pos);
+        assert(pos->movecount == i);
+        memcpy(&n, redo_getsavedstate(pos), sizeof n);
+        assert(n == i);
+        if (i % 10 == 0) {
+            side = redo_findnextposition(pos, 'b');
+            assert(side);
+            assert(side->prev == pos);
+            memcpy(&n, redo_getsavedstate(side), sizeof n);
+            assert(n == -i);
+        }
+    }
+    assert(pos->endpoint);
+}
+
+/* Run a function in a child process that exits without closing the
+ * session, as if the program had crashed.
+ */
+static void runandcrash(void (*f)(redo_session*))
+{
+    pid_t pid;
+    int status;
+
+    pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        f(opensession());
+        _exit(0);
+    }
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+/* Modify the session without making a checkpoint.
+ */
+static void modifysession(redo_session *session)
+{
+    redo_addposition(session, redo_getfirstposition(session), 'z',
+                     makestate(-1), 0, redo_check);
+}
+
+/* Modify the session and then make a checkpoint.
+ */
+static void checkpointsession(redo_session *session)
+{
+    modifysession(session);
+    assert(redo_checkpointsession(session));
+}
+
+/* Verify that sessions are restored from their backing files, and
+ * that files with inconsistent or incompatible contents are rejected.
+ */
+int chkmapped(void)
+{
+    redo_session *session;
+    redo_position *pos, *oldroot;
+    void *block;
+    long pagesize;
+    int fd, i;
+
+    fd = mkstemp(filename);
+    assert(fd >= 0);
+    close(fd);
+
+    /* Create a session in an empty file, and verify that it is
+     * restored when the file is reopened.
+     */
+
+    session = opensession();
+    assert(redo_getsessionsize(session) == 1);
+    buildsession(session);
+    checksession(session);
+    redo_sethashfunction(session, redo_hashmeiyan);
+    assert(redo_checkpointsession(session));
+    redo_endsession(session);
+
+    session = opensession();
+    checksession(session);
+    assert(redo_getsolutioncount(session) == 1);
+    assert(redo_getsolution(session, 0)->movecount == PATH_LENGTH);
+    oldroot = redo_getfirstposition(session);
+
+    /* Verify that equivalent positions are still found, after the
+     * hash values stored with a different hash function have been
+     * recomputed.
+     */
+
+    pos = oldroot;
+    for (i = 0 ; i < 100 ; ++i)
+        pos = redo_findnextposition(pos, 'a');
+    pos = redo_addposition(session, pos, 'c', makestate(50), 0, redo_check);
+    assert(pos);
+    assert(pos->better);
+    assert(pos->better->movecount == 50);
+    redo_dropposition(session, pos);
+    checksession(session);
+    redo_endsession(session);
+
+    /* Block the address range that the file was mapped into, so that
+     * the file is mapped at a different address and the session's
+     * pointers have to be adjusted.
+     */
+
+    pagesize = sysconf(_SC_PAGESIZE);
+    block = (void*)((unsigned long)oldroot & ~(unsigned long)(pagesize - 1));
+    block = mmap(block, pagesize, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS,
+                 -1, 0);
+    assert(block != MAP_FAILED);
+    session = opensession();
+    assert(redo_getfirstposition(session) != oldroot);
+    checksession(session);
+    redo_endsession(session);
+    munmap(block, pagesize);
+
+    /* A file that was modified without a checkpoint is discarded. */
+
+    runandcrash(modifysession);
+    session = opensession();
+    assert(redo_getsessionsize(session) == 1);
+    buildsession(session);
+    redo_endsession(session);
+
+    /* Changes made before a checkpoint survive a crash. */
+
+    runandcrash(checkpointsession);
+    session = opensession();
+    assert(redo_findnextposition(redo_getfirstposition(session), 'z'));
+    redo_dropposition(session,
+                      redo_findnextposition(redo_getfirstposition(session),
+                                            'z'));
+    checksession(session);
+    redo_endsession(session);
+
+    /* A file is discarded if the state size or the initial state does
+     * not match.
+     */
+
+    session = redo_beginmappedsession(filename, makestate(0),
+                                      SIZE_STATE, SIZE_STATE - 1);
+    assert(session);
+    assert(redo_getsessionsize(session) == 1);
+    redo_endsession(session);
+    session = opensession();
+    assert(redo_getsessionsize(session) == 1);
+    buildsession(session);
+    redo_endsession(session);
+    session = redo_beginmappedsession(filename, makestate(7), SIZE_STATE, 0);
+    assert(session);
+    assert(redo_getsessionsize(session) == 1);
+    redo_endsession(session);
+
+    unlink(filename);
+    return 0;
+}
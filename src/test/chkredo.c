@@ -689,6 +689,729 @@ static void test_endpoints(void)
     teardown();
 }
 
+/* Verify that a session can be reset and reused.
+ */
+static void test_reset(void)
+{
+    redo_position *pos, *first, *last;
+    int i;
+
+    setup();
+    memset(sbuf, '.', sizeof sbuf);
+
+    /* Fill more than one chunk's worth of positions. */
+
+    pos = rootpos;
+    for (i = 0 ; i < 3000 ; ++i) {
+        memcpy(sbuf, &i, sizeof i);
+        pos = redo_addposition(session, pos, 'a', sbuf, 0, redo_nocheck);
+        assert(pos);
+        if (i == 0)
+            first = pos;
+    }
+    last = pos;
+    sbuf[4] = 'E';
+    pos = redo_addposition(session, last, 'a', sbuf, 1, redo_nocheck);
+    assert(rootpos->solutionsize == 3001);
+    assert(redo_getsessionsize(session) == 3002);
+
+    /* Verify that the reset session contains only a new root. */
+
+    memset(sbuf, 'r', sizeof sbuf);
+    assert(redo_resetsession(session, sbuf));
+    rootpos = redo_getfirstposition(session);
+    assert(rootpos);
+    assert(rootpos->inuse);
+    assert(rootpos->prev == NULL);
+    assert(rootpos->next == NULL);
+    assert(rootpos->nextcount == 0);
+    assert(rootpos->movecount == 0);
+    assert(rootpos->solutionsize == 0);
+    assert(rootpos->solutionend == 0);
+    assert(!memcmp(redo_getsavedstate(rootpos), sbuf, SIZE_STATE));
+    assert(redo_getsessionsize(session) == 1);
+    assert(!redo_hassessionchanged(session));
+    assert(redo_getnextposition(rootpos, 'a') == NULL);
+
+    /* Verify that the old states are no longer seen as equivalent. */
+
+    memset(sbuf, '.', sizeof sbuf);
+    i = 0;
+    memcpy(sbuf, &i, sizeof i);
+    pos = redo_addposition(session, rootpos, 'b', sbuf, 0, redo_check);
+    assert(pos);
+    assert(pos->better == NULL);
+    assert(redo_getsessionsize(session) == 2);
+
+    /* Verify that the existing memory is reused. */
+
+    assert(pos == first);
+    for (i = 1 ; i < 3000 ; ++i) {
+        memcpy(sbuf, &i, sizeof i);
+        pos = redo_addposition(session, pos, 'a', sbuf, 0, redo_check);
+        assert(pos);
+        assert(pos->better == NULL);
+    }
+    assert(pos == last);
+    assert(redo_getsessionsize(session) == 3001);
+
+    teardown();
+}
+
+/* Verify that a path cannot grow past the maximum move count.
+ */
+static void test_limits(void)
+{
+    redo_position *pos;
+    unsigned int i;
+
+    setup();
+    memset(sbuf, '.', sizeof sbuf);
+    pos = rootpos;
+    for (i = 1 ; i <= REDO_COUNT_MAX ; ++i) {
+        memcpy(sbuf, &i, sizeof i);
+        pos = redo_addposition(session, pos, 'a', sbuf, 0, redo_nocheck);
+        assert(pos);
+    }
+    assert(pos->movecount == REDO_COUNT_MAX);
+    sbuf[4] = 'X';
+    assert(redo_addposition(session, pos, 'a', sbuf, 0, redo_nocheck) == NULL);
+    assert(redo_getsessionsize(session) == (int)REDO_COUNT_MAX + 1);
+    teardown();
+}
+
+/* Verify that cycles are found on long paths, and that the search
+ * follows the current position as it moves around the tree.
+ */
+static void test_cycles(void)
+{
+    redo_position *pos[1000];
+    redo_position *p, *q;
+    int i;
+
+    setup();
+    memset(sbuf, 'c', sizeof sbuf);
+    pos[0] = rootpos;
+    for (i = 1 ; i < 1000 ; ++i) {
+        memcpy(sbuf, &i, sizeof i);
+        pos[i] = redo_addposition(session, pos[i - 1], 'a', sbuf, 0,
+                                  redo_nocheck);
+        assert(pos[i]);
+    }
+
+    /* Find ancestors at various depths from the end of the path. */
+
+    i = 10;
+    memcpy(sbuf, &i, sizeof i);
+    p = pos[999];
+    assert(redo_suppresscycle(session, &p, sbuf, 0));
+    assert(p == pos[10]);
+    i = 500;
+    memcpy(sbuf, &i, sizeof i);
+    p = pos[990];
+    assert(redo_suppresscycle(session, &p, sbuf, 0));
+    assert(p == pos[500]);
+    i = 995;
+    memcpy(sbuf, &i, sizeof i);
+    p = pos[990];
+    assert(!redo_suppresscycle(session, &p, sbuf, 0));
+    assert(p == pos[990]);
+
+    /* Move to a side branch and check that positions on the original
+     * path below the branch point are no longer ancestors. Of two
+     * ancestors with the same state, the nearer one is found.
+     */
+
+    i = 150;
+    memcpy(sbuf, &i, sizeof i);
+    sbuf[4] = 'x';
+    p = redo_addposition(session, pos[200], 'b', sbuf, 0, redo_nocheck);
+    q = redo_addposition(session, p, 'a', sbuf, 0, redo_nocheck);
+    q = redo_addposition(session, q, 'a', sbuf, 0, redo_nocheck);
+    assert(q);
+    sbuf[4] = 'c';
+    i = 300;
+    memcpy(sbuf, &i, sizeof i);
+    assert(!redo_suppresscycle(session, &q, sbuf, 0));
+    i = 150;
+    memcpy(sbuf, &i, sizeof i);
+    assert(redo_suppresscycle(session, &q, sbuf, 0));
+    assert(q == pos[150]);
+    q = p->next[0].p->next[0].p;
+    sbuf[4] = 'x';
+    assert(redo_suppresscycle(session, &q, sbuf, 0));
+    assert(q->prev->prev == p);
+    sbuf[4] = 'c';
+
+    /* Verify that a pruned cycle is removed from the search. */
+
+    assert(redo_getsessionsize(session) == 1003);
+    i = 997;
+    memcpy(sbuf, &i, sizeof i);
+    p = pos[999];
+    assert(redo_suppresscycle(session, &p, sbuf, 5));
+    assert(p == pos[997]);
+    assert(redo_getsessionsize(session) == 1001);
+    i = 999;
+    memcpy(sbuf, &i, sizeof i);
+    assert(!redo_suppresscycle(session, &p, sbuf, 5));
+    q = redo_addposition(session, p, 'a', sbuf, 0, redo_nocheck);
+    assert(q);
+    i = 5;
+    memcpy(sbuf, &i, sizeof i);
+    assert(redo_suppresscycle(session, &q, sbuf, 0));
+    assert(q == pos[5]);
+
+    /* Verify that the search still works after a reset. */
+
+    memset(sbuf, 'c', sizeof sbuf);
+    assert(redo_resetsession(session, sbuf));
+    rootpos = redo_getfirstposition(session);
+    sbuf[0] = 'd';
+    p = redo_addposition(session, rootpos, 'a', sbuf, 0, redo_nocheck);
+    q = p;
+    assert(redo_suppresscycle(session, &q, sbuf, 0));
+    assert(q == p);
+    sbuf[0] = 'c';
+    assert(redo_suppresscycle(session, &q, sbuf, 0));
+    assert(q == rootpos);
+    teardown();
+}
+
+/* Add a position whose state consists of a single letter.
+ */
+static redo_position *addletter(redo_session *s, redo_position *prev,
+                                int move, int letter, int endpoint)
+{
+    memset(sbuf, 0, sizeof sbuf);
+    sbuf[0] = letter;
+    return redo_addposition(s, prev, move, sbuf, endpoint, redo_check);
+}
+
+/* Verify that merging one session into another reuses positions by
+ * move and by state.
+ */
+static void test_merge(void)
+{
+    redo_session *src;
+    redo_position *posA, *posB, *posX, *pos;
+
+    setup();
+    posA = addletter(session, rootpos, 'a', 'A', 0);
+    posB = addletter(session, posA, 'b', 'B', 0);
+    posX = addletter(session, posB, 'x', 'X', 0);
+    assert(posX);
+
+    memset(sbuf, 0, sizeof sbuf);
+    src = redo_beginsession(sbuf, SIZE_STATE, SIZE_CMPSTATE);
+    assert(src);
+    pos = addletter(src, redo_getfirstposition(src), 'a', 'A', 0);
+    assert(addletter(src, pos, 'c', 'C', 1));
+    pos = addletter(src, redo_getfirstposition(src), 'd', 'D', 0);
+    assert(addletter(src, pos, 'e', 'B', 0));
+
+    /* Only the positions new to the session are added. */
+
+    assert(redo_mergesession(session, src) == 3);
+    assert(redo_getsessionsize(session) == 7);
+    assert(posA->nextcount == 2);
+    assert(posA->next[0].move == 'c');
+    assert(posA->next[0].p->endpoint == 1);
+    assert(rootpos->solutionsize == 2);
+    pos = redo_findnextposition(rootpos, 'd');
+    assert(pos);
+    pos = redo_findnextposition(pos, 'e');
+    assert(pos);
+    assert(pos->better == posB);
+    assert(redo_mergesession(session, src) == 0);
+    assert(redo_getsessionsize(session) == 7);
+
+    /* A shorter path to a known state causes a graft. */
+
+    assert(redo_resetsession(src, redo_getsavedstate(rootpos)));
+    pos = addletter(src, redo_getfirstposition(src), 'g', 'B', 0);
+    assert(addletter(src, pos, 'h', 'H', 0));
+    assert(redo_mergesession(session, src) == 2);
+    pos = redo_findnextposition(rootpos, 'g');
+    assert(pos);
+    assert(posB->better == pos);
+    assert(pos->nextcount == 2);
+    assert(posX->prev == pos);
+    assert(posX->movecount == 2);
+    redo_endsession(src);
+
+    /* Sessions with different state sizes cannot be merged. */
+
+    memset(sbuf, 0, sizeof sbuf);
+    src = redo_beginsession(sbuf, SIZE_STATE, 0);
+    assert(redo_mergesession(session, src) == -1);
+    redo_endsession(src);
+    sbuf[0] = 'Z';
+    src = redo_beginsession(sbuf, SIZE_STATE, SIZE_CMPSTATE);
+    assert(redo_mergesession(session, src) == -1);
+    redo_endsession(src);
+    assert(redo_getsessionsize(session) == 9);
+    teardown();
+}
+
+/* Fill a buffer with a sequence of states, each consisting of a
+ * single letter.
+ */
+static void makeletterstates(char *buf, char const *letters)
+{
+    int i;
+
+    for (i = 0 ; letters[i] ; ++i) {
+        memset(buf + i * SIZE_STATE, 0, SIZE_STATE);
+        buf[i * SIZE_STATE] = letters[i];
+    }
+}
+
+/* Verify that adding a whole path at once reuses existing positions,
+ * links and grafts equivalent positions, and updates solutions.
+ */
+static void test_addpath(void)
+{
+    char states[5 * SIZE_STATE];
+    int moves[5], endpoints[5];
+    redo_position *posA, *posB, *posD, *pos;
+
+    setup();
+    posA = addletter(session, rootpos, 'a', 'A', 0);
+    posB = addletter(session, posA, 'b', 'B', 0);
+    assert(posB);
+
+    /* Existing positions along the path are reused. */
+
+    moves[0] = 'a'; moves[1] = 'b'; moves[2] = 'c';
+    moves[3] = 'd'; moves[4] = 'e';
+    makeletterstates(states, "ABCDE");
+    memset(endpoints, 0, sizeof endpoints);
+    endpoints[4] = 1;
+    pos = redo_addpath(session, rootpos, moves, states, endpoints, 5,
+                       redo_check);
+    assert(pos);
+    assert(pos->movecount == 5);
+    assert(pos->endpoint == 1);
+    assert(redo_getsessionsize(session) == 6);
+    assert(posB->nextcount == 1);
+    assert(rootpos->solutionend == 1 && rootpos->solutionsize == 5);
+    assert(posB->solutionend == 1 && posB->solutionsize == 5);
+    posD = pos->prev;
+    assert(posD->movecount == 4);
+
+    /* A shorter path to a known state causes a graft, and a better
+     * endpoint replaces the solution.
+     */
+
+    moves[0] = 'f'; moves[1] = 'g'; moves[2] = 'h';
+    makeletterstates(states, "DXY");
+    endpoints[2] = 2;
+    pos = redo_addpath(session, rootpos, moves, states, endpoints, 3,
+                       redo_check);
+    assert(pos);
+    assert(pos->movecount == 3);
+    assert(redo_getsessionsize(session) == 9);
+    assert(posD->better == pos->prev->prev);
+    assert(pos->prev->prev->nextcount == 2);
+    assert(rootpos->solutionend == 2 && rootpos->solutionsize == 3);
+    assert(posA->solutionend == 0);
+
+    /* States repeated within the path are linked to each other. */
+
+    moves[0] = 'p'; moves[1] = 'q';
+    makeletterstates(states, "PP");
+    pos = redo_addpath(session, rootpos, moves, states, NULL, 2, redo_check);
+    assert(pos);
+    assert(pos->better == pos->prev);
+
+    /* No links are made when checking is not requested. */
+
+    moves[0] = 'r'; moves[1] = 's';
+    makeletterstates(states, "AB");
+    pos = redo_addpath(session, rootpos, moves, states, NULL, 2,
+                       redo_nocheck);
+    assert(pos);
+    assert(!pos->better && !pos->prev->better);
+    assert(redo_getsessionsize(session) == 13);
+    teardown();
+}
+
+/* Verify that positions with more branches than can be stored inline
+ * keep their branches in the correct order.
+ */
+static void test_fanout(void)
+{
+    redo_position *pos[40];
+    redo_position *p, *q;
+    int i, j;
+
+    setup();
+    memset(sbuf, 'f', sizeof sbuf);
+
+    /* Add branches past the inline limit, newest first. */
+
+    for (i = 0 ; i < 40 ; ++i) {
+        sbuf[0] = i;
+        pos[i] = redo_addposition(session, rootpos, i, sbuf, 0, redo_check);
+        assert(pos[i]);
+        assert(rootpos->nextcount == i + 1);
+        for (j = 0 ; j <= i ; ++j) {
+            assert(rootpos->next[j].move == i - j);
+            assert(rootpos->next[j].p == pos[i - j]);
+        }
+    }
+    assert(rootpos->next != rootpos->inlinenext);
+
+    /* Verify that a redone move moves to the front. */
+
+    assert(redo_getnextposition(rootpos, 5) == pos[5]);
+    assert(rootpos->next[0].move == 5);
+    for (j = 1 ; j < 35 ; ++j)
+        assert(rootpos->next[j].move == 40 - j);
+    for ( ; j < 40 ; ++j)
+        assert(rootpos->next[j].move == 39 - j);
+    assert(redo_getnextposition(rootpos, 5) == pos[5]);
+    assert(rootpos->next[1].move == 39);
+
+    /* Drop the branches, verifying the order of the remainder. */
+
+    for (i = 0 ; i < 38 ; ++i) {
+        if (i == 5)
+            continue;
+        assert(redo_dropposition(session, pos[i]) == rootpos);
+        assert(rootpos->next[0].move == 5);
+        assert(rootpos->next[1].move == 39);
+        for (j = 2 ; j < rootpos->nextcount ; ++j)
+            assert(rootpos->next[j].move < rootpos->next[j - 1].move);
+    }
+    assert(rootpos->nextcount == 3);
+    assert(redo_dropposition(session, pos[38]) == rootpos);
+    assert(rootpos->nextcount == 2);
+    assert(rootpos->next == rootpos->inlinenext);
+    assert(rootpos->next[0].p == pos[5]);
+    assert(rootpos->next[1].p == pos[39]);
+    assert(redo_dropposition(session, pos[39]) == rootpos);
+    assert(redo_dropposition(session, pos[5]) == rootpos);
+    assert(rootpos->next == NULL);
+    assert(rootpos->nextcount == 0);
+    assert(redo_getsessionsize(session) == 1);
+
+    /* Graft a position whose branches are stored externally. */
+
+    memset(sbuf, 'g', sizeof sbuf);
+    p = redo_addposition(session, rootpos, 'a', sbuf, 0, redo_check);
+    sbuf[0] = 'S';
+    p = redo_addposition(session, p, 'b', sbuf, 0, redo_check);
+    for (i = 0 ; i < 10 ; ++i) {
+        sbuf[1] = i;
+        pos[i] = redo_addposition(session, p, i, sbuf, 0, redo_check);
+        assert(pos[i]);
+    }
+    assert(p->nextcount == 10);
+    assert(redo_getnextposition(p, 3) == pos[3]);
+    sbuf[1] = 'g';
+    q = redo_addposition(session, rootpos, 'c', sbuf, 0, redo_check);
+    assert(q);
+    assert(p->better == q);
+    assert(p->next == NULL);
+    assert(p->nextcount == 0);
+    assert(q->nextcount == 10);
+    assert(q->next[0].p == pos[3]);
+    for (i = 0 ; i < 10 ; ++i) {
+        assert(pos[i]->prev == q);
+        assert(pos[i]->movecount == 2);
+    }
+
+    teardown();
+}
+
+/* Verify that the solution index lists the endpoints in order, and
+ * follows changes to the tree.
+ */
+static void test_solutions(void)
+{
+    redo_position *out[4];
+    redo_position *posA, *posB, *pos1, *pos2, *pos3;
+
+    setup();
+    assert(redo_getsolutioncount(session) == 0);
+    assert(redo_getsolution(session, 0) == NULL);
+    posA = addletter(session, rootpos, 'a', 'A', 0);
+    posB = addletter(session, posA, 'b', 'B', 0);
+    pos1 = addletter(session, posB, 'x', 'X', 1);
+    pos2 = addletter(session, posA, 'y', 'Y', 1);
+    pos3 = addletter(session, posB, 'z', 'Z', 2);
+    assert(pos1 && pos2 && pos3);
+
+    assert(redo_getsolutioncount(session) == 3);
+    assert(redo_getbestsolutions(session, 2, out) == 2);
+    assert(out[0] == pos3 && out[1] == pos2);
+    assert(redo_getbestsolutions(session, 4, out) == 3);
+    assert(out[2] == pos1);
+    assert(redo_getsolution(session, 0) == pos3);
+    assert(redo_getsolution(session, 2) == pos1);
+    assert(redo_getsolution(session, 3) == NULL);
+
+    /* A graft shortens two of the solutions. */
+
+    assert(addletter(session, rootpos, 'g', 'B', 0));
+    assert(pos1->movecount == 2 && pos3->movecount == 2);
+    assert(redo_getsolution(session, 0) == pos3);
+    assert(redo_getsolutioncount(session) == 3);
+
+    /* Dropped and reset positions are removed. */
+
+    assert(redo_dropposition(session, pos3) != pos3);
+    assert(redo_getsolutioncount(session) == 2);
+    assert(redo_getsolution(session, 0)->endpoint == 1);
+    assert(redo_getsolution(session, 1)->endpoint == 1);
+    memset(sbuf, 0, sizeof sbuf);
+    assert(redo_resetsession(session, sbuf));
+    assert(redo_getsolutioncount(session) == 0);
+    teardown();
+}
+
+/* Verify that the shortest-solution search combines paths that meet
+ * at equivalent positions, and prefers higher endpoint values.
+ */
+static void test_shortest(void)
+{
+    redo_position *posA, *posB, *posC, *posD, *posX, *posY, *pos;
+    unsigned long generation;
+    int moves[8];
+
+    setup();
+    redo_setgraftbehavior(session, redo_nograft);
+    generation = redo_getsessiongeneration(session);
+    assert(redo_findshortestsolution(session, rootpos, moves, 8) == 0);
+    posA = addletter(session, rootpos, 'a', 'A', 0);
+    posB = addletter(session, posA, 'b', 'B', 0);
+    posC = addletter(session, posB, 'c', 'C', 0);
+    assert(redo_getsessiongeneration(session) == generation);
+    posD = addletter(session, posC, 'd', 'D', 1);
+    assert(posD);
+    assert(redo_getsessiongeneration(session) == generation + 1);
+    assert(rootpos->solutionsize == 4);
+    assert(redo_findshortestsolution(session, rootpos, moves, 8) == 4);
+    assert(moves[0] == 'a' && moves[1] == 'b' && moves[2] == 'c');
+    assert(moves[3] == 'd');
+
+    /* A shorter path to C makes a shorter solution available, though
+     * the tree itself still only has the original one.
+     */
+
+    posX = addletter(session, rootpos, 'x', 'X', 0);
+    assert(redo_getsessiongeneration(session) == generation + 1);
+    posY = addletter(session, posX, 'y', 'C', 0);
+    assert(posY && posY->nextcount == 0);
+    assert(posC->better == posY);
+    assert(redo_getsessiongeneration(session) == generation + 2);
+    assert(rootpos->solutionsize == 4);
+    assert(redo_findshortestsolution(session, rootpos, moves, 8) == 3);
+    assert(moves[0] == 'x' && moves[1] == 'y' && moves[2] == 'd');
+    assert(redo_findshortestsolution(session, rootpos, NULL, 0) == 3);
+    assert(redo_findshortestsolution(session, posY, moves, 8) == 1);
+    assert(moves[0] == 'd');
+    moves[1] = 0;
+    assert(redo_findshortestsolution(session, rootpos, moves, 1) == 3);
+    assert(moves[0] == 'x' && moves[1] == 0);
+
+    /* A longer solution with a higher endpoint value is preferred. */
+
+    pos = addletter(session, posD, 'e', 'E', 0);
+    pos = addletter(session, pos, 'f', 'F', 2);
+    assert(pos);
+    assert(redo_findshortestsolution(session, rootpos, moves, 8) == 5);
+    assert(moves[0] == 'x' && moves[3] == 'e' && moves[4] == 'f');
+    assert(redo_findshortestsolution(session, pos, moves, 8) == 0);
+    teardown();
+}
+
+/* The number of positions passed to countevicted().
+ */
+static int evictedcount;
+
+/* An eviction function that checks that the position is still an
+ * intact leaf, and counts it.
+ */
+static void countevicted(redo_position const *position)
+{
+    int i;
+
+    assert(position->prev && !position->next);
+    for (i = 0 ; position->prev->next[i].p != position ; ++i)
+        assert(i + 1 < (int)position->prev->nextcount);
+    ++evictedcount;
+}
+
+/* Verify that a session with a position limit removes the least
+ * recently visited leaves, and leaves solutions and protected
+ * positions alone, and that each removal is reported.
+ */
+static void test_eviction(void)
+{
+    redo_sessionstats stats;
+    redo_position *path[11];
+    redo_position *side[20];
+    int i;
+
+    setup();
+    path[0] = rootpos;
+    for (i = 1 ; i <= 10 ; ++i) {
+        memset(sbuf, 0, sizeof sbuf);
+        sbuf[0] = i;
+        path[i] = redo_addposition(session, path[i - 1], 0, sbuf, i == 10,
+                                   redo_check);
+        assert(path[i]);
+    }
+    for (i = 0 ; i < 20 ; ++i) {
+        memset(sbuf, 0, sizeof sbuf);
+        sbuf[0] = 100 + i;
+        side[i] = redo_addposition(session, path[i / 2], 1 + i % 2, sbuf, 0,
+                                   redo_check);
+        assert(side[i]);
+    }
+    assert(redo_getsessionsize(session) == 31);
+    redo_keepposition(session, side[0], 1);
+    redo_visitposition(session, side[1]);
+    evictedcount = 0;
+    assert(redo_setevictfunction(session, countevicted) == NULL);
+
+    /* The nine oldest unprotected leaves are removed. */
+
+    assert(redo_setpositionlimit(session, 25) == 0);
+    assert(redo_getsessionsize(session) == 22);
+    redo_getsessionstats(session, &stats);
+    assert(stats.evictions == 9);
+    assert(evictedcount == 9);
+    assert(rootpos->solutionsize == 10);
+    for (i = 1 ; i <= 10 ; ++i)
+        assert(redo_findnextposition(path[i - 1], 0) == path[i]);
+    assert(redo_findnextposition(path[0], 1) == side[0]);
+    assert(redo_findnextposition(path[0], 2) == side[1]);
+    assert(redo_findnextposition(path[1], 1) == NULL);
+    assert(redo_findnextposition(path[5], 1) == NULL);
+    assert(redo_findnextposition(path[5], 2) == side[11]);
+
+    /* The limit is only applied again once it is exceeded. */
+
+    for (i = 0 ; i < 3 ; ++i) {
+        memset(sbuf, 0, sizeof sbuf);
+        sbuf[0] = 50 + i;
+        assert(redo_addposition(session, path[10], 1 + i, sbuf, 0,
+                                redo_check));
+    }
+    assert(redo_getsessionsize(session) == 25);
+    memset(sbuf, 0, sizeof sbuf);
+    sbuf[0] = 60;
+    assert(redo_addposition(session, path[10], 9, sbuf, 0, redo_check));
+    assert(redo_getsessionsize(session) == 22);
+    assert(redo_findnextposition(path[10], 9));
+    assert(evictedcount == 13);
+    assert(redo_setevictfunction(session, NULL) == countevicted);
+    assert(redo_setpositionlimit(session, 0) == 25);
+    teardown();
+}
+
+/* A hash function that gives every state the same value.
+ */
+static unsigned int constanthash(void const *state, int size)
+{
+    (void)state;
+    (void)size;
+    return 7;
+}
+
+/* Verify that equivalent positions are found regardless of the hash
+ * function in use, including when it is changed mid-session.
+ */
+static void test_hashfunctions(void)
+{
+    static redo_hashfunction *const hashfunctions[] = {
+        redo_hashcrc32c, redo_hashmix, redo_hashmeiyan, constanthash, NULL
+    };
+    redo_position *posA, *posB, *pos;
+    int i;
+
+    assert(redo_hashcrc32c("123456789", 9) == 0xE3069283);
+    assert(redo_hashmix("123456789", 9) != redo_hashmix("123456780", 9));
+
+    setup();
+    posA = addletter(session, rootpos, 'a', 'A', 0);
+    posB = addletter(session, posA, 'b', 'B', 0);
+    for (i = 0 ; i < (int)(sizeof hashfunctions / sizeof *hashfunctions) ;
+         ++i) {
+        redo_sethashfunction(session, hashfunctions[i]);
+        if (hashfunctions[i])
+            assert(redo_sethashfunction(session, hashfunctions[i]) ==
+                                        hashfunctions[i]);
+        pos = addletter(session, posB, 'c', 'A', 0);
+        assert(pos);
+        assert(pos->better == posA);
+        assert(!addletter(session, posB, 'd', 'D', 0)->better);
+        redo_dropposition(session, redo_getnextposition(posB, 'd'));
+        assert(redo_dropposition(session, pos) == posB);
+    }
+    assert(redo_getsessionsize(session) == 3);
+    teardown();
+}
+
+/* Verify that the session statistics reflect the session's contents
+ * and activity.
+ */
+static void test_stats(void)
+{
+    redo_sessionstats stats;
+    redo_position *pos1a, *pos2a, *pos1b;
+
+    setup();
+    redo_getsessionstats(session, &stats);
+    assert(stats.positions == 1);
+    assert(stats.branches == 0);
+    assert(stats.maxdepth == 0);
+    assert(stats.lookups == 0);
+    assert(stats.grafts == 0);
+    assert(stats.freepositions > 0);
+    assert(stats.positionbytes > 0);
+    assert(stats.hashsize > 0);
+    assert(stats.hashused == 1);
+
+    memset(sbuf, 's', sizeof sbuf);
+    pos1a = redo_addposition(session, rootpos, 'a', sbuf, 0, redo_check);
+    sbuf[0] = 'S';
+    pos2a = redo_addposition(session, pos1a, 'a', sbuf, 0, redo_check);
+    assert(pos2a);
+    redo_getsessionstats(session, &stats);
+    assert(stats.positions == 3);
+    assert(stats.branches == 2);
+    assert(stats.maxdepth == 2);
+    assert(stats.lookups == 2);
+    assert(stats.lookups == stats.hashrejects + stats.falsehits);
+
+    /* Find an equivalent position, causing a graft. */
+
+    pos1b = redo_addposition(session, rootpos, 'b', sbuf, 0, redo_check);
+    assert(pos1b);
+    assert(pos2a->better == pos1b);
+    redo_getsessionstats(session, &stats);
+    assert(stats.positions == 4);
+    assert(stats.lookups == 3);
+    assert(stats.comparisons >= 1);
+    assert(stats.probes >= stats.comparisons);
+    assert(stats.grafts == 1);
+    assert(stats.maxdepth == 2);
+
+    /* Verify that the counters are cleared by a reset. */
+
+    assert(redo_resetsession(session, sbuf));
+    redo_getsessionstats(session, &stats);
+    assert(stats.positions == 1);
+    assert(stats.lookups == 0);
+    assert(stats.probes == 0);
+    teardown();
+}
+
 int chkredo(void)
 {
     test_init();
@@ -698,5 +1421,16 @@ int chkredo(void)
     test_overall(redo_copypath);
     test_overall(redo_graftandcopy);
     test_endpoints();
+    test_fanout();
+    test_cycles();
+    test_merge();
+    test_addpath();
+    test_solutions();
+    test_shortest();
+    test_eviction();
+    test_hashfunctions();
+    test_stats();
+    test_reset();
+    test_limits();
     return 0;
 }
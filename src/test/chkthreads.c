@@ -0,0 +1,203 @@
+/* chkthreads.c: libredo multithreaded testing code.
+ *
+ * Copyright (C) 2013 by Brian Raiter. This program is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include "redo/redo.h"
+
+/* The number of threads of each kind to run at once, and the number
+ * of iterations for each thread to perform.
+ */
+#define THREAD_COUNT 8
+#define WRITER_STEPS 20000
+#define READER_STEPS 200000
+
+/* The size of the state data. The states are small enough that paths
+ * will frequently revisit them, exercising the equivalence checks.
+ */
+#define SIZE_STATE 8
+
+/* A session shared between the reader threads.
+ */
+static redo_session *sharedsession;
+
+/* A simple random-number generator that keeps its state in the
+ * caller's variable, so that threads do not share it.
+ */
+static unsigned int nextrandom(unsigned int *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return (*seed >> 16) & 0x7FFF;
+}
+
+/* Create a state for a given pair of coordinates.
+ */
+static void makestate(unsigned char *state, int x, int y)
+{
+    memset(state, 0, SIZE_STATE);
+    state[0] = x;
+    state[1] = y;
+}
+
+/* Grow and prune a private session, checking that it stays
+ * consistent. Every writer thread runs its own session, so that no
+ * locking is needed.
+ */
+static void *writerthread(void *data)
+{
+    unsigned char state[SIZE_STATE];
+    redo_session *session;
+    redo_position *pos, *next;
+    unsigned int seed;
+    int x, y, move, i, n;
+
+    seed = *(unsigned int*)data;
+    makestate(state, 0, 0);
+    session = redo_beginsession(state, SIZE_STATE, 0);
+    assert(session);
+    pos = redo_getfirstposition(session);
+    x = y = 0;
+    for (i = 0 ; i < WRITER_STEPS ; ++i) {
+        n = nextrandom(&seed) % 16;
+        if (n == 0) {
+            if (!pos->next && pos->prev) {
+                next = pos->prev;
+                assert(redo_dropposition(session, pos) == next);
+                pos = redo_getfirstposition(session);
+                x = y = 0;
+            }
+            continue;
+        } else if (n == 1 && pos->prev) {
+            pos = redo_getfirstposition(session);
+            x = y = 0;
+            continue;
+        }
+        move = nextrandom(&seed) % 4;
+        x += move == 0 ? 1 : move == 1 ? -1 : 0;
+        y += move == 2 ? 1 : move == 3 ? -1 : 0;
+        makestate(state, x, y);
+        if (redo_suppresscycle(session, &pos, state, 4))
+            continue;
+        next = redo_addposition(session, pos, move, state,
+                                x == 5 && y == 5, redo_check);
+        assert(next);
+        assert(next->prev == pos);
+        assert(!memcmp(redo_getsavedstate(next), state, SIZE_STATE));
+        assert(redo_getnextposition(pos, move) == next);
+        assert(pos->next[0].p == next);
+        pos = next;
+    }
+    assert(redo_getsessionsize(session) > 1);
+    makestate(state, 0, 0);
+    assert(redo_resetsession(session, state));
+    assert(redo_getsessionsize(session) == 1);
+    redo_endsession(session);
+    return NULL;
+}
+
+/* Walk randomly through the shared session, verifying that reading
+ * the session does not change it.
+ */
+static void *readerthread(void *data)
+{
+    redo_position *pos, *next;
+    redo_branch const *branch;
+    unsigned int seed;
+    int i;
+
+    seed = *(unsigned int*)data;
+    pos = redo_getfirstposition(sharedsession);
+    for (i = 0 ; i < READER_STEPS ; ++i) {
+        if (!pos->nextcount) {
+            pos = redo_getfirstposition(sharedsession);
+            continue;
+        }
+        branch = pos->next + nextrandom(&seed) % pos->nextcount;
+        next = redo_findnextposition(pos, branch->move);
+        assert(next == branch->p);
+        assert(next->prev == pos);
+        assert(next->movecount == pos->movecount + 1);
+        assert(redo_getsavedstate(next) != NULL);
+        pos = next;
+    }
+    return NULL;
+}
+
+/* Build the shared session. The branches of every position are
+ * ordered by move, so that the readers can verify that the order has
+ * not been altered.
+ */
+static void buildsharedsession(void)
+{
+    unsigned char state[SIZE_STATE];
+    redo_position *pos, *parent;
+    int depth, move;
+
+    makestate(state, 0, 0);
+    sharedsession = redo_beginsession(state, SIZE_STATE, 0);
+    assert(sharedsession);
+    parent = redo_getfirstposition(sharedsession);
+    for (depth = 1 ; depth <= 200 ; ++depth) {
+        pos = NULL;
+        for (move = 3 ; move >= 0 ; --move) {
+            makestate(state, depth, move);
+            pos = redo_addposition(sharedsession, parent, move, state, 0,
+                                   redo_nocheck);
+            assert(pos);
+        }
+        parent = pos;
+    }
+}
+
+/* Verify that the shared session is as it was built.
+ */
+static void checksharedsession(void)
+{
+    redo_position *pos;
+    int move;
+
+    assert(redo_getsessionsize(sharedsession) == 801);
+    pos = redo_getfirstposition(sharedsession);
+    while (pos->nextcount) {
+        assert(pos->nextcount == 4);
+        for (move = 0 ; move < 4 ; ++move)
+            assert(pos->next[move].move == move);
+        pos = pos->next[0].p;
+    }
+    assert(pos->movecount == 200);
+}
+
+/* Run writer threads, each with its own session, alongside reader
+ * threads that share a single session.
+ */
+int chkthreads(void)
+{
+    pthread_t writers[THREAD_COUNT], readers[THREAD_COUNT];
+    unsigned int seeds[2 * THREAD_COUNT];
+    int i;
+
+    buildsharedsession();
+    checksharedsession();
+    for (i = 0 ; i < 2 * THREAD_COUNT ; ++i)
+        seeds[i] = i + 1;
+    for (i = 0 ; i < THREAD_COUNT ; ++i) {
+        assert(!pthread_create(writers + i, NULL, writerthread, seeds + i));
+        assert(!pthread_create(readers + i, NULL, readerthread,
+                               seeds + THREAD_COUNT + i));
+    }
+    for (i = 0 ; i < THREAD_COUNT ; ++i) {
+        assert(!pthread_join(writers[i], NULL));
+        assert(!pthread_join(readers[i], NULL));
+    }
+    checksharedsession();
+    redo_endsession(sharedsession);
+    return 0;
+}
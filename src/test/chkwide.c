@@ -0,0 +1,84 @@
+/* chkwide.c: libredo testing code for the wide-counter build.
+ *
+ * Copyright (C) 2013 by Brian Raiter. This program is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "redo/redo.h"
+
+/* The length of the path used to exceed the 16-bit limits.
+ */
+#define PATH_LENGTH 70000
+
+/* Verify that large states are accepted.
+ */
+static void test_statesize(void)
+{
+    redo_session *session;
+    char *buf;
+
+    buf = calloc(1, 100000);
+    assert(buf);
+    session = redo_beginsession(buf, 100000, 0);
+    assert(session);
+    buf[99999] = 1;
+    assert(redo_addposition(session, redo_getfirstposition(session), 1,
+                            buf, 0, redo_check));
+    assert(redo_getsessionsize(session) == 2);
+    redo_endsession(session);
+    free(buf);
+}
+
+/* Verify that move counts and solution sizes are not truncated when
+ * a path grows past 65535 moves.
+ */
+static void test_longpath(void)
+{
+    redo_session *session;
+    redo_position *root, *pos, *shortcut;
+    int state, i;
+
+    state = 0;
+    session = redo_beginsession(&state, sizeof state, 0);
+    assert(session);
+    root = redo_getfirstposition(session);
+    assert(redo_setgraftbehavior(session, redo_graft) == redo_graft);
+
+    pos = root;
+    for (i = 1 ; i <= PATH_LENGTH ; ++i) {
+        state = i;
+        pos = redo_addposition(session, pos, 'a', &state, i == PATH_LENGTH,
+                               redo_check);
+        assert(pos);
+        assert(pos->movecount == (redo_count)i);
+    }
+    assert(pos->endpoint);
+    assert(root->solutionend == 1);
+    assert(root->solutionsize == PATH_LENGTH);
+    assert(redo_getsessionsize(session) == PATH_LENGTH + 1);
+
+    /* Graft the tail of the path onto a shortcut from the root. */
+
+    state = PATH_LENGTH - 1000;
+    shortcut = redo_addposition(session, root, 'b', &state, 0, redo_check);
+    assert(shortcut);
+    assert(shortcut->movecount == 1);
+    assert(shortcut->solutionsize == 1001);
+    assert(root->solutionsize == 1001);
+    assert(pos->movecount == 1001);
+
+    redo_endsession(session);
+}
+
+int chkwide(void)
+{
+    test_statesize();
+    test_longpath();
+    return 0;
+}
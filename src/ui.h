@@ -31,6 +31,7 @@ struct renderparams {
     gameplayinfo const *gameplay;       /* the state of the game */
     redo_position const *position;      /* the current redo position */
     int bookmark;                       /* true if a bookmark exists */
+    redo_sessionstats const *stats;     /* statistics to show, or NULL */
 };
 
 /* The set of functions that a user interface provides.